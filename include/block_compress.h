@@ -0,0 +1,37 @@
+#pragma once
+
+#include "utils.h"
+#include "thread_pool.h"
+
+// Pixel formats of baked textures. The BC formats store 4x4 blocks.
+enum TexFormat {
+  TEX_FORMAT_RGBA8 = 0,
+  // RGB at 4 bits per pixel, alpha is dropped
+  TEX_FORMAT_BC1,
+  // BC1 color plus interpolated alpha, 8 bits per pixel
+  TEX_FORMAT_BC3,
+  // RGBA at 8 bits per pixel, higher quality than BC3. Only mode 6 blocks
+  // are written and decoded.
+  TEX_FORMAT_BC7,
+  TEX_FORMAT_COUNT
+};
+
+const char* tex_format_name(TexFormat format);
+VkFormat tex_format_vk(TexFormat format);
+// Returns false for VkFormats that are not a TexFormat
+bool tex_format_from_vk(VkFormat vk_format, TexFormat& out_format);
+bool tex_format_is_block(TexFormat format);
+
+// Bytes of a w x h image in the format, partial blocks included
+size_t tex_image_size(TexFormat format, uint32_t w, uint32_t h);
+
+// Compresses a w x h RGBA8 image into dst, which must hold
+// tex_image_size bytes. Edge blocks repeat the last row and column.
+// Block rows are spread over threads if given.
+void encode_tex_blocks(const uint8_t* rgba, uint32_t w, uint32_t h,
+    TexFormat format, uint8_t* dst, ThreadPool* threads);
+
+// The reverse, for devices without BC support. Returns false on blocks
+// the decoder does not handle.
+bool decode_tex_blocks(const uint8_t* blocks, uint32_t w, uint32_t h,
+    TexFormat format, uint8_t* rgba);
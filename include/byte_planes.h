@@ -0,0 +1,17 @@
+#pragma once
+
+#include "utils.h"
+
+// Lossless coding for arrays of words whose high bytes are mostly zero,
+// such as the XOR or difference of similar values. The words are split
+// into byte planes, lowest byte first, and the runs of zero bytes are
+// run-length encoded with varints.
+
+// Appends the encoding of num_words words of word_size bytes
+void encode_byte_planes(const void* words, size_t num_words,
+    size_t word_size, vector<uint8_t>& out_bytes);
+
+// Decodes num_words words from bytes into out_words. Returns the number
+// of bytes consumed, which is 0 for malformed input or no words.
+size_t decode_byte_planes(const uint8_t* bytes, size_t num_bytes,
+    size_t num_words, size_t word_size, void* out_words);
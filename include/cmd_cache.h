@@ -0,0 +1,44 @@
+#pragma once
+
+#include "utils.h"
+
+struct CmdCacheEntry {
+  VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+  // what the contents were recorded for
+  uint64_t key = 0;
+  uint64_t generation = 0;
+};
+
+// Secondary command buffers that are recorded once and executed by many
+// primaries. An entry is re-recorded only when its key changes or the
+// cache is invalidated, e.g. because the geometry, pipeline or swapchain
+// changed.
+//
+// An entry may not be re-recorded while a submission that executes it is
+// in flight, so callers typically keep one entry per frame in flight.
+struct CmdCache {
+  VkDevice device = VK_NULL_HANDLE;
+  VkCommandPool cmd_pool = VK_NULL_HANDLE;
+  vector<CmdCacheEntry> entries;
+  // entries recorded in an older generation are stale
+  uint64_t generation = 1;
+
+  uint64_t num_hits = 0;
+  uint64_t num_records = 0;
+};
+
+void init_cmd_cache(CmdCache& cache, VkDevice device,
+    uint32_t queue_family_index, uint32_t num_entries);
+void cleanup_cmd_cache(CmdCache& cache);
+
+// Marks every entry as stale
+void invalidate_cmd_cache(CmdCache& cache);
+
+// Returns the entry's command buffer in out_cmd_buffer. If the entry is
+// stale or was recorded with a different key, it is reset and begun as a
+// secondary inside render_pass, and true is returned. The caller must then
+// record into it and call cmd_cache_end.
+bool cmd_cache_begin(CmdCache& cache, uint32_t index, uint64_t key,
+    VkRenderPass render_pass, uint32_t subpass,
+    VkCommandBuffer& out_cmd_buffer);
+void cmd_cache_end(CmdCache& cache, uint32_t index);
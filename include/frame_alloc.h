@@ -0,0 +1,61 @@
+#pragma once
+
+#include "utils.h"
+#include "mem_alloc.h"
+
+// Bytes each frame in flight may bump-allocate from the frame allocator
+const VkDeviceSize FRAME_ALLOC_SIZE = 1024 * 1024;
+
+// Bytes handed out by frame_alloc. Bind (buffer, offset) as a dynamic
+// uniform buffer offset, write through data.
+struct FrameRegion {
+  uint32_t offset = 0;
+  void* data = nullptr;
+};
+
+// A single persistently mapped buffer split into one FrameArena per frame
+// in flight. One buffer rather than one per frame, so that a single
+// descriptor set with a dynamic offset serves every frame.
+struct FrameAllocator {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  MemAlloc buffer_mem;
+  char* data = nullptr;
+
+  uint32_t num_frames = 0;
+  VkDeviceSize frame_size = 0;
+  // minUniformBufferOffsetAlignment, so every region can be a dynamic offset
+  VkDeviceSize alignment = 1;
+};
+
+// One frame's slice of the frame allocator, owned by its FrameContext.
+// Allocations are bump-allocated and the whole arena is reset when its
+// frame comes around again, so nothing is freed individually and nothing
+// is mapped per frame.
+//
+// The caller must make sure the GPU is done with the arena, e.g. by
+// waiting on the frame's fence, before resetting it.
+struct FrameArena {
+  char* data = nullptr;
+  // of the slice within the frame allocator's buffer
+  VkDeviceSize base = 0;
+  VkDeviceSize size = 0;
+  VkDeviceSize alignment = 1;
+
+  VkDeviceSize head = 0;
+  // high water mark of a single frame, for sizing FRAME_ALLOC_SIZE
+  VkDeviceSize peak_used = 0;
+};
+
+void init_frame_allocator(FrameAllocator& frame_allocator,
+    MemAllocator& allocator, uint32_t num_frames, VkDeviceSize frame_size,
+    VkBufferUsageFlags usage);
+void cleanup_frame_allocator(FrameAllocator& frame_allocator,
+    MemAllocator& allocator);
+
+// The arena over the slice of frame_index
+FrameArena frame_allocator_slice(const FrameAllocator& frame_allocator,
+    uint32_t frame_index);
+void frame_arena_reset(FrameArena& arena);
+
+// Bump-allocates size bytes from the arena
+FrameRegion frame_alloc(FrameArena& arena, VkDeviceSize size);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "utils.h"
+#include "upload.h"
+#include "frame_alloc.h"
+
+// Everything one frame in flight owns. Nothing in it is touched again until
+// the frame's fence signals, at which point all of it is recycled at once:
+// the command pool is reset as a whole, the upload semaphores go back to
+// the uploader and the frame's arena is reset.
+struct FrameContext {
+  uint32_t index = 0;
+
+  // transient pool for the commands recorded fresh every frame
+  VkCommandPool cmd_pool = VK_NULL_HANDLE;
+  VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+  VkCommandBuffer overlay_cmd_buffer = VK_NULL_HANDLE;
+
+  VkFence in_flight_fence = VK_NULL_HANDLE;
+  VkSemaphore img_available_sema = VK_NULL_HANDLE;
+  VkSemaphore render_done_sema = VK_NULL_HANDLE;
+
+  // upload semaphores the frame's submission waited on
+  vector<VkSemaphore> upload_semas;
+  // the frame's uniform data, its slice of the frame allocator
+  FrameArena arena;
+};
+
+void init_frame_context(FrameContext& frame, VkDevice device,
+    uint32_t queue_family_index, uint32_t index);
+void cleanup_frame_context(FrameContext& frame, VkDevice device,
+    Uploader& uploader);
+
+// Waits for the frame's previous submission, then recycles what it owned
+void begin_frame_context(FrameContext& frame, VkDevice device,
+    Uploader& uploader);
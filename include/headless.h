@@ -0,0 +1,16 @@
+#pragma once
+
+#include "utils.h"
+
+// A device with a compute queue and no surface, for running the
+// simulation without a window
+struct HeadlessVulkan {
+  VkInstance inst = VK_NULL_HANDLE;
+  VkPhysicalDevice phys_device = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t queue_family_index = 0;
+  VkQueue queue = VK_NULL_HANDLE;
+};
+
+void init_headless_vulkan(HeadlessVulkan& hv);
+void cleanup_headless_vulkan(HeadlessVulkan& hv);
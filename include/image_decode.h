@@ -0,0 +1,49 @@
+#pragma once
+
+#include "utils.h"
+#include "mipmaps.h"
+#include "staging.h"
+#include "thread_pool.h"
+#include "upload.h"
+
+#include <functional>
+
+// Staging memory one wave of decodes may take. With half the ring, a wave
+// always fits once the earlier waves retire, so a wave never has to submit
+// its own regions before their copies are recorded.
+const VkDeviceSize IMAGE_DECODE_WAVE_SIZE = STAGING_RING_SIZE / 2;
+
+// An image decoded into staging memory, as RGBA8
+struct DecodedImage {
+  // into the paths passed to decode_images
+  uint32_t index = 0;
+  bool ok = false;
+  uint32_t w = 0;
+  uint32_t h = 0;
+  StagingRegion staging;
+  // the levels within staging, only the base level unless mips were asked
+  // for
+  vector<MipLevel> levels;
+};
+
+typedef function<void(DecodedImage& image)> DecodedImageFn;
+
+struct ImageDecodeStats {
+  uint32_t num_images = 0;
+  uint32_t num_failed = 0;
+  uint32_t num_waves = 0;
+  VkDeviceSize decoded_bytes = 0;
+};
+
+// Decodes the images at paths on threads, straight into staging memory of
+// uploader, building their mip chains as well if mips is set.
+//
+// Images go in waves of at most IMAGE_DECODE_WAVE_SIZE bytes. The files
+// are mapped and their headers parsed in parallel, then for each wave the
+// staging memory is allocated on the calling thread, the pixels are
+// decoded in parallel, and on_decoded is called on the calling thread for
+// each image of the wave in order. It must record the copies out of
+// image.staging into uploader before returning. An image larger than the
+// staging ring cannot be decoded.
+ImageDecodeStats decode_images(Uploader& uploader, ThreadPool& threads,
+    const vector<string>& paths, bool mips, const DecodedImageFn& on_decoded);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "utils.h"
+
+// How a mapped file will be read, passed on to the kernel with madvise
+enum FileAccess {
+  // front to back, about once: read ahead eagerly and start right away
+  FILE_ACCESS_SEQUENTIAL,
+  // scattered reads of parts of the file: no read-ahead past the pages
+  // touched, so use advise_mapped_file before reading a range
+  FILE_ACCESS_RANDOM
+};
+
+// A whole file mapped read-only. The bytes are paged in from the page
+// cache on first touch rather than copied into a buffer, and stay valid
+// until close_mapped_file.
+struct MappedFile {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+// Returns false, with nothing to close, if the file cannot be opened or
+// mapped. An empty file opens with no data.
+bool open_mapped_file(MappedFile& file, const string& path,
+    FileAccess access);
+void close_mapped_file(MappedFile& file);
+
+// Asks for size bytes at offset to be read in ahead of their use
+void advise_mapped_file(const MappedFile& file, size_t offset, size_t size);
+
+// Maps the SPIR-V at path just long enough to create the module. Throws
+// if the file is missing or empty.
+VkShaderModule load_shader_module(VkDevice device, const string& path);
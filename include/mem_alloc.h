@@ -0,0 +1,85 @@
+#pragma once
+
+#include "utils.h"
+
+// Size of each VkDeviceMemory block that sub-allocations are carved from.
+// Requests larger than this get a block of their own.
+const VkDeviceSize MEM_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// Resources with linear and optimal tiling are kept in separate blocks so
+// that bufferImageGranularity never has to be considered between neighbours
+enum MemTiling {
+  MEM_TILING_LINEAR = 0,
+  MEM_TILING_OPTIMAL = 1,
+  MEM_TILING_COUNT
+};
+
+struct MemRange {
+  VkDeviceSize offset;
+  VkDeviceSize size;
+};
+
+struct MemBlock {
+  VkDeviceMemory mem = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  VkDeviceSize used = 0;
+  uint32_t num_allocs = 0;
+  // host-visible blocks are mapped once, when the block is created
+  void* mapped = nullptr;
+  // sized for a single request rather than MEM_BLOCK_SIZE. Such a block is
+  // released as soon as it is empty, as later requests rarely fit it.
+  bool dedicated = false;
+  // sorted by offset, adjacent ranges are always merged
+  vector<MemRange> free_ranges;
+};
+
+// A sub-range of a MemBlock. The (mem, offset) pair is what gets passed to
+// vkBind*Memory.
+struct MemAlloc {
+  VkDeviceMemory mem = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  uint32_t type_index = 0;
+  uint32_t tiling = MEM_TILING_LINEAR;
+  uint32_t block_index = 0;
+  // non-null if the memory is host-visible
+  void* mapped = nullptr;
+};
+
+struct MemHeapStats {
+  uint32_t num_blocks = 0;
+  uint32_t num_allocs = 0;
+  VkDeviceSize block_bytes = 0;
+  VkDeviceSize used_bytes = 0;
+};
+
+struct MemAllocator {
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDevice phys_device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties mem_props;
+  // indexed by [memory type][tiling]. Released blocks leave an empty slot
+  // behind so that block indices held by live allocations stay valid.
+  array<array<vector<MemBlock>, MEM_TILING_COUNT>, VK_MAX_MEMORY_TYPES> pools;
+  // number of live vkAllocateMemory allocations
+  uint32_t num_device_allocs = 0;
+};
+
+uint32_t find_mem_type_index(VkPhysicalDevice& phys_device,
+    uint32_t type_filter,
+    VkMemoryPropertyFlags target_mem_flags);
+
+void init_mem_allocator(MemAllocator& allocator,
+    VkPhysicalDevice phys_device, VkDevice device);
+void cleanup_mem_allocator(MemAllocator& allocator);
+
+MemAlloc alloc_mem(MemAllocator& allocator, const VkMemoryRequirements& reqs,
+    VkMemoryPropertyFlags props, MemTiling tiling);
+void free_mem(MemAllocator& allocator, MemAlloc& alloc);
+
+// Releases blocks that no longer hold any allocations, e.g. after buffers
+// are reallocated. Live allocations are never moved since that would
+// require rebinding the resources that use them.
+void release_empty_mem_blocks(MemAllocator& allocator);
+
+vector<MemHeapStats> get_mem_heap_stats(MemAllocator& allocator);
+void log_mem_stats(MemAllocator& allocator);
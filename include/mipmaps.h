@@ -0,0 +1,57 @@
+#pragma once
+
+#include "utils.h"
+
+// Where a level of an RGBA8 mip chain lives in a packed buffer
+struct MipLevel {
+  VkDeviceSize offset;
+  uint32_t w;
+  uint32_t h;
+};
+
+// Levels of a full chain, down to 1x1
+uint32_t mip_level_count(uint32_t w, uint32_t h);
+
+// Packs the levels of an RGBA8 chain one after another. Returns the total
+// size in bytes.
+VkDeviceSize layout_mip_chain(uint32_t w, uint32_t h, uint32_t num_levels,
+    vector<MipLevel>& out_levels);
+
+// Whether vkCmdBlitImage can filter linearly between levels of optimally
+// tiled images of the format
+bool supports_linear_blit(VkPhysicalDevice phys_device, VkFormat format);
+
+// Records blits from each level to the next. Every level must be in
+// TRANSFER_DST_OPTIMAL with level 0 written, and the image must have been
+// created with TRANSFER_SRC usage. Every level is left in
+// TRANSFER_DST_OPTIMAL, so a single barrier over all levels releases the
+// image as it would without mips. Needs a graphics queue.
+void record_mip_blits(VkCommandBuffer cmd_buffer, VkImage image,
+    uint32_t w, uint32_t h, uint32_t num_levels);
+
+// Box filters an RGBA8 image to half size, rounding down odd sizes. Uses
+// SSE2 where available.
+void downsample_rgba8(const uint8_t* src, uint32_t w, uint32_t h,
+    uint8_t* dst);
+void downsample_rgba8_scalar(const uint8_t* src, uint32_t w, uint32_t h,
+    uint8_t* dst);
+
+// The CPU fallback to record_mip_blits. Writes every level of pixels into
+// dst, laid out as layout_mip_chain says.
+void gen_mip_chain(const uint8_t* pixels, const vector<MipLevel>& levels,
+    uint8_t* dst);
+
+// Texture traffic of drawing a w x h texture minified onto a square of
+// screen_size pixels, one bilinear sample per pixel. Texels are assumed
+// tiled in 4x4 blocks, one 64 byte line each, as GPUs lay out RGBA8.
+struct MipSampling {
+  uint32_t level = 0;
+  // distinct lines touched, the traffic with an unbounded cache
+  uint64_t unique_bytes = 0;
+  // lines fetched through a 16KB, 4-way LRU texture cache, walking the
+  // pixels in 8x8 tiles like a rasterizer
+  uint64_t fetched_bytes = 0;
+};
+
+MipSampling model_mip_sampling(uint32_t w, uint32_t h, uint32_t screen_size,
+    bool use_mips);
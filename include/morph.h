@@ -0,0 +1,93 @@
+#pragma once
+
+#include "utils.h"
+
+// The number of per-node buffers: pos, vel, neighbors, data
+const int MORPH_BUF_COUNT = 4;
+
+// Budget for each node buffer set, in bytes
+const size_t MORPH_NODE_BUDGET = (size_t) 1e8;
+
+struct MorphNode {
+  vec4 pos;
+  vec4 vel;
+  // indices of the right, upper, left and lower neighbors, -1 for none
+  vec4 neighbors;
+  vec4 data;
+
+  MorphNode() {}
+  MorphNode(vec4 pos, vec4 vel, vec4 neighbors, vec4 data) :
+    pos(pos), vel(vel), neighbors(neighbors), data(data) {}
+};
+
+// The maximum # of morph nodes in the full node format. See
+// max_morph_nodes for the others.
+const int MAX_NUM_MORPH_NODES =
+  (int) (MORPH_NODE_BUDGET / (float) sizeof(MorphNode));
+
+// Nodes stored as one array per member, matching the GPU buffers
+struct MorphNodes {
+  vector<vec4> pos_vec;
+  vector<vec4> vel_vec;
+  vector<vec4> neighbors_vec;
+  vector<vec4> data_vec;
+
+  MorphNodes() {}
+  MorphNodes(size_t num_nodes);
+  MorphNodes(const vector<MorphNode>& nodes);
+
+  size_t size() const { return pos_vec.size(); }
+  MorphNode node_at(size_t i) const;
+  // the arrays in buffer order
+  array<vec4*, MORPH_BUF_COUNT> buffers();
+};
+
+// Parameters of the update rule, shared by the GPU and CPU simulations.
+// user[0] is (growth, smoothing, damping, time step), the rest is unused.
+const int MORPH_NUM_USER_PARAMS = 4;
+typedef array<vec4, MORPH_NUM_USER_PARAMS> MorphUserParams;
+
+MorphUserParams default_morph_params();
+
+// The simulation controls of the dev console
+struct MorphControls {
+  int num_zygote_samples = 10;
+  // a MorphShape
+  int zygote_shape = 0;
+  // generate the zygote with a compute shader rather than on the host and
+  // uploading it. Only applies to MorphSim, and not when reordering.
+  bool gpu_zygote = true;
+  int num_iters = 0;
+
+  bool animating_sim = false;
+  // continue from the previous frame's state instead of rerunning from the
+  // zygote
+  bool incremental = true;
+  int start_iter_num = 0;
+  int end_iter_num = 1000;
+  int delta_iters = 1;
+  bool loop_at_end = false;
+
+  // a MorphOrdering, applied to the zygote
+  int ordering = 0;
+  // when above zero, run_morph_pipeline and run_morph_cpu_pipeline also
+  // reorder the live state every reorder_interval iterations
+  int reorder_interval = 0;
+
+  bool log_input_nodes = false;
+  bool log_output_nodes = false;
+  bool log_render_data = false;
+  bool log_durations = false;
+  // gather locality before and after each reorder
+  bool log_locality = false;
+};
+
+string raw_node_str(const MorphNode& node);
+void log_nodes(const MorphNodes& node_vecs);
+
+vec3 gen_sphere(vec2 unit);
+vec3 gen_square(vec2 unit);
+vec3 gen_plane(vec2 unit);
+
+// Returns -1 if the coord is outside the plane
+int coord_to_index(ivec2 coord, ivec2 samples);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "utils.h"
+#include "morph.h"
+
+#include <fstream>
+#include <map>
+
+// Memory for checkpoints held in RAM
+const size_t MORPH_CHECKPOINT_BUDGET = 256 * 1024 * 1024;
+
+struct MorphCheckpoint {
+  // empty while the checkpoint only lives in the spill file
+  MorphNodes nodes;
+  bool in_memory = false;
+  size_t num_nodes = 0;
+  // where the compressed copy is, if it was ever spilled. Spilled data
+  // never changes, so reloading keeps the copy for the next eviction.
+  bool on_disk = false;
+  uint64_t file_offset = 0;
+  uint64_t file_size = 0;
+  uint64_t last_use = 0;
+};
+
+// Simulation states keyed by iteration number. Once the in-memory
+// checkpoints exceed the budget, the least recently used ones are written
+// to the spill file in compressed form, or dropped if there is none.
+struct CheckpointStore {
+  size_t mem_budget = MORPH_CHECKPOINT_BUDGET;
+  size_t mem_used = 0;
+  map<int, MorphCheckpoint> checkpoints;
+  uint64_t use_clock = 0;
+
+  // empty to drop evicted checkpoints instead
+  string spill_path;
+  fstream spill_file;
+  uint64_t spill_end = 0;
+
+  uint64_t num_spills = 0;
+  uint64_t num_reloads = 0;
+  uint64_t num_drops = 0;
+  uint64_t spilled_bytes = 0;
+};
+
+void init_checkpoint_store(CheckpointStore& store, size_t mem_budget,
+    const string& spill_path);
+// Also deletes the spill file
+void cleanup_checkpoint_store(CheckpointStore& store);
+void clear_checkpoint_store(CheckpointStore& store);
+
+size_t checkpoint_store_size(const CheckpointStore& store);
+bool checkpoint_store_has(const CheckpointStore& store, int iter_num);
+void checkpoint_store_put(CheckpointStore& store, int iter_num,
+    MorphNodes&& nodes);
+
+// Returns the iteration of the nearest checkpoint at or below iter_num, or
+// -1 if there is none
+int checkpoint_store_find(const CheckpointStore& store, int iter_num);
+// Returns the checkpoint at iter_num, reloading it if it was spilled. The
+// reference stays valid until the next call on the store.
+MorphNodes& checkpoint_store_get(CheckpointStore& store, int iter_num);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "utils.h"
+#include "morph.h"
+#include "morph_format.h"
+#include "thread_pool.h"
+#include "morph_zygote.h"
+
+// Nodes per task. Several tasks per worker keep the load balanced.
+const uint32_t MORPH_CPU_CHUNK_SIZE = 4096;
+
+// The update rule of morph.comp on the CPU, for checking the GPU results
+// and for machines without a GPU. Double buffered like MorphSim: each
+// iteration reads one node set and writes the other.
+struct MorphCpuSim {
+  ThreadPool* threads = nullptr;
+  MorphNodeFormat format = MORPH_FORMAT_FULL;
+  array<MorphNodeBuffers, 2> node_sets;
+  // the node set holding the latest state
+  uint32_t cur_set = 0;
+  int iter_num = 0;
+  MorphUserParams user_params;
+};
+
+void init_morph_cpu_sim(MorphCpuSim& sim, ThreadPool& threads,
+    MorphNodeFormat format);
+void cleanup_morph_cpu_sim(MorphCpuSim& sim);
+
+// Replaces the simulation state and resets the iteration count
+void morph_cpu_sim_write_nodes(MorphCpuSim& sim, const MorphNodes& node_vecs);
+// Generates the zygote straight into the node buffers
+void morph_cpu_sim_write_zygote(MorphCpuSim& sim, ivec2 samples,
+    MorphShapeFn shape, vector<uint32_t>& out_indices);
+MorphNodes morph_cpu_sim_read_nodes(MorphCpuSim& sim);
+
+void morph_cpu_sim_run(MorphCpuSim& sim, int num_iters);
+
+// Same as run_morph_pipeline, on the CPU
+void run_morph_cpu_pipeline(MorphCpuSim& sim, MorphControls& controls);
+
+// One iteration over the nodes in [first, end), reading in and writing
+// out. Both must have the same format and size.
+void morph_cpu_sim_step(const MorphNodeBuffers& in, MorphNodeBuffers& out,
+    const MorphUserParams& user_params, size_t first, size_t end);
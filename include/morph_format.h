@@ -0,0 +1,54 @@
+#pragma once
+
+#include "utils.h"
+#include "morph.h"
+
+// packed_vec3, a vec3 without the padding of the aligned gentypes
+#include "glm/gtc/type_aligned.hpp"
+
+// How the node buffers are laid out in memory, on the CPU and the GPU
+enum MorphNodeFormat {
+  // four vec4s per node, neighbor indices stored as floats
+  MORPH_FORMAT_FULL = 0,
+  // only what the update rule uses: the xyz of pos and vel as packed
+  // floats, neighbor indices as uint32 with MORPH_NO_NEIGHBOR for none,
+  // and the x of data. The dropped components read back as zero.
+  MORPH_FORMAT_COMPACT,
+  // compact, with vel packed as half floats
+  MORPH_FORMAT_COMPACT_HALF,
+  MORPH_FORMAT_COUNT
+};
+
+const uint32_t MORPH_NO_NEIGHBOR = 0xffffffff;
+
+const char* morph_format_name(MorphNodeFormat format);
+// Bytes per node of each of the pos, vel, neighbors and data buffers
+array<uint32_t, MORPH_BUF_COUNT> morph_buffer_strides(MorphNodeFormat format);
+uint32_t morph_bytes_per_node(MorphNodeFormat format);
+// The most nodes that fit in MORPH_NODE_BUDGET
+size_t max_morph_nodes(MorphNodeFormat format);
+
+// Node buffers in any format. The storage is in 16 byte units so that
+// every buffer is suitably aligned for SIMD loads.
+struct MorphNodeBuffers {
+  MorphNodeFormat format = MORPH_FORMAT_FULL;
+  size_t num_nodes = 0;
+  array<vector<uvec4>, MORPH_BUF_COUNT> bufs;
+
+  size_t size() const { return num_nodes; }
+  array<void*, MORPH_BUF_COUNT> ptrs();
+  array<const void*, MORPH_BUF_COUNT> ptrs() const;
+};
+
+void resize_morph_buffers(MorphNodeBuffers& buffers, MorphNodeFormat format,
+    size_t num_nodes);
+
+// Converts between MorphNodes and the buffers of a format. dst and src
+// point at one buffer per member, each num_nodes * stride bytes.
+void pack_morph_nodes(const MorphNodes& nodes, MorphNodeFormat format,
+    const array<void*, MORPH_BUF_COUNT>& dst);
+void unpack_morph_nodes(const array<const void*, MORPH_BUF_COUNT>& src,
+    MorphNodeFormat format, size_t num_nodes, MorphNodes& out_nodes);
+// Converts one buffer, buf_index in pos, vel, neighbors, data order
+void unpack_morph_buffer(const void* src, MorphNodeFormat format,
+    int buf_index, size_t num_nodes, vector<vec4>& out);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "utils.h"
+#include "mem_alloc.h"
+#include "morph_sim.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Bits of MorphReadback requests, in buffer order
+const uint32_t MORPH_READBACK_POS = 1 << 0;
+const uint32_t MORPH_READBACK_VEL = 1 << 1;
+const uint32_t MORPH_READBACK_NEIGHBORS = 1 << 2;
+const uint32_t MORPH_READBACK_DATA = 1 << 3;
+const uint32_t MORPH_READBACK_ALL = (1 << MORPH_BUF_COUNT) - 1;
+
+// A delivered snapshot. Buffers that were not requested are left empty.
+struct MorphReadbackResult {
+  int iter_num = 0;
+  uint32_t buf_mask = 0;
+  MorphNodes nodes;
+};
+
+// The consumer owns result and may move its buffers out
+typedef function<void(MorphReadbackResult& result)> MorphReadbackFn;
+
+enum MorphReadbackSlotState {
+  MORPH_SLOT_FREE = 0,
+  // the copy is submitted and its fence has not been seen signaled
+  MORPH_SLOT_IN_FLIGHT,
+  // the consumer thread is reading the mapped memory
+  MORPH_SLOT_CONSUMING
+};
+
+struct MorphReadbackSlot {
+  // host-visible, one region of capacity * sizeof(vec4) bytes per buffer
+  VkBuffer buffer = VK_NULL_HANDLE;
+  MemAlloc buffer_mem;
+  uint32_t capacity = 0;
+  VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+  VkFence fence = VK_NULL_HANDLE;
+  atomic<int> state{MORPH_SLOT_FREE};
+
+  // what the copy in the slot holds
+  int iter_num = 0;
+  uint32_t num_nodes = 0;
+  uint32_t buf_mask = 0;
+  MorphNodeFormat format = MORPH_FORMAT_FULL;
+};
+
+// Copies simulation buffers into host-visible memory without waiting for
+// them. Each request goes into its own slot, so with one slot per frame in
+// flight a copy is normally done by the time its slot comes around again.
+// Finished slots are unpacked and handed to consume on a separate thread.
+// Requests that find their slot still busy are dropped rather than
+// stalling the caller, unless it waits with morph_readback_wait first.
+struct MorphReadback {
+  MemAllocator* allocator = nullptr;
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueue queue = VK_NULL_HANDLE;
+  VkCommandPool cmd_pool = VK_NULL_HANDLE;
+  vector<unique_ptr<MorphReadbackSlot>> slots;
+  uint32_t next_slot = 0;
+
+  MorphReadbackFn consume;
+  thread consumer;
+  mutex lock;
+  condition_variable ready_cv;
+  // signaled when the consumer frees a slot
+  condition_variable free_cv;
+  // slots waiting for the consumer, oldest first
+  deque<uint32_t> ready;
+  bool stopping = false;
+
+  // stats
+  uint64_t num_requested = 0;
+  uint64_t num_dropped = 0;
+  atomic<uint64_t> num_delivered{0};
+};
+
+void init_morph_readback(MorphReadback& readback, MemAllocator& allocator,
+    uint32_t queue_family_index, VkQueue queue, uint32_t num_slots,
+    const MorphReadbackFn& consume);
+// Waits for copies in flight and for the consumer to finish
+void cleanup_morph_readback(MorphReadback& readback);
+
+// Submits a copy of the buffers in buf_mask of the sim's current state.
+// The sim's earlier and later submissions must go to the same queue. Returns
+// false if the request was dropped.
+bool morph_readback_request(MorphReadback& readback, MorphSim& sim,
+    uint32_t buf_mask);
+// Hands every finished copy to the consumer thread. Never blocks, call it
+// once per frame.
+void morph_readback_poll(MorphReadback& readback);
+// Waits until the next request has a free slot, for offline use where a
+// stall is better than a dropped request
+void morph_readback_wait(MorphReadback& readback);
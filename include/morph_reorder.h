@@ -0,0 +1,55 @@
+#pragma once
+
+#include "utils.h"
+#include "morph.h"
+#include "morph_sim.h"
+#include "morph_cpu_sim.h"
+
+// Node orderings for the reorder pass
+enum MorphOrdering {
+  MORPH_ORDER_NONE = 0,
+  // Morton (Z-order) curve over the current positions
+  MORPH_ORDER_MORTON,
+  // reverse Cuthill-McKee over the neighbor graph, which minimizes the
+  // index distance between neighbors
+  MORPH_ORDER_RCM,
+  MORPH_ORDER_COUNT
+};
+
+const char* morph_ordering_name(MorphOrdering ordering);
+
+// Gather locality of one iteration over the nodes, in node order. The
+// cache is a model of a 32KB, 8-way L1 with 64 byte lines, fed with the
+// pos reads of every node and its neighbors.
+struct MorphLocality {
+  double mean_neighbor_distance = 0.0;
+  uint32_t max_neighbor_distance = 0;
+  double cache_miss_rate = 0.0;
+  // distinct pos cache lines gathered per group of MORPH_WORKGROUP_SIZE
+  // nodes, a proxy for the memory transactions of a GPU workgroup
+  double lines_per_group = 0.0;
+};
+
+MorphLocality measure_morph_locality(const MorphNodes& nodes);
+void log_morph_locality(const char* label, const MorphLocality& locality);
+
+// Returns order, where order[new_index] is the old index of the node
+vector<uint32_t> compute_morph_order(const MorphNodes& nodes,
+    MorphOrdering ordering);
+
+// Permutes the nodes by order and remaps the neighbor indices and the
+// triangle indices to match
+void apply_morph_order(const vector<uint32_t>& order, MorphNodes& nodes,
+    vector<uint32_t>& indices);
+
+// compute_morph_order followed by apply_morph_order. With log set, the
+// locality before and after is printed.
+void reorder_morph_nodes(MorphNodes& nodes, vector<uint32_t>& indices,
+    MorphOrdering ordering, bool log);
+
+// Reorders the live state of a simulation, keeping its iteration count.
+// The indices must be the triangle indices of the current order.
+void morph_sim_reorder(MorphSim& sim, vector<uint32_t>& indices,
+    MorphOrdering ordering, bool log);
+void morph_cpu_sim_reorder(MorphCpuSim& sim, vector<uint32_t>& indices,
+    MorphOrdering ordering, bool log);
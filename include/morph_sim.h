@@ -0,0 +1,136 @@
+#pragma once
+
+#include "utils.h"
+#include "mem_alloc.h"
+#include "morph.h"
+#include "morph_format.h"
+#include "morph_zygote.h"
+#include "thread_pool.h"
+
+const int MORPH_WORKGROUP_SIZE = 64;
+// morph_zygote.comp runs on square tiles of nodes
+const int MORPH_ZYGOTE_TILE_SIZE = 8;
+// Room in the index buffer, two triangles for every node
+const uint32_t MORPH_INDICES_PER_NODE = 6;
+const char* const MORPH_ZYGOTE_SHADER_PATH = "../shaders/morph_zygote.spv";
+
+// Push constants of morph.comp
+struct MorphSimParams {
+  int32_t iter_num;
+  int32_t num_nodes;
+  int32_t pad[2];
+  // see morph.comp for the meaning of each component
+  vec4 user[MORPH_NUM_USER_PARAMS];
+};
+
+// Push constants of morph_zygote.comp
+struct MorphZygoteParams {
+  ivec2 samples;
+  int32_t shape;
+  int32_t pad;
+};
+
+// One half of the double buffer, a device-local buffer per node member
+struct MorphBufferSet {
+  array<VkBuffer, MORPH_BUF_COUNT> buffers;
+  array<MemAlloc, MORPH_BUF_COUNT> buffers_mem;
+};
+
+// Runs the morph simulation as a compute pipeline. Each iteration is one
+// dispatch that reads one buffer set and writes the other, so any number
+// of iterations can go into a single command buffer with only a pipeline
+// barrier between them.
+struct MorphSim {
+  MemAllocator* allocator = nullptr;
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueue queue = VK_NULL_HANDLE;
+  // the layout of the node buffers, which decides the shader
+  MorphNodeFormat format = MORPH_FORMAT_FULL;
+  // where the nodes and indices are read after the sim writes them. Vertex
+  // input is only included if the queue supports graphics.
+  VkPipelineStageFlags read_stages = 0;
+  VkAccessFlags read_access = 0;
+
+  VkDescriptorSetLayout desc_set_layout = VK_NULL_HANDLE;
+  VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkDescriptorPool desc_pool = VK_NULL_HANDLE;
+  // generates zygotes into buffer_sets[0] and index_buffer
+  VkDescriptorSetLayout zygote_desc_set_layout = VK_NULL_HANDLE;
+  VkPipelineLayout zygote_pipeline_layout = VK_NULL_HANDLE;
+  VkPipeline zygote_pipeline = VK_NULL_HANDLE;
+  VkDescriptorSet zygote_desc_set = VK_NULL_HANDLE;
+
+  array<MorphBufferSet, 2> buffer_sets;
+  // desc_sets[i] reads buffer_sets[i] and writes the other set
+  array<VkDescriptorSet, 2> desc_sets;
+  // host-visible, for writing the initial nodes and reading results. Holds
+  // one region per buffer, each max_nodes * sizeof(vec4) bytes.
+  VkBuffer host_buffer = VK_NULL_HANDLE;
+  MemAlloc host_buffer_mem;
+  // triangle indices of the current node order, for drawing the nodes
+  VkBuffer index_buffer = VK_NULL_HANDLE;
+  MemAlloc index_buffer_mem;
+
+  VkCommandPool cmd_pool = VK_NULL_HANDLE;
+  VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+  VkFence fence = VK_NULL_HANDLE;
+
+  uint32_t max_nodes = 0;
+  uint32_t num_nodes = 0;
+  uint32_t num_indices = 0;
+  // the buffer set holding the latest state
+  uint32_t cur_set = 0;
+  // iterations run since the nodes were written
+  int iter_num = 0;
+  MorphUserParams user_params;
+  // optional, for generating zygotes in parallel
+  ThreadPool* threads = nullptr;
+};
+
+// The shader to pass to init_morph_sim for a format
+const char* morph_shader_path(MorphNodeFormat format);
+
+void init_morph_sim(MorphSim& sim, MemAllocator& allocator,
+    uint32_t queue_family_index, VkQueue queue,
+    VkPipelineCache pipeline_cache, const string& shader_path,
+    const string& zygote_shader_path, MorphNodeFormat format);
+void cleanup_morph_sim(MorphSim& sim);
+
+// Makes room for num_nodes, reallocating the buffers if needed. Does not
+// keep the current state. Waits for the sim's queue before freeing the old
+// buffers, which covers readback copies submitted to it.
+void morph_sim_reserve(MorphSim& sim, uint32_t num_nodes);
+
+// Replaces the simulation state and resets the iteration count
+void morph_sim_write_nodes(MorphSim& sim, MorphNodes& node_vecs);
+// Generates the zygote on the host straight into the host buffer and makes
+// it the state, without an intermediate copy of the nodes
+void morph_sim_write_zygote(MorphSim& sim, ivec2 samples, MorphShapeFn shape,
+    vector<uint32_t>& out_indices);
+MorphNodes morph_sim_read_nodes(MorphSim& sim);
+
+// Replaces the contents of the index buffer
+void morph_sim_write_indices(MorphSim& sim, const vector<uint32_t>& indices);
+vector<uint32_t> morph_sim_read_indices(MorphSim& sim);
+
+// Records generating the zygote on the device, into the first buffer set
+// and the index buffer, and makes it the state. Nothing crosses the bus,
+// so a restart costs one dispatch however many samples there are. The sim
+// must have room for the nodes already.
+void record_morph_zygote(MorphSim& sim, VkCommandBuffer cmd_buffer,
+    ivec2 samples, MorphShape shape);
+// Reserves room, then records and waits for record_morph_zygote
+void morph_sim_gen_zygote(MorphSim& sim, ivec2 samples, MorphShape shape);
+
+// Records num_iters iterations, starting at sim.iter_num. The caller must
+// submit the command buffer before recording more.
+void record_morph_iters(MorphSim& sim, VkCommandBuffer cmd_buffer,
+    int num_iters);
+
+// Runs num_iters iterations and waits for them
+void morph_sim_run(MorphSim& sim, int num_iters);
+
+// Regenerates the zygote from the controls and runs controls.num_iters
+// iterations, logging as the controls ask
+void run_morph_pipeline(MorphSim& sim, MorphControls& controls);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "utils.h"
+#include "morph.h"
+#include "morph_sim.h"
+#include "morph_checkpoints.h"
+
+// Iterations between checkpoints
+const int MORPH_CHECKPOINT_INTERVAL = 1000;
+const char* const MORPH_SPILL_PATH = "morph_checkpoints.bin";
+
+// Moves a MorphSim to any iteration number without rerunning it from the
+// zygote. Going forward only runs the difference; going backward restores
+// the nearest checkpoint at or below the target first.
+struct MorphTimeline {
+  // the parameters the live state and the checkpoints were simulated with.
+  // Changing any of them invalidates both.
+  int num_zygote_samples = -1;
+  int zygote_shape = 0;
+  bool gpu_zygote = true;
+  MorphUserParams user_params;
+  // the node order is fixed for the whole timeline so that every
+  // checkpoint matches the indices. controls.reorder_interval is ignored.
+  int ordering = 0;
+
+  // whether the sim holds the state at sim.iter_num
+  bool live = false;
+  int checkpoint_interval = MORPH_CHECKPOINT_INTERVAL;
+  CheckpointStore checkpoints;
+  // host copy of the triangle indices of the current zygote, empty when it
+  // was generated on the device. sim.index_buffer always has them.
+  vector<uint32_t> indices;
+
+  // stats of the last seek
+  int last_iters_run = 0;
+  int last_restored_iter = -1;
+};
+
+void init_morph_timeline(MorphTimeline& timeline, size_t mem_budget,
+    const string& spill_path);
+void cleanup_morph_timeline(MorphTimeline& timeline);
+
+// Drops the live state and all checkpoints
+void invalidate_morph_timeline(MorphTimeline& timeline);
+
+// Brings the sim to target_iter, reusing the live state or a checkpoint if
+// the parameters still match. While looping, the loop start is also
+// checkpointed so that every wrap around is a restore.
+void morph_timeline_seek(MorphTimeline& timeline, MorphSim& sim,
+    const MorphControls& controls, int target_iter);
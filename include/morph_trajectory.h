@@ -0,0 +1,143 @@
+#pragma once
+
+#include "utils.h"
+#include "morph.h"
+#include "mapped_file.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+// Binary trajectory files. The layout is:
+//
+//   MorphTrajHeader
+//   per frame: MorphTrajFrameHeader, a uint32 byte size per chunk and
+//     buffer, then the chunks. Each chunk holds chunk_nodes nodes of every
+//     buffer in buf_mask, in buffer order.
+//   MorphTrajIndexEntry per frame, at header.index_offset
+//
+// A chunk of a buffer is its words coded with encode_byte_planes. Words
+// are the raw float bits, or with MORPH_TRAJ_QUANTIZE, 16-bit fixed point
+// over the chunk's range, which is stored as two vec4s in front. Neighbor
+// indices are never quantized. With MORPH_TRAJ_DELTA, the words of every
+// frame that is not a keyframe are XORed with the previous frame's.
+// The index is written on close. Files that were never closed are read by
+// walking the frame headers.
+
+const uint32_t MORPH_TRAJ_MAGIC = 0x4a52544d;        // "MTRJ"
+const uint32_t MORPH_TRAJ_FRAME_MAGIC = 0x4d415246;  // "FRAM"
+const uint32_t MORPH_TRAJ_VERSION = 1;
+const uint32_t MORPH_TRAJ_CHUNK_NODES = 16 * 1024;
+// frames between keyframes, which bounds the frames decoded for a seek
+const uint32_t MORPH_TRAJ_KEYFRAME_INTERVAL = 32;
+// frames the writer holds before dropping new ones
+const size_t MORPH_TRAJ_MAX_PENDING = 8;
+const char* const MORPH_TRAJ_PATH = "morph_trajectory.mtrj";
+
+// file flags
+const uint32_t MORPH_TRAJ_DELTA = 1 << 0;
+const uint32_t MORPH_TRAJ_QUANTIZE = 1 << 1;
+// frame flags
+const uint32_t MORPH_TRAJ_KEYFRAME = 1 << 0;
+
+struct MorphTrajHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  // MORPH_READBACK_* style bits of the recorded buffers
+  uint32_t buf_mask;
+  uint32_t chunk_nodes;
+  uint32_t keyframe_interval;
+  // 0 until the file is closed
+  uint64_t index_offset;
+  uint32_t num_frames;
+  uint32_t pad;
+};
+
+struct MorphTrajFrameHeader {
+  uint32_t magic;
+  int32_t iter_num;
+  uint32_t num_nodes;
+  uint32_t flags;
+  // bytes after this header up to the next frame
+  uint64_t payload_size;
+};
+
+struct MorphTrajIndexEntry {
+  int32_t iter_num;
+  uint32_t flags;
+  // of the frame header
+  uint64_t offset;
+};
+
+// Appends frames on a background thread, so that recording costs the
+// caller a move into a queue
+struct MorphTrajectoryWriter {
+  uint32_t flags = 0;
+  uint32_t buf_mask = 0;
+  ofstream file;
+  uint64_t file_end = 0;
+
+  thread writer;
+  mutex lock;
+  condition_variable pending_cv;
+  // signaled when the writer takes a frame or closes
+  condition_variable space_cv;
+  deque<pair<int, MorphNodes>> pending;
+  bool stopping = false;
+
+  // owned by the writer thread
+  array<vector<uint8_t>, MORPH_BUF_COUNT> prev_words;
+  uint32_t prev_num_nodes = 0;
+  vector<MorphTrajIndexEntry> index;
+
+  atomic<bool> open{false};
+  atomic<uint64_t> num_written{0};
+  atomic<uint64_t> num_dropped{0};
+  atomic<uint64_t> raw_bytes{0};
+  atomic<uint64_t> file_bytes{0};
+};
+
+// Returns false if the file could not be created
+bool open_morph_trajectory(MorphTrajectoryWriter& writer, const string& path,
+    uint32_t flags, uint32_t buf_mask);
+// Queues a frame. Returns false if it was dropped because the writer is
+// behind or closed.
+bool morph_trajectory_append(MorphTrajectoryWriter& writer, int iter_num,
+    MorphNodes&& nodes);
+// Like morph_trajectory_append, but waits for the writer to catch up
+// instead of dropping the frame
+bool morph_trajectory_append_wait(MorphTrajectoryWriter& writer,
+    int iter_num, MorphNodes&& nodes);
+// Writes the queued frames and the index
+void close_morph_trajectory(MorphTrajectoryWriter& writer);
+
+// Random access to the frames of a trajectory file through a read-only
+// mapping. Reading frame n decodes at most the frames since the keyframe
+// before it, and reading frames in order decodes each once.
+struct MorphTrajectoryReader {
+  MappedFile file;
+  MorphTrajHeader header;
+  vector<MorphTrajIndexEntry> frames;
+
+  // the words of the last decoded frame, the base for the next delta, and
+  // the (min, extent) pairs of its quantized chunks
+  int decoded_frame = -1;
+  uint32_t decoded_num_nodes = 0;
+  array<vector<uint8_t>, MORPH_BUF_COUNT> words;
+  array<vector<vec4>, MORPH_BUF_COUNT> ranges;
+};
+
+bool open_morph_trajectory_reader(MorphTrajectoryReader& reader,
+    const string& path);
+void close_morph_trajectory_reader(MorphTrajectoryReader& reader);
+
+// Returns the frame with the largest iteration at or below iter_num, or -1
+int morph_trajectory_find(const MorphTrajectoryReader& reader, int iter_num);
+// Buffers that were not recorded are left empty. Returns false if the
+// frame is corrupt.
+bool morph_trajectory_read(MorphTrajectoryReader& reader, size_t frame,
+    MorphNodes& out_nodes);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "utils.h"
+#include "morph.h"
+#include "morph_sim.h"
+#include "morph_cpu_sim.h"
+
+// A value matches if it is within max_ulps of the reference, or within
+// abs_tol for values near zero where ULPs are tiny
+struct MorphTolerance {
+  uint32_t max_ulps = 64;
+  float abs_tol = 1e-5f;
+};
+
+struct MorphCompareResult {
+  bool sizes_match = true;
+  size_t num_values = 0;
+  size_t num_mismatches = 0;
+  uint32_t max_ulps = 0;
+  float max_abs_err = 0.0f;
+  // where the largest ULP distance was
+  size_t worst_node = 0;
+  int worst_buffer = 0;
+};
+
+// Half precision formats round vel to 11 bits every iteration,
+// so they are compared with a looser tolerance
+MorphTolerance morph_tolerance_for(MorphNodeFormat format);
+
+// ULPs between two floats. NaNs are infinitely far from everything.
+uint32_t ulp_distance(float a, float b);
+
+MorphCompareResult compare_morph_nodes(const MorphNodes& nodes,
+    const MorphNodes& ref_nodes, const MorphTolerance& tol);
+void log_compare_result(const MorphCompareResult& result);
+
+// Runs controls.num_iters iterations of the zygote on both simulations,
+// comparing them every check_interval iterations. Returns false and logs
+// the first iteration at which they diverge.
+bool verify_morph_sim(MorphSim& sim, MorphCpuSim& cpu_sim,
+    const MorphControls& controls, const MorphTolerance& tol,
+    int check_interval);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "utils.h"
+#include "morph.h"
+#include "morph_format.h"
+#include "thread_pool.h"
+
+// Maps a point of the unit square to the zygote surface
+typedef vec3 (*MorphShapeFn)(vec2 unit);
+
+enum MorphShape {
+  MORPH_SHAPE_PLANE = 0,
+  MORPH_SHAPE_SQUARE,
+  MORPH_SHAPE_SPHERE,
+  MORPH_SHAPE_COUNT
+};
+
+const char* morph_shape_name(MorphShape shape);
+MorphShapeFn morph_shape_fn(MorphShape shape);
+
+// Rows per task when generating on a thread pool
+const int MORPH_ZYGOTE_ROWS_PER_TASK = 64;
+
+size_t morph_zygote_num_nodes(ivec2 samples);
+size_t morph_zygote_num_indices(ivec2 samples);
+
+// Writes the zygote straight into node buffers of any format, such as a
+// mapped staging buffer, and the triangle indices into out_indices. Every
+// row's output offsets are known up front, so rows are generated in
+// parallel on threads when given and nothing is allocated.
+void gen_morph_zygote(ivec2 samples, MorphShapeFn shape,
+    MorphNodeFormat format, const array<void*, MORPH_BUF_COUNT>& dst,
+    uint32_t* out_indices, ThreadPool* threads);
+
+// Same, resizing out_nodes and out_indices to fit
+void gen_morph_zygote(ivec2 samples, MorphShapeFn shape,
+    MorphNodes& out_nodes, vector<uint32_t>& out_indices,
+    ThreadPool* threads);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "utils.h"
+#include "thread_pool.h"
+
+// Records one chunk of draws into a secondary that is already begun
+typedef function<void(VkCommandBuffer cmd_buffer, uint32_t chunk_index)>
+  RecordChunkFn;
+
+// The command buffers of one worker thread for one frame in flight.
+// Command pools may only be used by one thread at a time, so every worker
+// gets its own, and the frames in flight get separate pools so that one
+// frame's pools can be reset while another frame is still executing.
+struct RecordPool {
+  VkCommandPool cmd_pool = VK_NULL_HANDLE;
+  vector<VkCommandBuffer> cmd_buffers;
+  uint32_t num_used = 0;
+};
+
+// Splits recording into chunks, records each chunk into a secondary on the
+// thread pool, and hands back the secondaries in chunk order for the
+// primary to execute.
+struct ParallelRecorder {
+  VkDevice device = VK_NULL_HANDLE;
+  ThreadPool* threads = nullptr;
+  uint32_t num_frames = 0;
+  // indexed by frame_index * num_threads + thread_index
+  vector<RecordPool> pools;
+  // the secondaries of the last parallel_record call, in chunk order
+  vector<VkCommandBuffer> recorded;
+};
+
+void init_parallel_recorder(ParallelRecorder& recorder, VkDevice device,
+    uint32_t queue_family_index, uint32_t num_frames, ThreadPool& threads);
+void cleanup_parallel_recorder(ParallelRecorder& recorder);
+
+// Resets the command pools of frame_index, then records num_chunks
+// secondaries inside render_pass. The caller must make sure the GPU is done
+// with the frame's previous secondaries. Returns the secondaries in chunk
+// order.
+vector<VkCommandBuffer>& parallel_record(ParallelRecorder& recorder,
+    uint32_t frame_index, uint32_t num_chunks, VkRenderPass render_pass,
+    uint32_t subpass, const RecordChunkFn& record_chunk);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "utils.h"
+
+// Where the pipeline cache is kept between runs, relative to the build dir
+const char* const PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+// Creates a pipeline cache, seeded from the file at path if the file was
+// written by the same driver for the same device. A cache from another
+// vendor, device or driver version is discarded, since drivers may reject
+// or even crash on foreign data. out_warm reports whether it was seeded.
+VkPipelineCache load_pipeline_cache(VkPhysicalDevice phys_device,
+    VkDevice device, const string& path, bool& out_warm);
+
+// Writes the cache contents back to path and destroys the cache
+void save_pipeline_cache(VkDevice device, VkPipelineCache cache,
+    const string& path);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "utils.h"
+#include "mem_alloc.h"
+
+#include <deque>
+
+// Size of the persistently mapped staging ring. Every host-to-device upload
+// goes through it, so a single upload may not be larger than this.
+const VkDeviceSize STAGING_RING_SIZE = 64 * 1024 * 1024;
+
+// Bytes handed out by staging_alloc. Copy commands read from
+// (buffer, offset), the host writes through data.
+struct StagingRegion {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void* data = nullptr;
+};
+
+// The regions allocated between two calls to staging_submit belong to the
+// same submission. They are given back once the fence value passed to
+// staging_submit is reported as completed by staging_retire.
+struct StagingSubmission {
+  uint64_t fence_value;
+  VkDeviceSize num_bytes;
+};
+
+struct StagingRing {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  MemAlloc buffer_mem;
+  char* data = nullptr;
+  VkDeviceSize size = 0;
+
+  // next free byte
+  VkDeviceSize head = 0;
+  // bytes between the oldest in-flight region and the head, including the
+  // bytes skipped when an allocation wraps around
+  VkDeviceSize used = 0;
+  VkDeviceSize unsubmitted_bytes = 0;
+  deque<StagingSubmission> in_flight;
+};
+
+void init_staging_ring(StagingRing& ring, MemAllocator& allocator,
+    VkDeviceSize size);
+void cleanup_staging_ring(StagingRing& ring, MemAllocator& allocator);
+
+// Returns false if the ring does not have room for the region until more
+// submissions are retired
+bool staging_alloc(StagingRing& ring, VkDeviceSize size,
+    VkDeviceSize alignment, StagingRegion& out_region);
+
+// Tags all the regions allocated since the last call with fence_value
+void staging_submit(StagingRing& ring, uint64_t fence_value);
+
+// Gives back the regions of every submission with a fence value
+// at or below completed_value
+void staging_retire(StagingRing& ring, uint64_t completed_value);
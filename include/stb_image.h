@@ -229,6 +229,14 @@ RECENT REVISION HISTORY:
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
 //
+// With GCC, Clang and MSVC on x86, AVX2 versions of the YCbCr->RGBA and
+// 2x2 upsampling kernels, and of the PNG "up" filter, are compiled in as
+// well and picked at run time when the CPU supports them; define
+// STBI_NO_AVX2 to leave them out. The PNG sub/avg/paeth filters of 8-bit
+// RGB and RGBA images use SSE2. stbi_set_simd_limit() caps the level the
+// decoders pick, for testing and benchmarking: every level produces the
+// same pixels.
+//
 // ===========================================================================
 //
 // HDR image support   (disable by defining STBI_NO_HDR)
@@ -466,6 +474,12 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// cap the SIMD kernels the decoders may use: 0 = scalar, 1 = SSE2 or NEON,
+// 2 = AVX2 (the default is 2, i.e. the best the CPU has). not thread-safe;
+// set it before decoding. stbi_simd_level() is the level decoding uses.
+STBIDEF void stbi_set_simd_limit(int level);
+STBIDEF int  stbi_simd_level(void);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -675,18 +689,15 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
    return ((info3 >> 26) & 1) != 0;
 }
-#endif
 
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -694,11 +705,38 @@ static int stbi__sse2_available(void)
    // instructions at will, and so are we.
    return 1;
 }
+
 #endif
 
+// AVX2 kernels are compiled for the AVX2 target function by function, so
+// the rest of the library still runs on any SSE2 CPU
+#if !defined(STBI_NO_AVX2) && ((defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5)) || (defined(_MSC_VER) && !defined(__clang__) && _MSC_VER >= 1700))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info,1);
+   // the OS must save the ymm registers too
+   if (((info[2] >> 27) & 1) == 0 || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info,7,0);
+   return ((info[1] >> 5) & 1) != 0;
+}
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+   return __builtin_cpu_supports("avx2");
+}
 #endif
 #endif
 
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -1001,6 +1039,37 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
     stbi__vertically_flip_on_load = flag_true_if_should_flip;
 }
 
+static int stbi__simd_limit = 2;
+
+STBIDEF void stbi_set_simd_limit(int level)
+{
+    stbi__simd_limit = level;
+}
+
+// the kernel level to decode with: 0 = scalar, 1 = SSE2/NEON, 2 = AVX2
+static int stbi__simd_level(void)
+{
+   int level = 0;
+#ifdef STBI_SSE2
+   if (stbi__sse2_available()) {
+      level = 1;
+#ifdef STBI_AVX2
+      if (stbi__avx2_available())
+         level = 2;
+#endif
+   }
+#endif
+#ifdef STBI_NEON
+   level = 1;
+#endif
+   return level < stbi__simd_limit ? level : stbi__simd_limit;
+}
+
+STBIDEF int stbi_simd_level(void)
+{
+   return stbi__simd_level();
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -3417,6 +3486,76 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// the SSE2 kernel above on 16 pixels at a time. the cross-lane shifts of
+// "prev" and "next" use a permute plus alignr, since AVX2 shifts stay
+// within 128-bit lanes.
+static STBI__AVX2_TARGET stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass, 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff);
+
+      // shift by one pixel across the whole register: lo = [0, curr.lo],
+      // hi = [curr.hi, 0]
+      __m256i lo   = _mm256_permute2x128_si256(curr, curr, 0x08);
+      __m256i hi   = _mm256_permute2x128_si256(curr, curr, 0x81);
+      __m256i prv0 = _mm256_alignr_epi8(curr, lo, 14);
+      __m256i nxt0 = _mm256_alignr_epi8(hi, curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, (short) t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, (short) (3*in_near[i+16] + in_far[i+16]), 15);
+
+      // horizontal polyphase filter
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave and undo scaling. the unpacks and the pack all work
+      // within lanes, so the output comes out in order.
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i de0  = _mm256_srli_epi16(int0, 4);
+      __m256i de1  = _mm256_srli_epi16(int1, 4);
+      __m256i outv = _mm256_packus_epi16(de0, de1);
+      _mm256_storeu_si256((__m256i *) (out + i*2), outv);
+
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3591,26 +3730,97 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// the SSE2 kernel on 16 pixels at a time, leaving the rest to it
+static STBI__AVX2_TARGET void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 4) {
+      __m128i signflip  = _mm_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // load
+         __m128i y_bytes = _mm_loadu_si128((__m128i *) (y+i));
+         __m128i cr_bytes = _mm_loadu_si128((__m128i *) (pcr+i));
+         __m128i cb_bytes = _mm_loadu_si128((__m128i *) (pcb+i));
+         __m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+         __m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+         // widen to short, with y, cr and cb in the high byte like the
+         // SSE2 unpacks leave them
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y_bytes), 8), y_bias);
+         __m256i crw = _mm256_slli_epi16(_mm256_cvtepi8_epi16(cr_biased), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_cvtepi8_epi16(cb_biased), 8);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte and transpose, within each lane: o0 holds pixels
+         // 0-3 and 8-11, o1 pixels 4-7 and 12-15
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         // store, putting the lanes back in pixel order
+         _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+         _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+         out += 64;
+      }
+   }
+
+   stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   int simd = stbi__simd_level();
+
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
-#ifdef STBI_SSE2
-   if (stbi__sse2_available()) {
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+   if (simd >= 1) {
       j->idct_block_kernel = stbi__idct_simd;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
    }
 #endif
 
-#ifdef STBI_NEON
-   j->idct_block_kernel = stbi__idct_simd;
-   j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-   j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+   // the IDCT stays on SSE2: a block is eight 128-bit rows, and the kernel
+   // only ever gets one block, so 256-bit registers would sit half empty
+#ifdef STBI_AVX2
+   if (simd >= 2) {
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
 #endif
+   STBI_NOTUSED(simd);
 }
 
 // clean up the temporary component buffers
@@ -4392,6 +4602,124 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+#ifdef STBI_SSE2
+#ifdef STBI_AVX2
+static STBI__AVX2_TARGET int stbi__png_up_avx2(stbi_uc *cur, stbi_uc const *raw, stbi_uc const *prior, int n)
+{
+   int k;
+   for (k=0; k+31 < n; k += 32) {
+      __m256i r = _mm256_loadu_si256((__m256i const *) (raw + k));
+      __m256i p = _mm256_loadu_si256((__m256i const *) (prior + k));
+      _mm256_storeu_si256((__m256i *) (cur + k), _mm256_add_epi8(r, p));
+   }
+   return k;
+}
+#endif
+
+static __m128i stbi__png_load_px(stbi_uc const *p, int n)
+{
+   stbi__uint32 v = 0;
+   if (n == 4) memcpy(&v, p, 4);
+   else        memcpy(&v, p, 3);
+   return _mm_cvtsi32_si128((int) v);
+}
+
+static void stbi__png_store_px(stbi_uc *p, __m128i px, int n)
+{
+   stbi__uint32 v = (stbi__uint32) _mm_cvtsi128_si32(px);
+   if (n == 4) memcpy(p, &v, 4);
+   else        memcpy(p, &v, 3);
+}
+
+// unfilters the pixels of a row after the first one, which the caller has
+// done and stepped cur, raw and prior past. "up" is bytewise and done 16
+// or 32 bytes at a time. sub, avg and paeth need the pixel to the left, so
+// they go a pixel at a time with only img_n lanes live, which is why they
+// don't gain from AVX2; they cover 8-bit RGB and RGBA, expanding RGB to
+// RGBA when out_n is 4. returns 0 for what it doesn't cover.
+static int stbi__png_unfilter_simd(int simd, stbi_uc *cur, stbi_uc const *raw, stbi_uc const *prior, int filter, stbi__uint32 count, int img_n, int out_n, int depth)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i alpha, a, b, c = zero;
+   stbi__uint32 i;
+
+   if (simd < 1)
+      return 0;
+
+   if (filter == STBI__F_up && img_n == out_n) {
+      int n = (int) (count*img_n), k = 0;
+#ifdef STBI_AVX2
+      if (simd >= 2)
+         k = stbi__png_up_avx2(cur, raw, prior, n);
+#endif
+      for (; k+15 < n; k += 16) {
+         __m128i r = _mm_loadu_si128((__m128i const *) (raw + k));
+         __m128i p = _mm_loadu_si128((__m128i const *) (prior + k));
+         _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(r, p));
+      }
+      for (; k < n; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      return 1;
+   }
+
+   if (depth != 8 || (img_n != 3 && img_n != 4) ||
+       filter < STBI__F_sub || filter > STBI__F_paeth)
+      return 0;
+
+   alpha = _mm_cvtsi32_si128(img_n == out_n ? 0 : (int) 0xff000000);
+   // sub is used on the first row too, where there is no prior row
+   a = stbi__png_load_px(cur - out_n, out_n);
+   if (filter == STBI__F_paeth)
+      c = stbi__png_load_px(prior - out_n, out_n);
+   for (i=0; i < count; ++i, cur += out_n, raw += img_n, prior += out_n) {
+      __m128i x = stbi__png_load_px(raw, img_n);
+      b = filter == STBI__F_sub ? zero : stbi__png_load_px(prior, out_n);
+      switch (filter) {
+         case STBI__F_sub:
+            x = _mm_add_epi8(x, a);
+            break;
+         case STBI__F_up:
+            x = _mm_add_epi8(x, b);
+            break;
+         case STBI__F_avg: {
+            // pavgb rounds up, (a+b)>>1 rounds down
+            __m128i avg = _mm_avg_epu8(a, b);
+            __m128i odd = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+            x = _mm_add_epi8(x, _mm_sub_epi8(avg, odd));
+            break;
+         }
+         case STBI__F_paeth: {
+            // pa = |b-c|, pb = |a-c|, pc = |a+b-2c|, ties go a, b, c
+            __m128i aw = _mm_unpacklo_epi8(a, zero);
+            __m128i bw = _mm_unpacklo_epi8(b, zero);
+            __m128i cw = _mm_unpacklo_epi8(c, zero);
+            __m128i pa = _mm_sub_epi16(bw, cw);
+            __m128i pb = _mm_sub_epi16(aw, cw);
+            __m128i pc = _mm_add_epi16(pa, pb);
+            __m128i smallest, use_a, use_b, pred;
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            use_a = _mm_cmpeq_epi16(smallest, pa);
+            use_b = _mm_andnot_si128(use_a, _mm_cmpeq_epi16(smallest, pb));
+            pred = _mm_or_si128(_mm_and_si128(use_a, aw),
+                   _mm_or_si128(_mm_and_si128(use_b, bw),
+                   _mm_andnot_si128(_mm_or_si128(use_a, use_b), cw)));
+            x = _mm_add_epi8(x, _mm_packus_epi16(pred, zero));
+            c = b;
+            break;
+         }
+      }
+      a = _mm_or_si128(x, alpha);
+      stbi__png_store_px(cur, a, out_n);
+   }
+   return 1;
+}
+#else
+#define stbi__png_unfilter_simd(simd,cur,raw,prior,filter,count,img_n,out_n,depth) (STBI_NOTUSED(simd), 0)
+#endif
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
@@ -4405,6 +4733,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
    int width = x;
+   int simd = stbi__simd_level();
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
    a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4477,6 +4806,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          #define STBI__CASE(f) \
              case f:     \
                 for (k=0; k < nk; ++k)
+         if (!stbi__png_unfilter_simd(simd, cur, raw, prior, filter, width-1, filter_bytes, filter_bytes, depth))
          switch (filter) {
             // "none" filter turns into a memcpy here; make that explicit.
             case STBI__F_none:         memcpy(cur, raw, nk); break;
@@ -4495,7 +4825,9 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
              case f:     \
                 for (i=x-1; i >= 1; --i, cur[filter_bytes]=255,raw+=filter_bytes,cur+=output_bytes,prior+=output_bytes) \
                    for (k=0; k < filter_bytes; ++k)
-         switch (filter) {
+         if (stbi__png_unfilter_simd(simd, cur, raw, prior, filter, x-1, filter_bytes, output_bytes, depth))
+            raw += (x-1)*filter_bytes;
+         else switch (filter) {
             STBI__CASE(STBI__F_none)         { cur[k] = raw[k]; } break;
             STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k- output_bytes]); } break;
             STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
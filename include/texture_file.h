@@ -0,0 +1,64 @@
+#pragma once
+
+#include "utils.h"
+#include "block_compress.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+// Baked texture files, laid out after KTX2 without its data format
+// descriptor and key/value data:
+//
+//   TexFileHeader
+//   TexFileLevel per level, level 0 first
+//   the levels, each TEX_FILE_ALIGNMENT aligned
+//
+// Level data is in the GPU's layout, so it can be copied straight from the
+// mapped file into staging memory and on to the image.
+
+// "«MTEX 10»\r\n\x1A\n", in the style of KTX's identifier
+const uint8_t TEX_FILE_IDENTIFIER[12] = {
+  0xab, 'M', 'T', 'E', 'X', ' ', '1', '0', 0xbb, '\r', '\n', 0x1a
+};
+const uint32_t TEX_FILE_ALIGNMENT = 16;
+const char* const TEX_FILE_EXTENSION = ".mtex";
+
+struct TexFileHeader {
+  uint8_t identifier[12];
+  // a VkFormat, as in KTX2
+  uint32_t vk_format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t level_count;
+};
+
+struct TexFileLevel {
+  uint64_t byte_offset;
+  uint64_t byte_length;
+};
+
+// An open baked texture, mapped, so levels are paged in as they are read
+struct TextureFile {
+  TexFileHeader header;
+  TexFormat format = TEX_FORMAT_RGBA8;
+  vector<TexFileLevel> levels;
+  MappedFile file;
+};
+
+// Builds the mip chain of a w x h RGBA8 image, unless mips is false,
+// compresses every level and writes the file
+bool bake_texture_file(const string& path, const uint8_t* rgba, uint32_t w,
+    uint32_t h, TexFormat format, bool mips, ThreadPool* threads);
+
+// Maps the file and validates the header and level index. Returns false,
+// with nothing to close, if it is not a valid texture.
+bool open_texture_file(TextureFile& tex, const string& path);
+void close_texture_file(TextureFile& tex);
+
+// Extent of a level
+uint32_t texture_level_width(const TextureFile& tex, uint32_t level);
+uint32_t texture_level_height(const TextureFile& tex, uint32_t level);
+
+// A level as stored, byte_length bytes, within the mapping
+const uint8_t* texture_level_data(const TextureFile& tex, uint32_t level);
+// Copies a level as stored into dst
+void read_texture_level(const TextureFile& tex, uint32_t level, void* dst);
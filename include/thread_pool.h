@@ -0,0 +1,43 @@
+#pragma once
+
+#include "utils.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Called with the task index and the index of the worker running it. The
+// worker index is stable for the life of the pool, so it can pick
+// per-thread resources such as command pools.
+typedef function<void(uint32_t task_index, uint32_t thread_index)> TaskFn;
+
+// Fixed set of worker threads that run parallel-for style jobs. Only one
+// job runs at a time and thread_pool_run blocks until it is done.
+struct ThreadPool {
+  vector<thread> threads;
+  mutex lock;
+  condition_variable work_cv;
+  condition_variable done_cv;
+
+  // the current job
+  TaskFn task_fn;
+  atomic<uint32_t> num_tasks{0};
+  atomic<uint32_t> next_task{0};
+  uint32_t num_done = 0;
+  // workers inside the claim loop. A job is over only once this is back
+  // to 0, since a worker may still be claiming after the last task ran.
+  uint32_t num_active = 0;
+  // bumped for every job so sleeping workers can tell a new one started
+  uint64_t job_id = 0;
+  bool stopping = false;
+};
+
+void init_thread_pool(ThreadPool& pool, uint32_t num_threads);
+void cleanup_thread_pool(ThreadPool& pool);
+
+uint32_t thread_pool_size(ThreadPool& pool);
+
+// Runs fn for every task index in [0, num_tasks) across the workers
+void thread_pool_run(ThreadPool& pool, uint32_t num_tasks, const TaskFn& fn);
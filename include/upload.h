@@ -0,0 +1,112 @@
+#pragma once
+
+#include "utils.h"
+#include "staging.h"
+
+#include <deque>
+
+// Identifies a batch of upload commands. Tickets increase monotonically, so
+// once a ticket completes every earlier ticket has completed as well.
+typedef uint64_t UploadTicket;
+
+struct UploadBatch {
+  UploadTicket ticket;
+  VkCommandBuffer cmd_buffer;
+  VkFence fence;
+};
+
+// What the queue that consumes the uploads must do before using them: wait
+// on the semaphores signalled by the upload batches, then record the
+// acquire half of each queue family ownership transfer.
+struct UploadHandoff {
+  vector<VkSemaphore> wait_semas;
+  vector<VkBufferMemoryBarrier> buffer_barriers;
+  vector<VkImageMemoryBarrier> image_barriers;
+  // the stages that first use the uploaded resources
+  VkPipelineStageFlags dst_stages = 0;
+};
+
+// Records copies and barriers from any number of uploads into one command
+// buffer, then submits them together with a fence instead of draining the
+// queue after every command.
+//
+// The upload queue may differ from the queue that consumes the uploads
+// (dst_queue). In that case each batch signals a semaphore for dst_queue to
+// wait on, and if the queue families differ too, ownership of uploaded
+// resources is released here and acquired on dst_queue.
+struct Uploader {
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t queue_family_index = 0;
+  VkQueue queue = VK_NULL_HANDLE;
+  uint32_t dst_family_index = 0;
+  VkQueue dst_queue = VK_NULL_HANDLE;
+  VkCommandPool cmd_pool = VK_NULL_HANDLE;
+  // may be null if the uploader never stages data
+  StagingRing* staging = nullptr;
+
+  // the batch being recorded, if any
+  VkCommandBuffer cur_cmd_buffer = VK_NULL_HANDLE;
+  // the ticket of the batch being recorded
+  UploadTicket next_ticket = 1;
+  UploadTicket completed_ticket = 0;
+
+  // acquire barriers of the batch being recorded
+  UploadHandoff recording_handoff;
+  // handoff of the batches submitted since the last upload_take_handoff
+  UploadHandoff ready_handoff;
+
+  deque<UploadBatch> in_flight;
+  vector<VkCommandBuffer> free_cmd_buffers;
+  vector<VkFence> free_fences;
+  vector<VkSemaphore> free_semas;
+};
+
+void init_uploader(Uploader& uploader, VkDevice device,
+    uint32_t queue_family_index, VkQueue queue,
+    uint32_t dst_family_index, VkQueue dst_queue,
+    StagingRing* staging);
+void cleanup_uploader(Uploader& uploader);
+
+// Returns the command buffer of the current batch, starting one if needed.
+// Anything recorded into it is submitted by the next upload_flush.
+VkCommandBuffer upload_cmd_buffer(Uploader& uploader);
+
+// The ticket that the commands recorded so far will complete with
+UploadTicket upload_ticket(Uploader& uploader);
+
+// Allocates staging memory for the current batch. If the staging ring is
+// full this submits the current batch and waits on the oldest batches
+// until enough space is retired.
+StagingRegion upload_stage(Uploader& uploader, VkDeviceSize size,
+    VkDeviceSize alignment);
+
+// Makes the transfer writes to a buffer available to dst_stage on dst_queue,
+// releasing ownership if dst_queue belongs to a different family
+void upload_release_buffer(Uploader& uploader, VkBuffer buffer,
+    VkPipelineStageFlags dst_stage, VkAccessFlags dst_access);
+
+// As upload_release_buffer, and also transitions the image from
+// TRANSFER_DST_OPTIMAL to new_layout
+void upload_release_image(Uploader& uploader, VkImage image,
+    VkImageAspectFlags aspect, VkImageLayout new_layout,
+    VkPipelineStageFlags dst_stage, VkAccessFlags dst_access);
+
+// Submits the current batch, if any. Returns its ticket.
+UploadTicket upload_flush(Uploader& uploader);
+
+// Non-blocking check for completion. Also retires finished batches.
+bool upload_poll(Uploader& uploader, UploadTicket ticket);
+
+// Blocks until the ticket completes, submitting it first if needed
+void upload_wait(Uploader& uploader, UploadTicket ticket);
+
+// Moves the handoff of every submitted batch into out_handoff. The caller
+// must wait on its semaphores and record its barriers with
+// record_upload_acquire in the next submission to dst_queue.
+void upload_take_handoff(Uploader& uploader, UploadHandoff& out_handoff);
+void record_upload_acquire(VkCommandBuffer cmd_buffer,
+    UploadHandoff& handoff);
+
+// Gives back handoff semaphores once the submission that waited on them
+// has completed
+void upload_recycle_semaphores(Uploader& uploader, vector<VkSemaphore>& semas);
@@ -36,3 +36,7 @@ string vec3_str(vec3 v);
 string vec4_str(vec4 v);
 string ivec4_str(ivec4 v);
 
+// code must be 4 byte aligned. See load_shader_module for loading a file.
+VkShaderModule create_shader_module(VkDevice& device, const uint8_t* code,
+    size_t code_size);
+
@@ -1,2 +1,12 @@
-../vulkansdk-macos-1.1.106.0/macOS/bin/glslangValidator -V basic.vert
-../vulkansdk-macos-1.1.106.0/macOS/bin/glslangValidator -V basic.frag
+#!/bin/sh
+# Compiles the shaders by hand, the build does the same. Uses
+# $GLSLANG_VALIDATOR, or glslangValidator from the PATH or the Vulkan SDK.
+cd "$(dirname "$0")" || exit 1
+GLSLANG=${GLSLANG_VALIDATOR:-$(command -v glslangValidator)}
+GLSLANG=${GLSLANG:-${VULKAN_SDK:-../../vulkansdk-macos-1.1.106.0/macOS}/bin/glslangValidator}
+set -e
+"$GLSLANG" -V basic.vert -o vert.spv
+"$GLSLANG" -V basic.frag -o frag.spv
+"$GLSLANG" -V morph.comp -o morph.spv
+"$GLSLANG" -V morph_compact.comp -o morph_compact.spv
+"$GLSLANG" -V morph_zygote.comp -o morph_zygote.spv
@@ -1,12 +1,36 @@
 #include "app.h"
 #include "utils.h"
+#include "mem_alloc.h"
+#include "staging.h"
+#include "upload.h"
+#include "frame_alloc.h"
+#include "cmd_cache.h"
+#include "frame_context.h"
+#include "thread_pool.h"
+#include "parallel_record.h"
+#include "pipeline_cache.h"
+#include "morph.h"
+#include "morph_sim.h"
+#include "morph_timeline.h"
+#include "morph_cpu_sim.h"
+#include "morph_verify.h"
+#include "morph_reorder.h"
+#include "morph_readback.h"
+#include "morph_trajectory.h"
+#include "mipmaps.h"
+#include "texture_file.h"
+#include "image_decode.h"
+#include "mapped_file.h"
+#include "headless.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_vulkan.h"
 
+#include <algorithm>
 #include <chrono>
+#include <functional>
 #include <thread>
 #include <utility>
 #include <tuple>
@@ -19,6 +43,9 @@ using namespace std;
 using namespace glm;
 
 const int max_frames_in_flight = 2;
+const char* const TEXTURE_PATH = "../textures/sample_tex.jpg";
+// written by the bake_textures target, and preferred over TEXTURE_PATH
+const char* const BAKED_TEXTURE_PATH = "../textures/sample_tex.mtex";
 
 struct Vertex {
   vec3 pos;
@@ -50,6 +77,32 @@ struct AppState {
   VkDevice device;
   uint32_t target_family_index;
   VkQueue queue;
+  // queue for uploads. May be the graphics queue itself if the device has
+  // only one queue.
+  uint32_t transfer_family_index;
+  VkQueue transfer_queue;
+  // whether the upload queue can blit, which needs graphics support
+  bool upload_can_blit = false;
+  // textureCompressionBC is enabled
+  bool supports_bc = false;
+
+  MemAllocator allocator;
+  StagingRing staging_ring;
+  // uploads on the transfer queue
+  Uploader uploader;
+  // commands that need the graphics queue, e.g. depth layout transitions
+  Uploader gfx_uploader;
+
+  // scene secondaries, one entry per frame in flight
+  CmdCache scene_cmds;
+
+  // with more than one thread the scene is recorded in parallel chunks
+  // every frame instead of through scene_cmds
+  uint32_t num_record_threads = 1;
+  // times the mesh is drawn, to give the recorders a large scene
+  uint32_t num_scene_draws = 1;
+  ThreadPool record_threads;
+  ParallelRecorder recorder;
 
   VkSurfaceCapabilitiesKHR surface_caps;
   VkSurfaceFormatKHR target_format;
@@ -57,41 +110,53 @@ struct AppState {
   VkExtent2D target_extent;
   uint32_t target_image_count;
 
-  VkSwapchainKHR swapchain;
+  VkSwapchainKHR swapchain = VK_NULL_HANDLE;
   vector<VkImage> swapchain_images;
   vector<VkImageView> swapchain_img_views;
 
   VkRenderPass render_pass;
   VkPipelineLayout pipeline_layout;
   VkPipeline graphics_pipeline;
+  // shared by every pipeline, including imgui's
+  VkPipelineCache pipeline_cache;
+  bool pipeline_cache_warm = false;
   vector<VkFramebuffer> swapchain_framebuffers;
 
-  VkCommandPool cmd_pool;
-
   VkBuffer vert_buffer;
-  VkDeviceMemory vert_buffer_mem;
+  MemAlloc vert_buffer_mem;
   VkBuffer index_buffer;
-  VkDeviceMemory index_buffer_mem;
-  vector<VkBuffer> unif_buffers;
-  vector<VkDeviceMemory> unif_buffers_mem;
+  MemAlloc index_buffer_mem;
+  // per-frame uniform data, bound with dynamic offsets
+  FrameAllocator frame_allocator;
 
   VkDescriptorSetLayout desc_set_layout;
   VkDescriptorPool desc_pool;
-  vector<VkDescriptorSet> desc_sets;
+  VkDescriptorSet desc_set;
 
-  vector<VkCommandBuffer> cmd_buffers;
+  array<FrameContext, max_frames_in_flight> frames;
 
-  vector<VkSemaphore> img_available_semas;
-  vector<VkSemaphore> render_done_semas;
-  vector<VkFence> in_flight_fences;
+  MorphSim morph_sim;
+  MorphNodeFormat morph_format = MORPH_FORMAT_FULL;
+  MorphControls morph_controls;
+  MorphTimeline morph_timeline;
+  MorphReadback morph_readback;
+  // fed by the readback consumer while recording
+  MorphTrajectoryWriter morph_trajectory;
+  bool morph_traj_quantize = false;
+  // whether the readback consumer logs, set by the console every frame
+  atomic<bool> log_readbacks{false};
 
   VkImage texture_img;
-  VkDeviceMemory texture_img_mem;
+  MemAlloc texture_img_mem;
+  VkFormat texture_format = VK_FORMAT_R8G8B8A8_UNORM;
+  uint32_t texture_mip_levels = 1;
+  // bytes of all levels, as uploaded
+  VkDeviceSize texture_size = 0;
   VkImageView texture_img_view;
   VkSampler texture_sampler;
 
   VkImage depth_img;
-  VkDeviceMemory depth_img_mem;
+  MemAlloc depth_img_mem;
   VkImageView depth_img_view;
 
   size_t current_frame;
@@ -107,16 +172,6 @@ static void check_vk_result(VkResult res) {
   assert(res == VK_SUCCESS);
 }
 
-vector<char> read_file(const string& filename) {
-  ifstream file(filename, ios::ate | ios::binary);
-  size_t file_size = (size_t) file.tellg();
-  vector<char> buffer(file_size);
-  file.seekg(0);
-  file.read(buffer.data(), file_size);
-  file.close();
-  return buffer;
-}
-
 static VKAPI_ATTR VkBool32 VKAPI_CALL vulkan_debug_callback(
   VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
   VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -130,150 +185,70 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL vulkan_debug_callback(
   return VK_FALSE;
 }
 
-VkShaderModule create_shader_module(VkDevice& device, const vector<char>& code) {
-  VkShaderModuleCreateInfo create_info = {
-    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-    .codeSize = code.size(),
-    .pCode = reinterpret_cast<const uint32_t*>(code.data())
-  };
-  VkShaderModule module;
-  VkResult res = vkCreateShaderModule(device, &create_info, nullptr, &module);
-  assert(res == VK_SUCCESS);
-  return module;
-}
-
-uint32_t find_mem_type_index(VkPhysicalDevice& phys_device,
-    uint32_t type_filter,
-    VkMemoryPropertyFlags target_mem_flags) {
-  VkPhysicalDeviceMemoryProperties mem_props;
-  vkGetPhysicalDeviceMemoryProperties(phys_device, &mem_props);
-
-  uint32_t mem_type_index = 0;
-  bool found_mem_type = false;
-  for (uint32_t i = 0; i < mem_props.memoryTypeCount; ++i) {
-    bool mem_type_supported = type_filter & (1 << i);
-    bool has_target_props = (mem_props.memoryTypes[i].propertyFlags &
-      target_mem_flags) == target_mem_flags;
-    if (mem_type_supported && has_target_props) {
-      mem_type_index = i;
-      found_mem_type = true;
-      break;
-    }
-  }
-  assert(found_mem_type);
-  return mem_type_index;
-}
-
-VkCommandBuffer begin_single_time_commands(AppState& state) {
-  VkCommandBufferAllocateInfo alloc_info = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-    .commandPool = state.cmd_pool,
-    .commandBufferCount = 1
-  };
-  VkCommandBuffer tmp_cmd_buffer;
-  vkAllocateCommandBuffers(state.device, &alloc_info, &tmp_cmd_buffer);
-
-  VkCommandBufferBeginInfo begin_info = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-  };
-  vkBeginCommandBuffer(tmp_cmd_buffer, &begin_info);
-
-  return tmp_cmd_buffer;
-}
-
-void end_single_time_commands(AppState& state, VkCommandBuffer cmd_buffer) {
-  vkEndCommandBuffer(cmd_buffer);
-
-  VkSubmitInfo submit_info = {
-    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-    .commandBufferCount = 1,
-    .pCommandBuffers = &cmd_buffer
-  };
-  vkQueueSubmit(state.queue, 1, &submit_info, VK_NULL_HANDLE);
-  vkQueueWaitIdle(state.queue);
-
-  vkFreeCommandBuffers(state.device, state.cmd_pool, 1, &cmd_buffer);
+// Copies data into the staging ring. The region may be reused by a later
+// upload once the batch that reads from it completes.
+StagingRegion stage_data(AppState& state, const void* data,
+    VkDeviceSize size) {
+  StagingRegion region = upload_stage(state.uploader, size, 16);
+  memcpy(region.data, data, (size_t) size);
+  return region;
 }
 
 void copy_buffer(
     AppState& state,
-    VkBuffer src_buffer, VkBuffer dst_buffer,
+    VkBuffer src_buffer, VkDeviceSize src_offset, VkBuffer dst_buffer,
     VkDeviceSize buffer_size) {
-  VkCommandBuffer tmp_cmd_buffer = begin_single_time_commands(state);
+  VkCommandBuffer cmd_buffer = upload_cmd_buffer(state.uploader);
 
   VkBufferCopy copy_region = {
-    .srcOffset = 0,
+    .srcOffset = src_offset,
     .dstOffset = 0,
     .size = buffer_size
   };
-  vkCmdCopyBuffer(tmp_cmd_buffer, src_buffer, dst_buffer,
+  vkCmdCopyBuffer(cmd_buffer, src_buffer, dst_buffer,
       1, &copy_region);
-  
-  end_single_time_commands(state, tmp_cmd_buffer);
 }
 
 void create_buffer(
-    VkDevice device,
-    VkPhysicalDevice phys_device,
+    MemAllocator& allocator,
     VkDeviceSize size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags props, VkBuffer& buffer, VkDeviceMemory& buffer_mem) {
+    VkMemoryPropertyFlags props, VkBuffer& buffer, MemAlloc& buffer_mem) {
   VkBufferCreateInfo buffer_info = {
     .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
     .size = size,
     .usage = usage,
     .sharingMode = VK_SHARING_MODE_EXCLUSIVE
   };
-  VkResult res = vkCreateBuffer(device, &buffer_info, nullptr, &buffer);
+  VkResult res = vkCreateBuffer(allocator.device, &buffer_info, nullptr,
+      &buffer);
   assert(res == VK_SUCCESS);
 
   VkMemoryRequirements mem_reqs;
-  vkGetBufferMemoryRequirements(device, buffer, &mem_reqs);
-
-  uint32_t mem_type_index = find_mem_type_index(
-      phys_device, mem_reqs.memoryTypeBits, props);
-  VkMemoryAllocateInfo alloc_info = {
-    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-    .allocationSize = mem_reqs.size,
-    .memoryTypeIndex = mem_type_index
-  };
-  res = vkAllocateMemory(device, &alloc_info, nullptr, &buffer_mem);
-  assert(res == VK_SUCCESS);
+  vkGetBufferMemoryRequirements(allocator.device, buffer, &mem_reqs);
 
-  vkBindBufferMemory(device, buffer, buffer_mem, 0);
+  buffer_mem = alloc_mem(allocator, mem_reqs, props, MEM_TILING_LINEAR);
+  vkBindBufferMemory(allocator.device, buffer, buffer_mem.mem,
+      buffer_mem.offset);
 }
 
 void create_index_buffer(
     AppState& state,
     vector<uint16_t>& indices,
-    VkBuffer& index_buffer, VkDeviceMemory& index_buffer_mem) {
+    VkBuffer& index_buffer, MemAlloc& index_buffer_mem) {
   VkDeviceSize buffer_size = sizeof(indices[0]) * indices.size();
 
-  VkBuffer staging_buffer;
-  VkDeviceMemory staging_buffer_mem;
-  create_buffer(state.device, state.phys_device, buffer_size,
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      staging_buffer, staging_buffer_mem);
-
-  void* data;
-  vkMapMemory(state.device, staging_buffer_mem, 0, buffer_size, 0, &data);
-  memcpy(data, indices.data(), (size_t) buffer_size);
-  vkUnmapMemory(state.device, staging_buffer_mem);
+  StagingRegion staging = stage_data(state, indices.data(), buffer_size);
 
-  create_buffer(state.device, state.phys_device, buffer_size,
+  create_buffer(state.allocator, buffer_size,
       VK_BUFFER_USAGE_TRANSFER_DST_BIT |
         VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
         index_buffer, index_buffer_mem);
 
   copy_buffer(state,
-      staging_buffer, index_buffer, buffer_size);
-
-  vkDestroyBuffer(state.device, staging_buffer, nullptr);
-  vkFreeMemory(state.device, staging_buffer_mem, nullptr);
+      staging.buffer, staging.offset, index_buffer, buffer_size);
+  upload_release_buffer(state.uploader, index_buffer,
+      VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
 }
 
 VkFormat find_supported_format(VkPhysicalDevice& phys_device,
@@ -478,36 +453,90 @@ void setup_logical_device(AppState& state) {
   printf("\n");
   assert(found_index);
 
-  // init logical device
+  // find a queue for uploads. Prefer a transfer-only family, which maps to
+  // the DMA engines on discrete GPUs, then any other family, then a second
+  // queue of the graphics family.
+  int transfer_family = -1;
+  int other_family = -1;
+  for (int i = 0; i < queue_family_count; ++i) {
+    VkQueueFlags flags = queue_fam_props[i].queueFlags;
+    if (i == state.target_family_index ||
+        !(flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT |
+            VK_QUEUE_COMPUTE_BIT))) {
+      continue;
+    }
+    bool transfer_only = !(flags & (VK_QUEUE_GRAPHICS_BIT |
+          VK_QUEUE_COMPUTE_BIT));
+    if (transfer_only && transfer_family == -1) {
+      transfer_family = i;
+    } else if (other_family == -1) {
+      other_family = i;
+    }
+  }
+  if (transfer_family == -1) {
+    transfer_family = other_family;
+  }
 
-  float queue_priority = 1.0f;
-  VkDeviceQueueCreateInfo queue_info = {
+  float queue_priorities[] = {1.0f, 1.0f};
+  vector<VkDeviceQueueCreateInfo> queue_infos = {{
     .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
     .pNext = nullptr,
     .queueFamilyIndex = state.target_family_index,
     .queueCount = 1,
-    .pQueuePriorities = &queue_priority
-  };
+    .pQueuePriorities = queue_priorities
+  }};
+  uint32_t transfer_queue_index = 0;
+  if (transfer_family != -1) {
+    state.transfer_family_index = transfer_family;
+    queue_infos.push_back({
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .pNext = nullptr,
+      .queueFamilyIndex = state.transfer_family_index,
+      .queueCount = 1,
+      .pQueuePriorities = queue_priorities
+    });
+    printf("uploading on queue family %d\n\n", transfer_family);
+  } else if (queue_fam_props[state.target_family_index].queueCount > 1) {
+    state.transfer_family_index = state.target_family_index;
+    queue_infos[0].queueCount = 2;
+    transfer_queue_index = 1;
+    printf("uploading on a second graphics queue\n\n");
+  } else {
+    // single queue devices, e.g. lavapipe
+    state.transfer_family_index = state.target_family_index;
+    printf("uploading on the graphics queue\n\n");
+  }
+  state.upload_can_blit = queue_fam_props[state.transfer_family_index]
+    .queueFlags & VK_QUEUE_GRAPHICS_BIT;
+
   vector<const char*> device_ext_names = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
   };
+  // baked textures may be block compressed
+  VkPhysicalDeviceFeatures supported_features;
+  vkGetPhysicalDeviceFeatures(state.phys_device, &supported_features);
+  VkPhysicalDeviceFeatures features = {};
+  features.textureCompressionBC = supported_features.textureCompressionBC;
+  state.supports_bc = features.textureCompressionBC == VK_TRUE;
   VkDeviceCreateInfo device_info = {
     .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
     .pNext = nullptr,
-    .queueCreateInfoCount = 1,
-    .pQueueCreateInfos = &queue_info,
+    .queueCreateInfoCount = static_cast<uint32_t>(queue_infos.size()),
+    .pQueueCreateInfos = queue_infos.data(),
     .enabledExtensionCount = static_cast<uint32_t>(device_ext_names.size()),
     .ppEnabledExtensionNames = device_ext_names.data(),
     .enabledLayerCount = 0,
     .ppEnabledLayerNames = nullptr,
-    .pEnabledFeatures = nullptr
+    .pEnabledFeatures = &features
   };
   VkResult res = vkCreateDevice(state.phys_device, &device_info,
       nullptr, &state.device);
   assert(res == VK_SUCCESS);
 
-  // retrieve our queue
+  // retrieve our queues
   vkGetDeviceQueue(state.device, state.target_family_index, 0, &state.queue);
+  vkGetDeviceQueue(state.device, state.transfer_family_index,
+      transfer_queue_index, &state.transfer_queue);
 }
 
 void prepare_swapchain_creation(AppState& state) {
@@ -555,7 +584,7 @@ void prepare_swapchain_creation(AppState& state) {
 }
 
 VkImageView create_image_view(AppState& state, VkImage image,
-    VkFormat format, VkImageAspectFlags aspect_flags) {
+    VkFormat format, VkImageAspectFlags aspect_flags, uint32_t mip_levels) {
   VkImageViewCreateInfo view_info = {
     .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
     .image = image,
@@ -564,7 +593,7 @@ VkImageView create_image_view(AppState& state, VkImage image,
     .subresourceRange = {
       .aspectMask = aspect_flags,
       .baseMipLevel = 0,
-      .levelCount = 1,
+      .levelCount = mip_levels,
       .baseArrayLayer = 0,
       .layerCount = 1
     }
@@ -594,11 +623,18 @@ void setup_swapchain(AppState& state) {
     .preTransform = state.surface_caps.currentTransform,
     .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
     .presentMode = state.target_present_mode,
-    .oldSwapchain = VK_NULL_HANDLE
+    // lets the driver hand the old images over to the new swapchain
+    .oldSwapchain = state.swapchain
   };
+  VkSwapchainKHR old_swapchain = state.swapchain;
   VkResult res = vkCreateSwapchainKHR(state.device,
       &swapchain_info, nullptr, &state.swapchain);
   assert(res == VK_SUCCESS);
+  // the old swapchain is retired now. Nothing in flight uses it, since
+  // recreate_swapchain waited for the present queue to go idle.
+  if (old_swapchain != VK_NULL_HANDLE) {
+    vkDestroySwapchainKHR(state.device, old_swapchain, nullptr);
+  }
 
   // retrieve the swapchain images
   uint32_t swapchain_img_count = 0;
@@ -613,7 +649,7 @@ void setup_swapchain(AppState& state) {
   for (int i = 0; i < state.swapchain_images.size(); ++i) {
     state.swapchain_img_views[i] = create_image_view(state,
         state.swapchain_images[i], state.target_format.format,
-        VK_IMAGE_ASPECT_COLOR_BIT);
+        VK_IMAGE_ASPECT_COLOR_BIT, 1);
   }
 }
 
@@ -681,7 +717,7 @@ void setup_renderpass(AppState& state) {
 void setup_descriptor_set_layout(AppState& state) {
   VkDescriptorSetLayoutBinding ubo_layout_binding = {
     .binding = 0,
-    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
     .descriptorCount = 1,
     .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
     .pImmutableSamplers = nullptr
@@ -707,10 +743,10 @@ void setup_descriptor_set_layout(AppState& state) {
 }
 
 void setup_graphics_pipeline(AppState& state) {
-  auto vert_shader_code = read_file("../shaders/vert.spv");
-  auto frag_shader_code = read_file("../shaders/frag.spv");
-  VkShaderModule vert_module = create_shader_module(state.device, vert_shader_code);
-  VkShaderModule frag_module = create_shader_module(state.device, frag_shader_code);
+  VkShaderModule vert_module = load_shader_module(state.device,
+      "../shaders/vert.spv");
+  VkShaderModule frag_module = load_shader_module(state.device,
+      "../shaders/frag.spv");
 
   VkPipelineShaderStageCreateInfo vert_stage_info = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -739,24 +775,23 @@ void setup_graphics_pipeline(AppState& state) {
     .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
     .primitiveRestartEnable = VK_FALSE
   };
-  VkViewport viewport = {
-    .x = 0.0f,
-    .y = 0.0f,
-    .width = (float) state.target_extent.width,
-    .height = (float) state.target_extent.height,
-    .minDepth = 0.0f,
-    .maxDepth = 1.0f
-  };
-  VkRect2D scissor_rect = {
-    .offset = {0, 0},
-    .extent = state.target_extent
-  };
+  // the viewport and scissor are set at record time so that the pipeline
+  // survives a resize
   VkPipelineViewportStateCreateInfo viewport_state_info = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
     .viewportCount = 1,
-    .pViewports = &viewport,
+    .pViewports = nullptr,
     .scissorCount = 1,
-    .pScissors = &scissor_rect
+    .pScissors = nullptr
+  };
+  vector<VkDynamicState> dynamic_states = {
+    VK_DYNAMIC_STATE_VIEWPORT,
+    VK_DYNAMIC_STATE_SCISSOR
+  };
+  VkPipelineDynamicStateCreateInfo dynamic_state_info = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+    .dynamicStateCount = (uint32_t) dynamic_states.size(),
+    .pDynamicStates = dynamic_states.data()
   };
   VkPipelineRasterizationStateCreateInfo rast_info = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
@@ -820,14 +855,14 @@ void setup_graphics_pipeline(AppState& state) {
     .pMultisampleState = &multisampling,
     .pDepthStencilState = &depth_stencil,
     .pColorBlendState = &color_blending,
-    .pDynamicState = nullptr,
+    .pDynamicState = &dynamic_state_info,
     .layout = state.pipeline_layout,
     .renderPass = state.render_pass,
     .subpass = 0,
     .basePipelineHandle = VK_NULL_HANDLE,
     .basePipelineIndex = -1
   };
-  res = vkCreateGraphicsPipelines(state.device, VK_NULL_HANDLE, 1,
+  res = vkCreateGraphicsPipelines(state.device, state.pipeline_cache, 1,
       &graphics_pipeline_info, nullptr, &state.graphics_pipeline);
   assert(res == VK_SUCCESS);
 
@@ -856,22 +891,10 @@ void setup_framebuffers(AppState& state) {
   }
 }
 
-void setup_command_pool(AppState& state) {
-  VkCommandPoolCreateInfo cmd_pool_info = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-    .pNext = nullptr,
-    .queueFamilyIndex = state.target_family_index,
-    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
-  };
-  VkResult res = vkCreateCommandPool(state.device, &cmd_pool_info, nullptr,
-      &state.cmd_pool);
-  assert(res == VK_SUCCESS);
-}
-
 void create_image(AppState& state, uint32_t w, uint32_t h,
-    VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+    uint32_t mip_levels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
     VkMemoryPropertyFlags mem_props, VkImage& image,
-    VkDeviceMemory& image_mem) {
+    MemAlloc& image_mem) {
 
   VkImageCreateInfo img_info = {
     .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -879,7 +902,7 @@ void create_image(AppState& state, uint32_t w, uint32_t h,
     .extent.width = w,
     .extent.height = h,
     .extent.depth = 1,
-    .mipLevels = 1,
+    .mipLevels = mip_levels,
     .arrayLayers = 1,
     .format = format,
     .tiling = tiling,
@@ -895,44 +918,35 @@ void create_image(AppState& state, uint32_t w, uint32_t h,
 
   VkMemoryRequirements mem_reqs;
   vkGetImageMemoryRequirements(state.device, image, &mem_reqs);
-  VkMemoryAllocateInfo alloc_info = {
-    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-    .allocationSize = mem_reqs.size,
-    .memoryTypeIndex = find_mem_type_index(state.phys_device,
-        mem_reqs.memoryTypeBits, mem_props)
-  };
-  res = vkAllocateMemory(state.device, &alloc_info, nullptr,
-    &image_mem);
-  assert(res == VK_SUCCESS);
+  image_mem = alloc_mem(state.allocator, mem_reqs, mem_props,
+      tiling == VK_IMAGE_TILING_OPTIMAL ? MEM_TILING_OPTIMAL : MEM_TILING_LINEAR);
 
-  vkBindImageMemory(state.device, image, image_mem, 0); 
+  vkBindImageMemory(state.device, image, image_mem.mem, image_mem.offset);
 }
 
 void copy_buffer_to_image(AppState& state, VkBuffer buffer,
-    VkImage image, uint32_t w, uint32_t h) {
-  VkCommandBuffer tmp_cmd_buffer = begin_single_time_commands(state);
+    VkDeviceSize buffer_offset, VkImage image, uint32_t w, uint32_t h,
+    uint32_t mip_level) {
+  VkCommandBuffer cmd_buffer = upload_cmd_buffer(state.uploader);
 
   VkBufferImageCopy region = {
-    .bufferOffset = 0,
+    .bufferOffset = buffer_offset,
     .bufferRowLength = 0,
     .bufferImageHeight = 0,
     .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-    .imageSubresource.mipLevel = 0,
+    .imageSubresource.mipLevel = mip_level,
     .imageSubresource.baseArrayLayer = 0,
     .imageSubresource.layerCount = 1,
     .imageOffset = {0, 0, 0},
     .imageExtent = {w, h, 1}
   };
-  vkCmdCopyBufferToImage(tmp_cmd_buffer, buffer, image,
+  vkCmdCopyBufferToImage(cmd_buffer, buffer, image,
       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-  end_single_time_commands(state, tmp_cmd_buffer);
 }
 
-void transition_image_layout(AppState& state, VkImage img,
-    VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout) {
-  VkCommandBuffer tmp_cmd_buffer = begin_single_time_commands(state);
-
+void transition_image_layout(VkCommandBuffer cmd_buffer, VkImage img,
+    VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout,
+    uint32_t mip_levels) {
   VkAccessFlags src_access, dst_access;
   VkPipelineStageFlags src_stage, dst_stage;
 
@@ -968,7 +982,7 @@ void transition_image_layout(AppState& state, VkImage img,
     .image = img,
     .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
     .subresourceRange.baseMipLevel = 0,
-    .subresourceRange.levelCount = 1,
+    .subresourceRange.levelCount = mip_levels,
     .subresourceRange.baseArrayLayer = 0,
     .subresourceRange.layerCount = 1,
     .srcAccessMask = src_access,
@@ -980,62 +994,143 @@ void transition_image_layout(AppState& state, VkImage img,
       barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
     }
   }
-  vkCmdPipelineBarrier(tmp_cmd_buffer,
+  vkCmdPipelineBarrier(cmd_buffer,
       src_stage, dst_stage,
       0,
       0, nullptr,
       0, nullptr,
       1, &barrier);
+}
 
-  end_single_time_commands(state, tmp_cmd_buffer);
+// Uploads the source image with a full mip chain. The chain is blitted on
+// the upload queue when it and the format allow, otherwise it is built on
+// the CPU by the decoder.
+static void setup_source_texture(AppState& state) {
+  VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+  bool blit = state.upload_can_blit &&
+    supports_linear_blit(state.phys_device, format);
+  vector<string> paths = {TEXTURE_PATH};
+  decode_images(state.uploader, state.record_threads, paths, !blit,
+      [&](DecodedImage& image) {
+        assert(image.ok);
+        uint32_t w = image.w;
+        uint32_t h = image.h;
+        state.texture_format = format;
+        state.texture_mip_levels = mip_level_count(w, h);
+        vector<MipLevel> levels;
+        state.texture_size = layout_mip_chain(w, h,
+            state.texture_mip_levels, levels);
+
+        create_image(state, w, h, state.texture_mip_levels, format,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+              (blit ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0) |
+              VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            state.texture_img, state.texture_img_mem);
+        transition_image_layout(upload_cmd_buffer(state.uploader),
+            state.texture_img, format,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            state.texture_mip_levels);
+        for (uint32_t i = 0; i < image.levels.size(); ++i) {
+          copy_buffer_to_image(state, image.staging.buffer,
+              image.staging.offset + image.levels[i].offset,
+              state.texture_img, image.levels[i].w, image.levels[i].h, i);
+        }
+        if (blit) {
+          record_mip_blits(upload_cmd_buffer(state.uploader),
+              state.texture_img, w, h, state.texture_mip_levels);
+        }
+        printf("texture %s: %ux%u, %u mip levels %s\n", TEXTURE_PATH, w, h,
+            state.texture_mip_levels, blit ? "blitted" : "built on the cpu");
+      });
 }
 
-void setup_texture_image(AppState& state) {
-  int tex_w, tex_h, tex_channels;
-  stbi_uc* pixels = stbi_load("../textures/sample_tex.jpg",
-      &tex_w, &tex_h, &tex_channels, STBI_rgb_alpha);
-  VkDeviceSize img_size = tex_w * tex_h * 4;
-  assert(pixels);
-
-  VkBuffer staging_buffer;
-  VkDeviceMemory staging_buffer_mem;
-
-  create_buffer(state.device, state.phys_device, img_size,
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      staging_buffer, staging_buffer_mem);
-  void* data;
-  vkMapMemory(state.device, staging_buffer_mem, 0, img_size, 0, &data);
-  memcpy(data, pixels, (size_t) img_size);
-  vkUnmapMemory(state.device, staging_buffer_mem);
-  
-  stbi_image_free(pixels);
+// Copies the levels of a baked texture from the mapped file straight into
+// staging memory. On devices without BC support the blocks are decoded to
+// RGBA8 on the way. Returns false, having recorded nothing, if a level
+// cannot be decoded.
+static bool setup_baked_texture(AppState& state, TextureFile& tex) {
+  VkFormat file_format = tex_format_vk(tex.format);
+  bool native = !tex_format_is_block(tex.format);
+  if (!native && state.supports_bc) {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(state.phys_device, file_format,
+        &props);
+    native = props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+  }
+  TexFormat upload_format = native ? tex.format : TEX_FORMAT_RGBA8;
+  uint32_t num_levels = tex.header.level_count;
+
+  vector<VkDeviceSize> offsets(num_levels);
+  VkDeviceSize staging_size = 0;
+  for (uint32_t i = 0; i < num_levels; ++i) {
+    offsets[i] = staging_size;
+    staging_size += (tex_image_size(upload_format,
+          texture_level_width(tex, i), texture_level_height(tex, i)) + 15) /
+      16 * 16;
+  }
+  StagingRegion staging = upload_stage(state.uploader, staging_size, 16);
+  uint8_t* staging_data = static_cast<uint8_t*>(staging.data);
+  for (uint32_t i = 0; i < num_levels; ++i) {
+    if (native) {
+      read_texture_level(tex, i, staging_data + offsets[i]);
+    } else if (!decode_tex_blocks(texture_level_data(tex, i),
+          texture_level_width(tex, i), texture_level_height(tex, i),
+          tex.format, staging_data + offsets[i])) {
+      printf("failed to decode level %u of %s\n", i, BAKED_TEXTURE_PATH);
+      return false;
+    }
+  }
 
-  create_image(state, tex_w, tex_h, VK_FORMAT_R8G8B8A8_UNORM,
-      VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-        VK_IMAGE_USAGE_SAMPLED_BIT,
+  state.texture_format = tex_format_vk(upload_format);
+  state.texture_mip_levels = num_levels;
+  state.texture_size = staging_size;
+  create_image(state, tex.header.width, tex.header.height, num_levels,
+      state.texture_format, VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
       state.texture_img, state.texture_img_mem);
+  transition_image_layout(upload_cmd_buffer(state.uploader),
+      state.texture_img, state.texture_format,
+      VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      num_levels);
+  for (uint32_t i = 0; i < num_levels; ++i) {
+    copy_buffer_to_image(state, staging.buffer, staging.offset + offsets[i],
+        state.texture_img, texture_level_width(tex, i),
+        texture_level_height(tex, i), i);
+  }
+  printf("texture %s: %ux%u %s, %u mip levels%s\n", BAKED_TEXTURE_PATH,
+      tex.header.width, tex.header.height, tex_format_name(upload_format),
+      num_levels, native ? "" : ", decoded on the cpu");
+  return true;
+}
 
-  transition_image_layout(state, state.texture_img,
-      VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED,
-      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  copy_buffer_to_image(state, staging_buffer, state.texture_img, (uint32_t) tex_w,
-      (uint32_t) tex_h);
-  transition_image_layout(state, state.texture_img,
-      VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-  vkDestroyBuffer(state.device, staging_buffer, nullptr);
-  vkFreeMemory(state.device, staging_buffer_mem, nullptr);
+// Prefers the baked texture, which needs no decoding, over the source
+void setup_texture_image(AppState& state) {
+  auto start_time = chrono::steady_clock::now();
+  TextureFile tex;
+  bool baked = open_texture_file(tex, BAKED_TEXTURE_PATH);
+  if (baked) {
+    baked = setup_baked_texture(state, tex);
+    close_texture_file(tex);
+  }
+  if (!baked) {
+    setup_source_texture(state);
+  }
+  upload_release_image(state.uploader, state.texture_img,
+      VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+  chrono::duration<double, milli> load_time =
+    chrono::steady_clock::now() - start_time;
+  printf("texture load %.2fms, %.1fKB on the device\n\n", load_time.count(),
+      state.texture_size / 1024.0);
 }
 
 void setup_texture_image_view(AppState& state) {
   state.texture_img_view = create_image_view(state,
-      state.texture_img, VK_FORMAT_R8G8B8A8_UNORM,
-      VK_IMAGE_ASPECT_COLOR_BIT);
+      state.texture_img, state.texture_format,
+      VK_IMAGE_ASPECT_COLOR_BIT, state.texture_mip_levels);
 }
 
 void setup_texture_sampler(AppState& state) {
@@ -1055,7 +1150,7 @@ void setup_texture_sampler(AppState& state) {
     .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
     .mipLodBias = 0.0f,
     .minLod = 0.0f,
-    .maxLod = 0.0f
+    .maxLod = (float) state.texture_mip_levels
   };
   VkResult res = vkCreateSampler(state.device, &sampler_info,
       nullptr, &state.texture_sampler);
@@ -1066,31 +1161,23 @@ void setup_depth_resources(AppState& state) {
   VkFormat depth_format = find_depth_format(state.phys_device);
 
   create_image(state, state.target_extent.width, state.target_extent.height,
-      depth_format, VK_IMAGE_TILING_OPTIMAL,
+      1, depth_format, VK_IMAGE_TILING_OPTIMAL,
       VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, state.depth_img,
       state.depth_img_mem);
   state.depth_img_view = create_image_view(state, state.depth_img,
-      depth_format, VK_IMAGE_ASPECT_DEPTH_BIT);
+      depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
 
-  transition_image_layout(state, state.depth_img,
-      depth_format, VK_IMAGE_LAYOUT_UNDEFINED,
-      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+  // transfer queues cannot use depth attachment layouts
+  transition_image_layout(upload_cmd_buffer(state.gfx_uploader),
+      state.depth_img, depth_format, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
 }
 
 void setup_vertex_buffer(AppState& state, vector<Vertex>& vertices) {
   VkDeviceSize buffer_size = sizeof(vertices[0]) * vertices.size();
 
-  VkBuffer staging_buffer;
-  VkDeviceMemory staging_buffer_mem;
-  create_buffer(state.device, state.phys_device,
-      buffer_size,
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      staging_buffer, staging_buffer_mem);
-
-  create_buffer(state.device, state.phys_device,
+  create_buffer(state.allocator,
       buffer_size,
       VK_BUFFER_USAGE_TRANSFER_DST_BIT |
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
@@ -1098,17 +1185,12 @@ void setup_vertex_buffer(AppState& state, vector<Vertex>& vertices) {
       state.vert_buffer, state.vert_buffer_mem);
 
   // upload vertex data to vertex buffer mem
-  void* mapped_data;
-  vkMapMemory(state.device, staging_buffer_mem, 0, buffer_size, 0, 
-    &mapped_data);
-  memcpy(mapped_data, vertices.data(), (size_t) buffer_size);
-  vkUnmapMemory(state.device, staging_buffer_mem);
-
-  copy_buffer(state, staging_buffer,
+  StagingRegion staging = stage_data(state, vertices.data(), buffer_size);
+  copy_buffer(state, staging.buffer, staging.offset,
       state.vert_buffer, buffer_size);
-
-  vkDestroyBuffer(state.device, staging_buffer, nullptr);
-  vkFreeMemory(state.device, staging_buffer_mem, nullptr);
+  upload_release_buffer(state.uploader, state.vert_buffer,
+      VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+      VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
 }
 
 void setup_index_buffer(AppState& state, vector<uint16_t>& indices) {
@@ -1117,15 +1199,11 @@ void setup_index_buffer(AppState& state, vector<uint16_t>& indices) {
 }
 
 void setup_uniform_buffers(AppState& state) {
-  state.unif_buffers.resize(state.swapchain_img_views.size());
-  state.unif_buffers_mem.resize(state.swapchain_img_views.size());
-  VkDeviceSize unif_buffer_size = sizeof(UniformBufferObject);
-  for (size_t i = 0; i < state.unif_buffers.size(); ++i) {
-    create_buffer(state.device, state.phys_device, unif_buffer_size,
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        state.unif_buffers[i], state.unif_buffers_mem[i]);
+  init_frame_allocator(state.frame_allocator, state.allocator,
+      max_frames_in_flight, FRAME_ALLOC_SIZE,
+      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+  for (FrameContext& frame : state.frames) {
+    frame.arena = frame_allocator_slice(state.frame_allocator, frame.index);
   }
 }
 
@@ -1149,87 +1227,179 @@ void setup_descriptor_pool(AppState& state) {
 }
 
 void setup_descriptor_sets(AppState& state) {
-  // create one descriptor set for each index of the swapchain
-  vector<VkDescriptorSetLayout> desc_set_layouts(
-      state.swapchain_img_views.size(), state.desc_set_layout);
+  // a single set serves every frame. The dynamic offset passed to
+  // vkCmdBindDescriptorSets picks the frame's uniform data.
   VkDescriptorSetAllocateInfo desc_set_alloc_info = {
     .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
     .descriptorPool = state.desc_pool,
-    .descriptorSetCount = (uint32_t) desc_set_layouts.size(),
-    .pSetLayouts = desc_set_layouts.data()
+    .descriptorSetCount = 1,
+    .pSetLayouts = &state.desc_set_layout
   };
-  state.desc_sets.resize(desc_set_layouts.size());
   VkResult res = vkAllocateDescriptorSets(state.device,
-      &desc_set_alloc_info, state.desc_sets.data());
+      &desc_set_alloc_info, &state.desc_set);
   assert(res == VK_SUCCESS);
   
-  // for each descriptor set, set the resources for each of its bindings
-  for (size_t i = 0; i < state.desc_sets.size(); ++i) {
-    VkDescriptorBufferInfo buffer_info = {
-      .buffer = state.unif_buffers[i],
-      .offset = 0,
-      .range = sizeof(UniformBufferObject)
-    };
-    VkDescriptorImageInfo image_info = {
-      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-      .imageView = state.texture_img_view,
-      .sampler = state.texture_sampler
-    };
-    vector<VkWriteDescriptorSet> desc_writes(2);
-    desc_writes[0] = {
-      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = state.desc_sets[i],
-      .dstBinding = 0,
-      .dstArrayElement = 0,
-      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-      .descriptorCount = 1,
-      .pBufferInfo = &buffer_info,
-      .pImageInfo = nullptr,
-      .pTexelBufferView = nullptr
-    };
-    desc_writes[1] = {
-      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = state.desc_sets[i],
-      .dstBinding = 1,
-      .dstArrayElement = 0,
-      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      .descriptorCount = 1,
-      .pImageInfo = &image_info
-    };
-    vkUpdateDescriptorSets(state.device, (uint32_t) desc_writes.size(),
-        desc_writes.data(), 0, nullptr);
-  }
+  // set the resources for each of its bindings
+  VkDescriptorBufferInfo buffer_info = {
+    .buffer = state.frame_allocator.buffer,
+    .offset = 0,
+    .range = sizeof(UniformBufferObject)
+  };
+  VkDescriptorImageInfo image_info = {
+    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    .imageView = state.texture_img_view,
+    .sampler = state.texture_sampler
+  };
+  vector<VkWriteDescriptorSet> desc_writes(2);
+  desc_writes[0] = {
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = state.desc_set,
+    .dstBinding = 0,
+    .dstArrayElement = 0,
+    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+    .descriptorCount = 1,
+    .pBufferInfo = &buffer_info,
+    .pImageInfo = nullptr,
+    .pTexelBufferView = nullptr
+  };
+  desc_writes[1] = {
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = state.desc_set,
+    .dstBinding = 1,
+    .dstArrayElement = 0,
+    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+    .descriptorCount = 1,
+    .pImageInfo = &image_info
+  };
+  vkUpdateDescriptorSets(state.device, (uint32_t) desc_writes.size(),
+      desc_writes.data(), 0, nullptr);
 }
 
-void setup_command_buffers(AppState& state) {
-  state.cmd_buffers.resize(state.swapchain_framebuffers.size());
-  VkCommandBufferAllocateInfo cmd_buffer_info = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-    .commandPool = state.cmd_pool,
-    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-    .commandBufferCount = (uint32_t) state.swapchain_framebuffers.size()
+// Records draws [first_draw, first_draw + num_draws) of the scene
+void record_scene_draws(AppState& state, VkCommandBuffer cmd_buffer,
+    uint32_t first_draw, uint32_t num_draws, vector<uint16_t>& indices,
+    uint32_t ubo_offset) {
+  vector<VkBuffer> vert_buffers = {state.vert_buffer};
+  vector<VkDeviceSize> byte_offsets = {0};
+
+  VkViewport viewport = {
+    .x = 0.0f,
+    .y = 0.0f,
+    .width = (float) state.target_extent.width,
+    .height = (float) state.target_extent.height,
+    .minDepth = 0.0f,
+    .maxDepth = 1.0f
   };
-  VkResult res = vkAllocateCommandBuffers(state.device, &cmd_buffer_info,
-      state.cmd_buffers.data());
-  assert(res == VK_SUCCESS);
+  VkRect2D scissor_rect = {
+    .offset = {0, 0},
+    .extent = state.target_extent
+  };
+
+  vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+      state.graphics_pipeline);
+  // secondaries do not inherit dynamic state, each one sets its own
+  vkCmdSetViewport(cmd_buffer, 0, 1, &viewport);
+  vkCmdSetScissor(cmd_buffer, 0, 1, &scissor_rect);
+  vkCmdBindVertexBuffers(cmd_buffer, 0, vert_buffers.size(),
+      vert_buffers.data(), byte_offsets.data());
+  vkCmdBindIndexBuffer(cmd_buffer, state.index_buffer, 0,
+      VK_INDEX_TYPE_UINT16);
+  // the desc sets specify the link between the binding points and actual
+  // resources
+  vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+      state.pipeline_layout, 0, 1, &state.desc_set, 1, &ubo_offset);
+  for (uint32_t d = first_draw; d < first_draw + num_draws; ++d) {
+    vkCmdDrawIndexed(cmd_buffer, (uint32_t) indices.size(),
+        1, 0, 0, 0);
+  }
+}
+
+// Records the static scene draws into the frame's cached secondary. Only
+// happens when the cache was invalidated or the UBO offset changed.
+void record_scene(AppState& state, uint32_t frame_index,
+    vector<uint16_t>& indices, uint32_t ubo_offset) {
+  VkCommandBuffer cmd_buffer;
+  if (!cmd_cache_begin(state.scene_cmds, frame_index, ubo_offset,
+        state.render_pass, 0, cmd_buffer)) {
+    return;
+  }
+  record_scene_draws(state, cmd_buffer, 0, state.num_scene_draws, indices,
+      ubo_offset);
+  cmd_cache_end(state.scene_cmds, frame_index);
 }
 
-void record_render_pass(AppState& state, uint32_t buffer_index,
-    vector<uint16_t>& indices) {
-  uint32_t i = buffer_index;
+// Records the scene in chunks across the record threads. Returns the
+// secondaries in draw order.
+vector<VkCommandBuffer>& record_scene_parallel(AppState& state,
+    ParallelRecorder& recorder, uint32_t frame_index,
+    vector<uint16_t>& indices, uint32_t ubo_offset) {
+  // a few chunks per thread keeps the threads busy if some run slow
+  uint32_t num_chunks = std::min(state.num_scene_draws,
+      4 * thread_pool_size(*recorder.threads));
+  uint32_t draws_per_chunk =
+    (state.num_scene_draws + num_chunks - 1) / num_chunks;
+  num_chunks = (state.num_scene_draws + draws_per_chunk - 1) /
+    draws_per_chunk;
+  return parallel_record(recorder, frame_index, num_chunks,
+      state.render_pass, 0, [&](VkCommandBuffer cmd_buffer, uint32_t chunk) {
+    uint32_t first_draw = chunk * draws_per_chunk;
+    uint32_t num_draws = std::min(draws_per_chunk,
+        state.num_scene_draws - first_draw);
+    record_scene_draws(state, cmd_buffer, first_draw, num_draws, indices,
+        ubo_offset);
+  });
+}
 
-  // moves the command buffer back to the initial state so that we
-  // may record again
-  VkResult res = vkResetCommandBuffer(state.cmd_buffers[i],
-      VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
+// The overlay changes every frame, so it is recorded into the frame's
+// transient pool
+void record_overlay(AppState& state, FrameContext& frame) {
+  VkCommandBufferInheritanceInfo inheritance_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+    .renderPass = state.render_pass,
+    .subpass = 0,
+    .framebuffer = VK_NULL_HANDLE
+  };
+  VkCommandBufferBeginInfo begin_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+      VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+    .pInheritanceInfo = &inheritance_info
+  };
+  VkResult res = vkBeginCommandBuffer(frame.overlay_cmd_buffer, &begin_info);
+  assert(res == VK_SUCCESS);
+  ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(),
+      frame.overlay_cmd_buffer);
+  res = vkEndCommandBuffer(frame.overlay_cmd_buffer);
   assert(res == VK_SUCCESS);
+}
 
+// The primary only begins the render pass and executes the secondaries.
+// It is re-recorded every frame since the overlay changes, but that is
+// cheap.
+void record_render_pass(AppState& state, FrameContext& frame,
+    uint32_t img_index, vector<uint16_t>& indices, UploadHandoff& handoff,
+    uint32_t ubo_offset) {
+  uint32_t frame_index = frame.index;
+  VkCommandBuffer cmd_buffer = frame.cmd_buffer;
+
+  vector<VkCommandBuffer> secondaries;
+  if (state.num_record_threads > 1) {
+    secondaries = record_scene_parallel(state, state.recorder, frame_index,
+        indices, ubo_offset);
+  } else {
+    record_scene(state, frame_index, indices, ubo_offset);
+    secondaries.push_back(state.scene_cmds.entries[frame_index].cmd_buffer);
+  }
+  record_overlay(state, frame);
+  secondaries.push_back(frame.overlay_cmd_buffer);
+
+  // no reset needed, begin_frame_context reset the whole pool
   VkCommandBufferBeginInfo begin_info = {
     .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
     .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     .pInheritanceInfo = nullptr
   };
-  res = vkBeginCommandBuffer(state.cmd_buffers[i], &begin_info);
+  VkResult res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
   assert(res == VK_SUCCESS);
 
   array<VkClearValue, 2> clear_values = {};
@@ -1239,123 +1409,91 @@ void record_render_pass(AppState& state, uint32_t buffer_index,
   VkRenderPassBeginInfo render_pass_info = {
     .sType= VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
     .renderPass = state.render_pass,
-    .framebuffer = state.swapchain_framebuffers[i],
+    .framebuffer = state.swapchain_framebuffers[img_index],
     .renderArea.offset = {0, 0},
     .renderArea.extent = state.target_extent,
     .clearValueCount = (uint32_t) clear_values.size(),
     .pClearValues = clear_values.data()
   };
-  vector<VkBuffer> vert_buffers = {state.vert_buffer};
-  vector<VkDeviceSize> byte_offsets = {0};
-
-  vkCmdBeginRenderPass(state.cmd_buffers[i], &render_pass_info,
-      VK_SUBPASS_CONTENTS_INLINE);
 
-  vkCmdBindPipeline(state.cmd_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-      state.graphics_pipeline);
-  vkCmdBindVertexBuffers(state.cmd_buffers[i], 0, vert_buffers.size(),
-      vert_buffers.data(), byte_offsets.data());
-  vkCmdBindIndexBuffer(state.cmd_buffers[i], state.index_buffer, 0,
-      VK_INDEX_TYPE_UINT16);
-  // the desc sets specify the link between the binding points and actual
-  // resources
-  vkCmdBindDescriptorSets(state.cmd_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-      state.pipeline_layout, 0, 1, &state.desc_sets[i], 0, nullptr);
-  //vkCmdDraw(cmd_buffers[i], (uint32_t) vertices.size(), 1, 0, 0);
-  vkCmdDrawIndexed(state.cmd_buffers[i], (uint32_t) indices.size(),
-      1, 0, 0, 0);
+  // take ownership of anything uploaded since the last frame
+  record_upload_acquire(cmd_buffer, handoff);
 
-  ImGui_ImplVulkan_RenderDrawData(
-      ImGui::GetDrawData(), state.cmd_buffers[i]);
+  vkCmdBeginRenderPass(cmd_buffer, &render_pass_info,
+      VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  vkCmdExecuteCommands(cmd_buffer, (uint32_t) secondaries.size(),
+      secondaries.data());
+  vkCmdEndRenderPass(cmd_buffer);
 
-  vkCmdEndRenderPass(state.cmd_buffers[i]);
-  res = vkEndCommandBuffer(state.cmd_buffers[i]);
+  res = vkEndCommandBuffer(cmd_buffer);
   assert(res == VK_SUCCESS);
 }
 
-void record_render_passes(AppState& state, vector<uint16_t>& indices) {
-  for (uint32_t i = 0; i < state.cmd_buffers.size(); ++i) {
-    record_render_pass(state, i, indices);
-  }
-}
-
-void setup_sync_objects(AppState& state) {
-  state.img_available_semas.resize(max_frames_in_flight);
-  state.render_done_semas.resize(max_frames_in_flight);
-  state.in_flight_fences.resize(max_frames_in_flight);
-  VkSemaphoreCreateInfo sema_info = {
-    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
-  };
-  VkFenceCreateInfo fence_info = {
-    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-    .flags = VK_FENCE_CREATE_SIGNALED_BIT
-  };
-  for (int i = 0; i < max_frames_in_flight; ++i) {
-    VkResult res = vkCreateSemaphore(state.device, &sema_info, nullptr,
-        &state.img_available_semas[i]);
-    assert(res == VK_SUCCESS);
-    res = vkCreateSemaphore(state.device, &sema_info, nullptr,
-        &state.render_done_semas[i]);
-    assert(res == VK_SUCCESS);
-    res = vkCreateFence(state.device, &fence_info, nullptr,
-        &state.in_flight_fences[i]);
-    assert(res == VK_SUCCESS);
-  }
-}
-
 void cleanup_swapchain(AppState& state) {
   vkDestroyImageView(state.device, state.depth_img_view, nullptr);
   vkDestroyImage(state.device, state.depth_img, nullptr);
-  vkFreeMemory(state.device, state.depth_img_mem, nullptr);
+  free_mem(state.allocator, state.depth_img_mem);
 
   for (VkFramebuffer& fb : state.swapchain_framebuffers) {
     vkDestroyFramebuffer(state.device, fb, nullptr);
   }
-  vkFreeCommandBuffers(state.device, state.cmd_pool,
-      (uint32_t) state.cmd_buffers.size(), state.cmd_buffers.data());
 
-  vkDestroyPipeline(state.device, state.graphics_pipeline, nullptr);
-  vkDestroyPipelineLayout(state.device, state.pipeline_layout, nullptr);
-  vkDestroyRenderPass(state.device, state.render_pass, nullptr);
   for (VkImageView& img_view : state.swapchain_img_views) {
     vkDestroyImageView(state.device, img_view, nullptr);
   }
-  // TODO this triggers a segfault, bug with MoltenVK:
+  // the swapchain itself is kept for setup_swapchain to pass as
+  // oldSwapchain, which retires it.
+  // TODO destroying the last one triggers a segfault, bug with MoltenVK:
   // https://github.com/KhronosGroup/MoltenVK/issues/584
   // Validation layer will complain for now
   //vkDestroySwapchainKHR(state.device, state.swapchain, nullptr);
-  for (size_t i = 0; i < state.swapchain_img_views.size(); ++i) {
-    vkDestroyBuffer(state.device, state.unif_buffers[i], nullptr);
-    vkFreeMemory(state.device, state.unif_buffers_mem[i], nullptr);
-  }
-  vkFreeDescriptorSets(state.device, state.desc_pool,
-      (uint32_t) state.desc_sets.size(), state.desc_sets.data());
 }
 
 void cleanup_vulkan(AppState& state) {
   cleanup_swapchain(state);
+  vkDestroyPipeline(state.device, state.graphics_pipeline, nullptr);
+  vkDestroyPipelineLayout(state.device, state.pipeline_layout, nullptr);
+  vkDestroyRenderPass(state.device, state.render_pass, nullptr);
 
+  vkFreeDescriptorSets(state.device, state.desc_pool, 1, &state.desc_set);
   vkDestroyDescriptorPool(state.device, state.desc_pool, nullptr);
+  cleanup_frame_allocator(state.frame_allocator, state.allocator);
   
   vkDestroySampler(state.device, state.texture_sampler, nullptr);
   vkDestroyImageView(state.device, state.texture_img_view, nullptr);
   vkDestroyImage(state.device, state.texture_img, nullptr);
-  vkFreeMemory(state.device, state.texture_img_mem, nullptr);
+  free_mem(state.allocator, state.texture_img_mem);
 
   vkDestroyDescriptorSetLayout(state.device, state.desc_set_layout, nullptr);
 
   vkDestroyBuffer(state.device, state.index_buffer, nullptr);
-  vkFreeMemory(state.device, state.index_buffer_mem, nullptr);
+  free_mem(state.allocator, state.index_buffer_mem);
   vkDestroyBuffer(state.device, state.vert_buffer, nullptr);
-  vkFreeMemory(state.device, state.vert_buffer_mem, nullptr);
+  free_mem(state.allocator, state.vert_buffer_mem);
 
-  for (int i = 0; i < max_frames_in_flight; ++i) {
-    vkDestroySemaphore(state.device, state.render_done_semas[i], nullptr);
-    vkDestroySemaphore(state.device, state.img_available_semas[i], nullptr);
-    vkDestroyFence(state.device, state.in_flight_fences[i], nullptr);
+  for (FrameContext& frame : state.frames) {
+    cleanup_frame_context(frame, state.device, state.uploader);
   }
-  vkDestroyCommandPool(state.device, state.cmd_pool, nullptr);
-
+  printf("scene command cache: %lu hits, %lu records\n\n",
+      (unsigned long) state.scene_cmds.num_hits,
+      (unsigned long) state.scene_cmds.num_records);
+  cleanup_cmd_cache(state.scene_cmds);
+  cleanup_parallel_recorder(state.recorder);
+  cleanup_thread_pool(state.record_threads);
+
+  cleanup_morph_readback(state.morph_readback);
+  close_morph_trajectory(state.morph_trajectory);
+  cleanup_morph_timeline(state.morph_timeline);
+  cleanup_morph_sim(state.morph_sim);
+  cleanup_uploader(state.gfx_uploader);
+  cleanup_uploader(state.uploader);
+  cleanup_staging_ring(state.staging_ring, state.allocator);
+
+  save_pipeline_cache(state.device, state.pipeline_cache,
+      PIPELINE_CACHE_PATH);
+
+  log_mem_stats(state.allocator);
+  cleanup_mem_allocator(state.allocator);
   vkDestroyDevice(state.device, nullptr);
 
   state.destroy_debug_utils(state.inst, state.debug_messenger, nullptr);
@@ -1374,22 +1512,36 @@ void recreate_swapchain(AppState& state) {
     glfwWaitEvents();
   }
 
-  vkDeviceWaitIdle(state.device);
+  // the frame fences do not cover presents, which still use the old
+  // swapchain until the queue they went to is idle
+  VkResult res = vkQueueWaitIdle(state.queue);
+  assert(res == VK_SUCCESS);
   cleanup_swapchain(state);
+  // the cached draws set the old extent as their viewport
+  invalidate_cmd_cache(state.scene_cmds);
 
-  // TODO - figure out why these in particular must be
-  // called again. Not immediately obvious for some
+  // the render pass and pipeline only depend on the formats, which stay
+  // the same, so only the size dependent resources are rebuilt
   setup_swapchain(state);
-  setup_renderpass(state);
-  setup_graphics_pipeline(state);
   setup_depth_resources(state);
   setup_framebuffers(state);
-  setup_uniform_buffers(state);
-  setup_descriptor_sets(state);
-  setup_command_buffers(state);
+  // the old depth image's block stays empty if the new one did not fit it
+  release_empty_mem_blocks(state.allocator);
   ImGui_ImplVulkan_SetMinImageCount(state.surface_caps.minImageCount);
 }
 
+// Consumer of the morph readbacks, on the readback thread
+static void consume_readback(AppState& state, MorphReadbackResult& result) {
+  if (state.log_readbacks) {
+    printf("output nodes at iteration %d:\n", result.iter_num);
+    log_nodes(result.nodes);
+  }
+  if (state.morph_trajectory.open) {
+    morph_trajectory_append(state.morph_trajectory, result.iter_num,
+        std::move(result.nodes));
+  }
+}
+
 void init_vulkan(AppState& state) {
   VkResult res;
 
@@ -1411,17 +1563,51 @@ void init_vulkan(AppState& state) {
 		6, 7, 4
   };
   
+  auto start_time = chrono::steady_clock::now();
+
   setup_vertex_attr_desc(state);
   setup_instance(state);
   setup_debug_callback(state);
   setup_surface(state); 
   setup_physical_device(state);
   setup_logical_device(state);
+  state.pipeline_cache = load_pipeline_cache(state.phys_device,
+      state.device, PIPELINE_CACHE_PATH, state.pipeline_cache_warm);
+  init_mem_allocator(state.allocator, state.phys_device, state.device);
+  init_staging_ring(state.staging_ring, state.allocator, STAGING_RING_SIZE);
+  init_uploader(state.uploader, state.device, state.transfer_family_index,
+      state.transfer_queue, state.target_family_index, state.queue,
+      &state.staging_ring);
+  init_uploader(state.gfx_uploader, state.device, state.target_family_index,
+      state.queue, state.target_family_index, state.queue, nullptr);
+  init_morph_sim(state.morph_sim, state.allocator, state.target_family_index,
+      state.queue, state.pipeline_cache,
+      morph_shader_path(state.morph_format), MORPH_ZYGOTE_SHADER_PATH,
+      state.morph_format);
+  state.morph_sim.threads = &state.record_threads;
+  init_morph_timeline(state.morph_timeline, MORPH_CHECKPOINT_BUDGET,
+      MORPH_SPILL_PATH);
+  init_morph_readback(state.morph_readback, state.allocator,
+      state.target_family_index, state.queue, max_frames_in_flight,
+      [&state](MorphReadbackResult& result) {
+        consume_readback(state, result);
+      });
   setup_swapchain(state);
   setup_renderpass(state);
   setup_descriptor_set_layout(state);
+  auto pipeline_start_time = chrono::steady_clock::now();
   setup_graphics_pipeline(state);
-  setup_command_pool(state);
+  chrono::duration<double, milli> pipeline_time =
+    chrono::steady_clock::now() - pipeline_start_time;
+  for (uint32_t i = 0; i < max_frames_in_flight; ++i) {
+    init_frame_context(state.frames[i], state.device,
+        state.target_family_index, i);
+  }
+  init_cmd_cache(state.scene_cmds, state.device, state.target_family_index,
+      max_frames_in_flight);
+  init_thread_pool(state.record_threads, state.num_record_threads);
+  init_parallel_recorder(state.recorder, state.device,
+      state.target_family_index, max_frames_in_flight, state.record_threads);
   setup_texture_image(state);
   setup_texture_image_view(state);
   setup_texture_sampler(state);
@@ -1432,20 +1618,30 @@ void init_vulkan(AppState& state) {
   setup_uniform_buffers(state);
   setup_descriptor_pool(state);
   setup_descriptor_sets(state);
-  setup_command_buffers(state);
-  setup_sync_objects(state);
+
+  // all of the above uploads go out in a single submission per queue
+  upload_flush(state.uploader);
+  upload_flush(state.gfx_uploader);
+
+  chrono::duration<double, milli> init_time =
+    chrono::steady_clock::now() - start_time;
+  printf("%s start: init_vulkan %.2fms, graphics pipeline %.2fms\n\n",
+      state.pipeline_cache_warm ? "warm" : "cold", init_time.count(),
+      pipeline_time.count());
 }
 
 void render_frame(AppState& state) {
   size_t current_frame = state.current_frame;
+  FrameContext& frame = state.frames[current_frame];
 
-  vkWaitForFences(state.device, 1, &state.in_flight_fences[current_frame],
-        VK_TRUE, std::numeric_limits<uint64_t>::max());
+  // also recycles the command pool, upload semaphores and uniform data of
+  // the frame's last submission
+  begin_frame_context(frame, state.device, state.uploader);
   
   uint32_t img_index;
   VkResult res= vkAcquireNextImageKHR(state.device, state.swapchain,
       std::numeric_limits<uint64_t>::max(),
-      state.img_available_semas[current_frame],
+      frame.img_available_sema,
       VK_NULL_HANDLE, &img_index);
   if (res == VK_ERROR_OUT_OF_DATE_KHR || state.framebuffer_resized) {
     state.framebuffer_resized = false;
@@ -1466,38 +1662,55 @@ void render_frame(AppState& state) {
     .view = view_mat,
     .proj = proj_mat
   };
-  void* unif_data;
-  vkMapMemory(state.device, state.unif_buffers_mem[img_index], 0,
-      sizeof(ubo), 0, &unif_data);
-  memcpy(unif_data, &ubo, sizeof(ubo));
-  vkUnmapMemory(state.device, state.unif_buffers_mem[img_index]);
+  FrameRegion ubo_region = frame_alloc(frame.arena, sizeof(ubo));
+  memcpy(ubo_region.data, &ubo, sizeof(ubo));
 
-  record_render_pass(state, img_index, state.indices);
+  // uploads are submitted before the frame that uses them. Transfer queue
+  // batches signal a semaphore for this frame to wait on, and the frame
+  // acquires ownership of the resources they wrote.
+  upload_flush(state.uploader);
+  upload_flush(state.gfx_uploader);
+  UploadHandoff handoff;
+  upload_take_handoff(state.uploader, handoff);
+
+  record_render_pass(state, frame, img_index, state.indices, handoff,
+      ubo_region.offset);
+
+  upload_poll(state.uploader, upload_ticket(state.uploader));
+  upload_poll(state.gfx_uploader, upload_ticket(state.gfx_uploader));
 
   // submit cmd buffer to pipeline
+  vector<VkSemaphore> wait_semas = {frame.img_available_sema};
   vector<VkPipelineStageFlags> wait_stages = {
     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
   };
+  VkPipelineStageFlags upload_stages = handoff.dst_stages ?
+    handoff.dst_stages : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  for (VkSemaphore sema : handoff.wait_semas) {
+    wait_semas.push_back(sema);
+    wait_stages.push_back(upload_stages);
+  }
+  frame.upload_semas = handoff.wait_semas;
+
   VkSubmitInfo submit_info = {
     .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-    .waitSemaphoreCount = 1,
-    .pWaitSemaphores = &state.img_available_semas[current_frame],
+    .waitSemaphoreCount = (uint32_t) wait_semas.size(),
+    .pWaitSemaphores = wait_semas.data(),
     .pWaitDstStageMask = wait_stages.data(),
     .commandBufferCount = 1,
-    .pCommandBuffers = &state.cmd_buffers[img_index],
+    .pCommandBuffers = &frame.cmd_buffer,
     .signalSemaphoreCount = 1,
-    .pSignalSemaphores = &state.render_done_semas[current_frame]
+    .pSignalSemaphores = &frame.render_done_sema
   };
-  vkResetFences(state.device, 1, &state.in_flight_fences[current_frame]);
-  res = vkQueueSubmit(state.queue, 1, &submit_info,
-      state.in_flight_fences[current_frame]);
+  vkResetFences(state.device, 1, &frame.in_flight_fence);
+  res = vkQueueSubmit(state.queue, 1, &submit_info, frame.in_flight_fence);
   assert(res == VK_SUCCESS);
 
   // present result when done
   VkPresentInfoKHR present_info = {
     .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
     .waitSemaphoreCount = 1,
-    .pWaitSemaphores = &state.render_done_semas[current_frame],
+    .pWaitSemaphores = &frame.render_done_sema,
     .swapchainCount = 1,
     .pSwapchains = &state.swapchain,
     .pImageIndices = &img_index,
@@ -1533,12 +1746,143 @@ void init_glfw(AppState& state) {
 }
 
 void upload_imgui_fonts(AppState& state) {
-  VkCommandBuffer tmp_buffer = begin_single_time_commands(state);
-  ImGui_ImplVulkan_CreateFontsTexture(tmp_buffer);
-  end_single_time_commands(state, tmp_buffer);
+  // imgui records its own layout transitions, so this goes to the
+  // graphics queue
+  ImGui_ImplVulkan_CreateFontsTexture(upload_cmd_buffer(state.gfx_uploader));
+  // imgui's own staging buffer must outlive the copy
+  upload_wait(state.gfx_uploader, upload_flush(state.gfx_uploader));
   ImGui_ImplVulkan_DestroyFontUploadObjects();
 }
 
+void show_morph_console(AppState& state) {
+  MorphControls& controls = state.morph_controls;
+  ImGui::Begin("morph console");
+
+  ImGui::Text("init data:");
+  ImGui::InputInt("AxA samples", &controls.num_zygote_samples);
+  controls.num_zygote_samples = std::max(controls.num_zygote_samples, 0);
+  const char* shape_names[MORPH_SHAPE_COUNT];
+  for (int i = 0; i < MORPH_SHAPE_COUNT; ++i) {
+    shape_names[i] = morph_shape_name((MorphShape) i);
+  }
+  ImGui::Combo("zygote shape", &controls.zygote_shape, shape_names,
+      MORPH_SHAPE_COUNT);
+  ImGui::Checkbox("generate on gpu", &controls.gpu_zygote);
+
+  ImGui::Text("simulation:");
+  int max_iter_num = 1*1000*1000*1000;
+  ImGui::DragInt("iter num", &controls.num_iters, 0.2f, 0, max_iter_num);
+  ImGui::DragFloat4("growth/smooth/damp/dt",
+      &state.morph_sim.user_params[0][0], 0.001f);
+  if (ImGui::Button("run once")) {
+    run_morph_pipeline(state.morph_sim, controls);
+    // the sim no longer holds the timeline's state
+    state.morph_timeline.live = false;
+  }
+  ImGui::Text("animation:");
+  string anim_btn_text(controls.animating_sim ? "PAUSE" : "PLAY");
+  if (ImGui::Button(anim_btn_text.c_str())) {
+    controls.animating_sim = !controls.animating_sim;
+  }
+  ImGui::DragInt("start iter", &controls.start_iter_num, 10.0f, 0,
+      max_iter_num);
+  ImGui::DragInt("end iter", &controls.end_iter_num, 10.0f,
+      controls.start_iter_num, max_iter_num);
+  ImGui::DragInt("delta iters per frame", &controls.delta_iters, 0.2f, -10,
+      10);
+  ImGui::Checkbox("loop at end", &controls.loop_at_end);
+  ImGui::Checkbox("incremental", &controls.incremental);
+  const char* ordering_names[MORPH_ORDER_COUNT];
+  for (int o = 0; o < MORPH_ORDER_COUNT; ++o) {
+    ordering_names[o] = morph_ordering_name((MorphOrdering) o);
+  }
+  ImGui::Combo("node order", &controls.ordering, ordering_names,
+      MORPH_ORDER_COUNT);
+
+  // run the animation
+  if (controls.animating_sim) {
+    controls.num_iters += controls.delta_iters;
+    controls.num_iters = clamp(controls.num_iters,
+        controls.start_iter_num, controls.end_iter_num);
+    if (controls.loop_at_end && controls.num_iters == controls.end_iter_num) {
+      controls.num_iters = controls.start_iter_num;
+    }
+    if (controls.incremental) {
+      morph_timeline_seek(state.morph_timeline, state.morph_sim, controls,
+          controls.num_iters);
+    } else {
+      // output nodes are read back asynchronously below
+      MorphControls frame_controls = controls;
+      frame_controls.log_output_nodes = false;
+      run_morph_pipeline(state.morph_sim, frame_controls);
+      state.morph_timeline.live = false;
+    }
+    state.log_readbacks = controls.log_output_nodes;
+    if (controls.log_output_nodes || state.morph_trajectory.open) {
+      morph_readback_request(state.morph_readback, state.morph_sim,
+          MORPH_READBACK_ALL);
+    }
+  }
+  morph_readback_poll(state.morph_readback);
+
+  // frames come from the readbacks while animating
+  MorphTrajectoryWriter& trajectory = state.morph_trajectory;
+  bool recording = trajectory.open;
+  if (ImGui::Checkbox("record trajectory", &recording)) {
+    if (recording) {
+      uint32_t traj_flags = MORPH_TRAJ_DELTA |
+        (state.morph_traj_quantize ? MORPH_TRAJ_QUANTIZE : 0);
+      open_morph_trajectory(trajectory, MORPH_TRAJ_PATH, traj_flags,
+          MORPH_READBACK_ALL);
+    } else {
+      close_morph_trajectory(trajectory);
+    }
+  }
+  ImGui::SameLine();
+  ImGui::Checkbox("quantize", &state.morph_traj_quantize);
+  ImGui::Text("trajectory: %lu frames, %lu dropped, %.1f/%.1fMB",
+      (unsigned long) trajectory.num_written,
+      (unsigned long) trajectory.num_dropped,
+      trajectory.file_bytes / (1024.0 * 1024.0),
+      trajectory.raw_bytes / (1024.0 * 1024.0));
+  MorphTimeline& timeline = state.morph_timeline;
+  CheckpointStore& checkpoints = timeline.checkpoints;
+  ImGui::DragInt("checkpoint interval", &timeline.checkpoint_interval, 10.0f,
+      1, max_iter_num);
+  ImGui::Text("iters run: %d, restored from: %d",
+      timeline.last_iters_run, timeline.last_restored_iter);
+  ImGui::Text("checkpoints: %lu, in memory: %.1f/%.1fMB",
+      (unsigned long) checkpoint_store_size(checkpoints),
+      checkpoints.mem_used / (1024.0 * 1024.0),
+      checkpoints.mem_budget / (1024.0 * 1024.0));
+  ImGui::Text("spills: %lu (%.1fMB), reloads: %lu, drops: %lu",
+      (unsigned long) checkpoints.num_spills,
+      checkpoints.spilled_bytes / (1024.0 * 1024.0),
+      (unsigned long) checkpoints.num_reloads,
+      (unsigned long) checkpoints.num_drops);
+
+  ImGui::Separator();
+  ImGui::Text("debug");
+  ImGui::Text("While animating, only output nodes are logged");
+  ImGui::Checkbox("log input nodes", &controls.log_input_nodes);
+  ImGui::Checkbox("log output nodes", &controls.log_output_nodes);
+  ImGui::Checkbox("log render data", &controls.log_render_data);
+  ImGui::Checkbox("log durations", &controls.log_durations);
+  ImGui::Checkbox("log locality", &controls.log_locality);
+  if (controls.animating_sim) {
+    controls.log_input_nodes = false;
+    controls.log_render_data = false;
+    controls.log_durations = false;
+    controls.log_locality = false;
+  }
+  MorphReadback& readback = state.morph_readback;
+  ImGui::Text("readbacks: %lu delivered, %lu dropped",
+      (unsigned long) readback.num_delivered,
+      (unsigned long) readback.num_dropped);
+
+  ImGui::End();
+}
+
 void main_loop(AppState& state) {
   IMGUI_CHECKVERSION();
   ImGui::CreateContext();
@@ -1551,7 +1895,7 @@ void main_loop(AppState& state) {
     .Device = state.device,
     .QueueFamily = state.target_family_index,
     .Queue = state.queue,
-    .PipelineCache = VK_NULL_HANDLE,
+    .PipelineCache = state.pipeline_cache,
     .DescriptorPool = state.desc_pool,
     .Allocator = nullptr,
     .MinImageCount = state.surface_caps.minImageCount,
@@ -1573,6 +1917,7 @@ void main_loop(AppState& state) {
     if (show_demo_win) {
       ImGui::ShowDemoWindow(&show_demo_win);
     }
+    show_morph_console(state);
 
     ImGui::Render();
 
@@ -1585,6 +1930,497 @@ void main_loop(AppState& state) {
   ImGui::DestroyContext();
 }
 
+// Times recording the scene with 1, 2, 4, ... record threads. Nothing is
+// submitted, so this is the CPU cost of recording alone.
+void bench_record(AppState& state, uint32_t max_threads) {
+  const int num_warmup_frames = 10;
+  const int num_frames = 200;
+  printf("recording %d draws, %d frames per run\n", state.num_scene_draws,
+      num_frames);
+
+  double base_ms = 0.0;
+  for (uint32_t num_threads = 1; num_threads <= max_threads;
+      num_threads *= 2) {
+    ThreadPool threads;
+    init_thread_pool(threads, num_threads);
+    ParallelRecorder recorder;
+    init_parallel_recorder(recorder, state.device, state.target_family_index,
+        max_frames_in_flight, threads);
+
+    chrono::steady_clock::time_point start;
+    for (int i = 0; i < num_warmup_frames + num_frames; ++i) {
+      if (i == num_warmup_frames) {
+        start = chrono::steady_clock::now();
+      }
+      uint32_t frame_index = i % max_frames_in_flight;
+      record_scene_parallel(state, recorder, frame_index, state.indices,
+          0);
+    }
+    chrono::duration<double, milli> elapsed =
+      chrono::steady_clock::now() - start;
+    double frame_ms = elapsed.count() / num_frames;
+    if (num_threads == 1) {
+      base_ms = frame_ms;
+    }
+    printf("threads: %2d, record ms/frame: %7.3f, speedup: %.2fx\n",
+        num_threads, frame_ms, base_ms / frame_ms);
+
+    cleanup_parallel_recorder(recorder);
+    cleanup_thread_pool(threads);
+  }
+  printf("\n");
+}
+
+// Times building the mip chain of a size x size texture on the CPU, then
+// compares the modeled texture traffic of drawing it minified with and
+// without mips
+void bench_texture_mips(uint32_t size) {
+  const int num_runs = 10;
+  uint32_t num_levels = mip_level_count(size, size);
+  vector<MipLevel> levels;
+  VkDeviceSize chain_size = layout_mip_chain(size, size, num_levels, levels);
+  vector<uint8_t> pixels((size_t) size * size * 4);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = (uint8_t) (i * 2654435761u >> 24);
+  }
+  vector<uint8_t> chain((size_t) chain_size);
+  printf("%ux%u texture, %u levels\n", size, size, num_levels);
+
+  for (int simd = 0; simd < 2; ++simd) {
+    auto start = chrono::steady_clock::now();
+    for (int run = 0; run < num_runs; ++run) {
+      if (simd) {
+        gen_mip_chain(pixels.data(), levels, chain.data());
+        continue;
+      }
+      memcpy(chain.data(), pixels.data(), pixels.size());
+      for (size_t i = 1; i < levels.size(); ++i) {
+        downsample_rgba8_scalar(chain.data() + levels[i - 1].offset,
+            levels[i - 1].w, levels[i - 1].h, chain.data() + levels[i].offset);
+      }
+    }
+    chrono::duration<double, milli> elapsed =
+      chrono::steady_clock::now() - start;
+    printf("cpu chain (%s): %.2fms\n", simd ? "simd" : "scalar",
+        elapsed.count() / num_runs);
+  }
+
+  printf("\n%8s %6s %14s %14s %6s %14s %14s\n", "screen", "level",
+      "unique MB", "fetched MB", "level", "unique MB", "fetched MB");
+  for (uint32_t screen = size; screen >= 64 && screen >= size / 64;
+      screen /= 2) {
+    MipSampling base = model_mip_sampling(size, size, screen, false);
+    MipSampling mips = model_mip_sampling(size, size, screen, true);
+    printf("%8u %6u %14.2f %14.2f %6u %14.2f %14.2f\n", screen, base.level,
+        base.unique_bytes / (1024.0 * 1024.0),
+        base.fetched_bytes / (1024.0 * 1024.0), mips.level,
+        mips.unique_bytes / (1024.0 * 1024.0),
+        mips.fetched_bytes / (1024.0 * 1024.0));
+  }
+  printf("\n");
+}
+
+// Options of the windowless simulation modes
+struct SimOptions {
+  bool headless = false;
+  bool cpu = false;
+  bool verify = false;
+  bool bench = false;
+  bool bench_reorder = false;
+  uint32_t num_threads = 1;
+  // record a trajectory of the headless run, a frame every record_interval
+  // iterations
+  string record_path;
+  int record_interval = 1;
+  uint32_t record_flags = MORPH_TRAJ_DELTA;
+  MorphNodeFormat format = MORPH_FORMAT_FULL;
+};
+
+// Calls fn with the first device that has a compute queue. Software
+// devices such as lavapipe will do.
+static void with_headless_device(
+    const function<void(HeadlessVulkan&, MemAllocator&, VkPipelineCache)>& fn) {
+  HeadlessVulkan hv;
+  init_headless_vulkan(hv);
+  bool pipeline_cache_warm = false;
+  VkPipelineCache pipeline_cache = load_pipeline_cache(hv.phys_device,
+      hv.device, PIPELINE_CACHE_PATH, pipeline_cache_warm);
+  MemAllocator allocator;
+  init_mem_allocator(allocator, hv.phys_device, hv.device);
+
+  fn(hv, allocator, pipeline_cache);
+
+  save_pipeline_cache(hv.device, pipeline_cache, PIPELINE_CACHE_PATH);
+  cleanup_mem_allocator(allocator);
+  cleanup_headless_vulkan(hv);
+}
+
+// Runs the simulation in steps of opts.record_interval iterations and
+// records the state after each through the async readback path
+static void record_morph_trajectory(MorphSim& sim, HeadlessVulkan& hv,
+    MemAllocator& allocator, MorphControls& controls,
+    const SimOptions& opts) {
+  MorphTrajectoryWriter writer;
+  if (!open_morph_trajectory(writer, opts.record_path, opts.record_flags,
+        MORPH_READBACK_ALL)) {
+    return;
+  }
+  MorphReadback readback;
+  init_morph_readback(readback, allocator, hv.queue_family_index, hv.queue,
+      2, [&writer](MorphReadbackResult& result) {
+        // the export must hold every frame, so wait out a slow writer
+        morph_trajectory_append_wait(writer, result.iter_num,
+            std::move(result.nodes));
+      });
+
+  // the zygote is the first frame
+  MorphControls zygote_controls = controls;
+  zygote_controls.num_iters = 0;
+  zygote_controls.log_output_nodes = false;
+  run_morph_pipeline(sim, zygote_controls);
+  morph_readback_request(readback, sim, MORPH_READBACK_ALL);
+  int interval = std::max(opts.record_interval, 1);
+  while (sim.iter_num < controls.num_iters) {
+    morph_sim_run(sim, std::min(interval, controls.num_iters - sim.iter_num));
+    morph_readback_wait(readback);
+    morph_readback_request(readback, sim, MORPH_READBACK_ALL);
+  }
+  cleanup_morph_readback(readback);
+  close_morph_trajectory(writer);
+
+  printf("trajectory %s: %lu frames, %lu dropped, %.1fMB of %.1fMB\n",
+      opts.record_path.c_str(), (unsigned long) writer.num_written,
+      (unsigned long) (writer.num_dropped + readback.num_dropped),
+      writer.file_bytes / (1024.0 * 1024.0),
+      writer.raw_bytes / (1024.0 * 1024.0));
+}
+
+// Runs the simulation once without a window. With verify, the CPU
+// simulation runs alongside and the results are compared.
+void run_headless_sim(MorphControls& controls, const SimOptions& opts) {
+  with_headless_device([&](HeadlessVulkan& hv, MemAllocator& allocator,
+        VkPipelineCache pipeline_cache) {
+    ThreadPool threads;
+    init_thread_pool(threads, opts.num_threads);
+    MorphSim sim;
+    init_morph_sim(sim, allocator, hv.queue_family_index, hv.queue,
+        pipeline_cache, morph_shader_path(opts.format),
+        MORPH_ZYGOTE_SHADER_PATH, opts.format);
+    sim.threads = &threads;
+    if (opts.verify) {
+      MorphCpuSim cpu_sim;
+      init_morph_cpu_sim(cpu_sim, threads, opts.format);
+      verify_morph_sim(sim, cpu_sim, controls,
+          morph_tolerance_for(opts.format), MORPH_CHECKPOINT_INTERVAL);
+      cleanup_morph_cpu_sim(cpu_sim);
+    } else if (!opts.record_path.empty()) {
+      record_morph_trajectory(sim, hv, allocator, controls, opts);
+    } else {
+      run_morph_pipeline(sim, controls);
+    }
+    cleanup_morph_sim(sim);
+    cleanup_thread_pool(threads);
+  });
+}
+
+// Logs the frame of a trajectory file at or before iter_num
+void dump_morph_trajectory(const string& path, int iter_num) {
+  MorphTrajectoryReader reader;
+  if (!open_morph_trajectory_reader(reader, path)) {
+    return;
+  }
+  int frame = morph_trajectory_find(reader, iter_num);
+  MorphNodes nodes;
+  if (frame < 0) {
+    printf("no frame at or before iteration %d\n", iter_num);
+  } else if (!morph_trajectory_read(reader, frame, nodes)) {
+    printf("frame %d of %s is corrupt\n", frame, path.c_str());
+  } else {
+    printf("%lu frames, frame %d at iteration %d:\n",
+        (unsigned long) reader.frames.size(), frame,
+        reader.frames[frame].iter_num);
+    log_nodes(nodes);
+  }
+  close_morph_trajectory_reader(reader);
+}
+
+// Runs the simulation once on the CPU. Needs no Vulkan device at all.
+void run_cpu_sim(MorphControls& controls, const SimOptions& opts) {
+  ThreadPool threads;
+  init_thread_pool(threads, opts.num_threads);
+  MorphCpuSim cpu_sim;
+  init_morph_cpu_sim(cpu_sim, threads, opts.format);
+  run_morph_cpu_pipeline(cpu_sim, controls);
+  cleanup_morph_cpu_sim(cpu_sim);
+  cleanup_thread_pool(threads);
+}
+
+// Times decoding num_images copies of the sample texture into staging
+// memory, once with serial stbi_load calls as a baseline, then through the
+// decode service on 1, 2, 4, ... threads
+void bench_image_decode(uint32_t num_images, uint32_t max_threads) {
+  vector<string> paths(num_images, TEXTURE_PATH);
+  printf("decoding %u images\n", num_images);
+  with_headless_device([&](HeadlessVulkan& hv, MemAllocator& allocator,
+        VkPipelineCache) {
+    StagingRing staging_ring;
+    init_staging_ring(staging_ring, allocator, STAGING_RING_SIZE);
+    Uploader uploader;
+    init_uploader(uploader, hv.device, hv.queue_family_index, hv.queue,
+        hv.queue_family_index, hv.queue, &staging_ring);
+
+    auto start = chrono::steady_clock::now();
+    for (const string& path : paths) {
+      int w, h, channels;
+      stbi_uc* pixels = stbi_load(path.c_str(), &w, &h, &channels,
+          STBI_rgb_alpha);
+      assert(pixels);
+      StagingRegion staging = upload_stage(uploader,
+          (VkDeviceSize) w * h * 4, 16);
+      memcpy(staging.data, pixels, staging.size);
+      stbi_image_free(pixels);
+    }
+    upload_wait(uploader, upload_flush(uploader));
+    chrono::duration<double, milli> elapsed =
+      chrono::steady_clock::now() - start;
+    double base_ms = elapsed.count();
+    printf("serial stbi_load: %8.2fms\n", base_ms);
+
+    for (uint32_t num_threads = 1; num_threads <= max_threads;
+        num_threads *= 2) {
+      ThreadPool threads;
+      init_thread_pool(threads, num_threads);
+      start = chrono::steady_clock::now();
+      ImageDecodeStats stats = decode_images(uploader, threads, paths,
+          false, [](DecodedImage&) {});
+      upload_wait(uploader, upload_flush(uploader));
+      elapsed = chrono::steady_clock::now() - start;
+      printf("threads: %2d, %8.2fms, %u waves, %.1fMB, speedup: %.2fx\n",
+          num_threads, elapsed.count(), stats.num_waves,
+          stats.decoded_bytes / (1024.0 * 1024.0),
+          base_ms / elapsed.count());
+      cleanup_thread_pool(threads);
+    }
+
+    cleanup_uploader(uploader);
+    cleanup_staging_ring(staging_ring, allocator);
+  });
+  printf("\n");
+}
+
+// Times stb_image decoding each image to RGBA at every SIMD level up to
+// the best the CPU has, in megabytes of decoded pixels per second, then
+// over the whole corpus. Flags images whose pixels differ between levels.
+void bench_stb_decode(const vector<string>& paths) {
+  const int num_runs = 10;
+  const char* const level_names[] = {"scalar", "sse2/neon", "avx2"};
+  int num_levels = stbi_simd_level() + 1;
+  vector<double> total_ms(num_levels, 0.0);
+  double total_mb = 0.0;
+
+  printf("%-32s %10s", "image", "MB");
+  for (int level = 0; level < num_levels; ++level) {
+    printf(" %12s", level_names[level]);
+  }
+  printf("\n");
+  for (const string& path : paths) {
+    MappedFile file;
+    int w, h, channels;
+    if (!open_mapped_file(file, path, FILE_ACCESS_SEQUENTIAL)) {
+      printf("%-32s failed to open\n", path.c_str());
+      continue;
+    }
+    if (!stbi_info_from_memory(file.data, (int) file.size, &w, &h,
+          &channels)) {
+      printf("%-32s failed: %s\n", path.c_str(), stbi_failure_reason());
+      close_mapped_file(file);
+      continue;
+    }
+    size_t size = (size_t) w * h * 4;
+    double mb = size * num_runs / (1024.0 * 1024.0);
+    vector<stbi_uc> ref;
+    bool mismatch = false;
+    total_mb += mb;
+    printf("%-32s %10.2f", path.c_str(), size / (1024.0 * 1024.0));
+
+    for (int level = 0; level < num_levels; ++level) {
+      stbi_set_simd_limit(level);
+      auto start = chrono::steady_clock::now();
+      for (int run = 0; run < num_runs; ++run) {
+        stbi_uc* pixels = stbi_load_from_memory(file.data, (int) file.size,
+            &w, &h, &channels, STBI_rgb_alpha);
+        assert(pixels);
+        if (run == 0 && level == 0) {
+          ref.assign(pixels, pixels + size);
+        } else if (run == 0) {
+          mismatch |= memcmp(ref.data(), pixels, size) != 0;
+        }
+        stbi_image_free(pixels);
+      }
+      chrono::duration<double, milli> elapsed =
+        chrono::steady_clock::now() - start;
+      total_ms[level] += elapsed.count();
+      printf(" %7.1fMB/s", mb * 1000.0 / elapsed.count());
+    }
+    printf("%s\n", mismatch ? " (pixels differ)" : "");
+    close_mapped_file(file);
+  }
+
+  printf("%-32s %10.2f", "total", total_mb / num_runs);
+  for (int level = 0; level < num_levels; ++level) {
+    printf(" %7.1fMB/s", total_mb * 1000.0 / total_ms[level]);
+  }
+  printf("\n\n");
+  stbi_set_simd_limit(2);
+}
+
+// Times the simulation in every node format, on the CPU and, unless
+// opts.cpu is set, on a headless device. The bandwidth is the node
+// streams read and written per iteration. Neighbor gathers are left out.
+void bench_morph_formats(MorphControls& controls, const SimOptions& opts) {
+  const int num_warmup_iters = 5;
+  int num_iters = controls.num_iters > 0 ? controls.num_iters : 100;
+  MorphNodes node_vecs;
+  vector<uint32_t> indices;
+  gen_morph_zygote(ivec2(controls.num_zygote_samples),
+      morph_shape_fn((MorphShape) controls.zygote_shape), node_vecs, indices,
+      nullptr);
+  printf("%lu nodes, %d iters, %u cpu threads\n\n", node_vecs.size(),
+      num_iters, opts.num_threads);
+
+  array<double, MORPH_FORMAT_COUNT> cpu_ms;
+  array<double, MORPH_FORMAT_COUNT> gpu_ms;
+  gpu_ms.fill(0.0);
+
+  ThreadPool threads;
+  init_thread_pool(threads, opts.num_threads);
+  for (int f = 0; f < MORPH_FORMAT_COUNT; ++f) {
+    MorphCpuSim cpu_sim;
+    init_morph_cpu_sim(cpu_sim, threads, (MorphNodeFormat) f);
+    morph_cpu_sim_write_nodes(cpu_sim, node_vecs);
+    morph_cpu_sim_run(cpu_sim, num_warmup_iters);
+    auto start = chrono::steady_clock::now();
+    morph_cpu_sim_run(cpu_sim, num_iters);
+    chrono::duration<double, milli> elapsed =
+      chrono::steady_clock::now() - start;
+    cpu_ms[f] = elapsed.count() / num_iters;
+    cleanup_morph_cpu_sim(cpu_sim);
+  }
+  cleanup_thread_pool(threads);
+
+  if (!opts.cpu) {
+    with_headless_device([&](HeadlessVulkan& hv, MemAllocator& allocator,
+          VkPipelineCache pipeline_cache) {
+      for (int f = 0; f < MORPH_FORMAT_COUNT; ++f) {
+        MorphNodeFormat format = (MorphNodeFormat) f;
+        MorphSim sim;
+        init_morph_sim(sim, allocator, hv.queue_family_index, hv.queue,
+            pipeline_cache, morph_shader_path(format),
+            MORPH_ZYGOTE_SHADER_PATH, format);
+        morph_sim_write_nodes(sim, node_vecs);
+        morph_sim_run(sim, num_warmup_iters);
+        auto start = chrono::steady_clock::now();
+        morph_sim_run(sim, num_iters);
+        chrono::duration<double, milli> elapsed =
+          chrono::steady_clock::now() - start;
+        gpu_ms[f] = elapsed.count() / num_iters;
+        cleanup_morph_sim(sim);
+      }
+    });
+  }
+
+  printf("%-13s %10s %10s %12s %9s %12s %9s\n", "format", "bytes/node",
+      "max nodes", "cpu ms/iter", "cpu GB/s", "gpu ms/iter", "gpu GB/s");
+  for (int f = 0; f < MORPH_FORMAT_COUNT; ++f) {
+    MorphNodeFormat format = (MorphNodeFormat) f;
+    double iter_bytes =
+      2.0 * morph_bytes_per_node(format) * node_vecs.size();
+    double cpu_gbps = cpu_ms[f] > 0.0 ? iter_bytes / (cpu_ms[f] * 1e6) : 0.0;
+    double gpu_gbps = gpu_ms[f] > 0.0 ? iter_bytes / (gpu_ms[f] * 1e6) : 0.0;
+    printf("%-13s %10u %10lu %12.3f %9.2f %12.3f %9.2f\n",
+        morph_format_name(format), morph_bytes_per_node(format),
+        max_morph_nodes(format), cpu_ms[f], cpu_gbps, gpu_ms[f], gpu_gbps);
+  }
+  printf("\n");
+}
+
+// Times the simulation in opts.format with the zygote in every node order,
+// next to the locality proxies of each order
+void bench_morph_orderings(MorphControls& controls, const SimOptions& opts) {
+  const int num_warmup_iters = 5;
+  int num_iters = controls.num_iters > 0 ? controls.num_iters : 100;
+  MorphNodes zygote;
+  vector<uint32_t> indices;
+  gen_morph_zygote(ivec2(controls.num_zygote_samples),
+      morph_shape_fn((MorphShape) controls.zygote_shape), zygote, indices,
+      nullptr);
+  printf("%lu nodes, %d iters, %u cpu threads, %s format\n\n",
+      zygote.size(), num_iters, opts.num_threads,
+      morph_format_name(opts.format));
+
+  array<MorphNodes, MORPH_ORDER_COUNT> ordered;
+  array<MorphLocality, MORPH_ORDER_COUNT> locality;
+  for (int o = 0; o < MORPH_ORDER_COUNT; ++o) {
+    ordered[o] = zygote;
+    vector<uint32_t> ordered_indices = indices;
+    reorder_morph_nodes(ordered[o], ordered_indices, (MorphOrdering) o,
+        false);
+    locality[o] = measure_morph_locality(ordered[o]);
+  }
+
+  array<double, MORPH_ORDER_COUNT> cpu_ms;
+  array<double, MORPH_ORDER_COUNT> gpu_ms;
+  gpu_ms.fill(0.0);
+
+  ThreadPool threads;
+  init_thread_pool(threads, opts.num_threads);
+  for (int o = 0; o < MORPH_ORDER_COUNT; ++o) {
+    MorphCpuSim cpu_sim;
+    init_morph_cpu_sim(cpu_sim, threads, opts.format);
+    morph_cpu_sim_write_nodes(cpu_sim, ordered[o]);
+    morph_cpu_sim_run(cpu_sim, num_warmup_iters);
+    auto start = chrono::steady_clock::now();
+    morph_cpu_sim_run(cpu_sim, num_iters);
+    chrono::duration<double, milli> elapsed =
+      chrono::steady_clock::now() - start;
+    cpu_ms[o] = elapsed.count() / num_iters;
+    cleanup_morph_cpu_sim(cpu_sim);
+  }
+  cleanup_thread_pool(threads);
+
+  if (!opts.cpu) {
+    with_headless_device([&](HeadlessVulkan& hv, MemAllocator& allocator,
+          VkPipelineCache pipeline_cache) {
+      MorphSim sim;
+      init_morph_sim(sim, allocator, hv.queue_family_index, hv.queue,
+          pipeline_cache, morph_shader_path(opts.format),
+          MORPH_ZYGOTE_SHADER_PATH, opts.format);
+      for (int o = 0; o < MORPH_ORDER_COUNT; ++o) {
+        morph_sim_write_nodes(sim, ordered[o]);
+        morph_sim_run(sim, num_warmup_iters);
+        auto start = chrono::steady_clock::now();
+        morph_sim_run(sim, num_iters);
+        chrono::duration<double, milli> elapsed =
+          chrono::steady_clock::now() - start;
+        gpu_ms[o] = elapsed.count() / num_iters;
+      }
+      cleanup_morph_sim(sim);
+    });
+  }
+
+  printf("%-8s %10s %10s %10s %12s %12s %12s\n", "order", "mean dist",
+      "miss rate", "lines/wg", "cpu ms/iter", "gpu ms/iter", "gpu speedup");
+  for (int o = 0; o < MORPH_ORDER_COUNT; ++o) {
+    double speedup = gpu_ms[o] > 0.0 ? gpu_ms[0] / gpu_ms[o] : 0.0;
+    printf("%-8s %10.1f %9.2f%% %10.1f %12.3f %12.3f %11.2fx\n",
+        morph_ordering_name((MorphOrdering) o),
+        locality[o].mean_neighbor_distance,
+        100.0 * locality[o].cache_miss_rate, locality[o].lines_per_group,
+        cpu_ms[o], gpu_ms[o], speedup);
+  }
+  printf("\n");
+}
+
 void cleanup_state(AppState& state) {
   cleanup_vulkan(state);
 
@@ -1603,10 +2439,152 @@ void run_app(int argc, char** argv) {
 
   AppState state;
 
+  // read cmd-line args
+  bool bench = false;
+  uint32_t bench_mips_size = 0;
+  uint32_t bench_decode_images = 0;
+  vector<string> bench_stb_paths;
+  SimOptions sim_opts;
+  sim_opts.num_threads = std::max(1u, thread::hardware_concurrency());
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "--record-threads" && i + 1 < argc) {
+      state.num_record_threads = (uint32_t) std::max(1, atoi(argv[++i]));
+    } else if (arg == "--scene-draws" && i + 1 < argc) {
+      state.num_scene_draws = (uint32_t) std::max(1, atoi(argv[++i]));
+    } else if (arg == "--bench-record") {
+      bench = true;
+    } else if (arg == "--bench-mips" && i + 1 < argc) {
+      bench_mips_size = (uint32_t) std::max(1, atoi(argv[++i]));
+    } else if (arg == "--bench-decode" && i + 1 < argc) {
+      bench_decode_images = (uint32_t) std::max(1, atoi(argv[++i]));
+    } else if (arg == "--bench-stb" && i + 1 < argc) {
+      bench_stb_paths.push_back(argv[++i]);
+    } else if (arg == "--sim-headless") {
+      sim_opts.headless = true;
+    } else if (arg == "--sim-samples" && i + 1 < argc) {
+      state.morph_controls.num_zygote_samples = std::max(0, atoi(argv[++i]));
+    } else if (arg == "--sim-iters" && i + 1 < argc) {
+      state.morph_controls.num_iters = std::max(0, atoi(argv[++i]));
+    } else if (arg == "--sim-cpu") {
+      sim_opts.cpu = true;
+    } else if (arg == "--sim-verify") {
+      sim_opts.verify = true;
+    } else if (arg == "--sim-threads" && i + 1 < argc) {
+      sim_opts.num_threads = (uint32_t) std::max(1, atoi(argv[++i]));
+    } else if (arg == "--sim-format" && i + 1 < argc) {
+      string format(argv[++i]);
+      sim_opts.format = format == "compact" ? MORPH_FORMAT_COMPACT :
+        format == "half" ? MORPH_FORMAT_COMPACT_HALF : MORPH_FORMAT_FULL;
+    } else if (arg == "--bench-morph") {
+      sim_opts.bench = true;
+    } else if (arg == "--sim-shape" && i + 1 < argc) {
+      string shape(argv[++i]);
+      state.morph_controls.zygote_shape = shape == "square" ?
+        MORPH_SHAPE_SQUARE : shape == "sphere" ? MORPH_SHAPE_SPHERE :
+        MORPH_SHAPE_PLANE;
+    } else if (arg == "--sim-host-zygote") {
+      state.morph_controls.gpu_zygote = false;
+    } else if (arg == "--sim-reorder" && i + 1 < argc) {
+      string ordering(argv[++i]);
+      state.morph_controls.ordering = ordering == "morton" ?
+        MORPH_ORDER_MORTON : ordering == "rcm" ? MORPH_ORDER_RCM :
+        MORPH_ORDER_NONE;
+      state.morph_controls.log_locality = true;
+    } else if (arg == "--sim-reorder-every" && i + 1 < argc) {
+      state.morph_controls.reorder_interval = std::max(0, atoi(argv[++i]));
+    } else if (arg == "--bench-reorder") {
+      sim_opts.bench_reorder = true;
+    } else if (arg == "--sim-log") {
+      state.morph_controls.log_output_nodes = true;
+    } else if (arg == "--sim-record" && i + 1 < argc) {
+      sim_opts.headless = true;
+      sim_opts.record_path = argv[++i];
+    } else if (arg == "--sim-record-every" && i + 1 < argc) {
+      sim_opts.record_interval = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--sim-record-quantize") {
+      sim_opts.record_flags |= MORPH_TRAJ_QUANTIZE;
+    } else if (arg == "--traj-dump" && i + 2 < argc) {
+      string path(argv[++i]);
+      dump_morph_trajectory(path, atoi(argv[++i]));
+      return;
+    } else {
+      printf("Incorrect usage. Options:\n\n"
+          "--record-threads n: record the scene on n threads\n"
+          "--scene-draws n: draw the mesh n times\n"
+          "--bench-record: time recording with 1, 2, 4, ... threads\n"
+          "--bench-mips n: time mip generation of an n x n texture and\n"
+          "  model its sampling traffic with and without mips\n"
+          "--bench-decode n: time decoding n images with 1, 2, 4, ..."
+          " threads\n"
+          "--bench-stb path: time stb_image decoding at each SIMD level,\n"
+          "  repeat for a corpus of JPEG and PNG files\n"
+          "--sim-headless: run the simulation once without a window\n"
+          "--sim-samples n: zygote of n x n nodes\n"
+          "--sim-iters n: run n iterations\n"
+          "--sim-cpu: run the simulation once on the CPU\n"
+          "--sim-verify: compare the GPU simulation against the CPU one\n"
+          "--sim-threads n: CPU simulation threads\n"
+          "--sim-format full|compact|half: node buffer layout\n"
+          "--bench-morph: time the simulation in every node format\n"
+          "--sim-shape plane|square|sphere: zygote shape\n"
+          "--sim-host-zygote: generate the zygote on the CPU and upload it\n"
+          "--sim-reorder none|morton|rcm: node order of the zygote\n"
+          "--sim-reorder-every n: reorder again every n iterations\n"
+          "--bench-reorder: time the simulation in every node order\n"
+          "--sim-log: log the output nodes\n"
+          "--sim-record path: record a trajectory of a headless run\n"
+          "--sim-record-every n: record every n iterations\n"
+          "--sim-record-quantize: store 16-bit positions and data\n"
+          "--traj-dump path iter: log a recorded frame\n");
+      return;
+    }
+  }
+
+  if (bench_mips_size > 0) {
+    bench_texture_mips(bench_mips_size);
+    return;
+  }
+  if (bench_decode_images > 0) {
+    bench_image_decode(bench_decode_images,
+        std::max(1u, thread::hardware_concurrency()));
+    return;
+  }
+  if (!bench_stb_paths.empty()) {
+    bench_stb_decode(bench_stb_paths);
+    return;
+  }
+  if (sim_opts.bench) {
+    bench_morph_formats(state.morph_controls, sim_opts);
+    return;
+  }
+  if (sim_opts.bench_reorder) {
+    bench_morph_orderings(state.morph_controls, sim_opts);
+    return;
+  }
+  if (sim_opts.cpu) {
+    state.morph_controls.log_durations = true;
+    run_cpu_sim(state.morph_controls, sim_opts);
+    return;
+  }
+  if (sim_opts.headless || sim_opts.verify) {
+    state.morph_controls.log_durations = true;
+    run_headless_sim(state.morph_controls, sim_opts);
+    return;
+  }
+  state.morph_format = sim_opts.format;
+
   init_glfw(state);
   init_vulkan(state);
   
-  main_loop(state);
+  if (bench) {
+    uint32_t max_threads = std::max(state.num_record_threads,
+        (uint32_t) thread::hardware_concurrency());
+    bench_record(state, max_threads);
+    vkDeviceWaitIdle(state.device);
+  } else {
+    main_loop(state);
+  }
   cleanup_state(state);
 }
 
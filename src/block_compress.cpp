@@ -0,0 +1,466 @@
+#include "block_compress.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const uint32_t BLOCK_SIZE = 4;
+const uint32_t BLOCK_PIXELS = BLOCK_SIZE * BLOCK_SIZE;
+// interpolation weights of 4-bit BC7 indices, out of 64
+const int BC7_WEIGHTS4[16] = {
+  0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+typedef uint8_t BlockPixels[BLOCK_PIXELS][4];
+
+const char* tex_format_name(TexFormat format) {
+  switch (format) {
+    case TEX_FORMAT_RGBA8: return "rgba8";
+    case TEX_FORMAT_BC1: return "bc1";
+    case TEX_FORMAT_BC3: return "bc3";
+    case TEX_FORMAT_BC7: return "bc7";
+    default: return "unknown";
+  }
+}
+
+VkFormat tex_format_vk(TexFormat format) {
+  switch (format) {
+    case TEX_FORMAT_BC1: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    case TEX_FORMAT_BC3: return VK_FORMAT_BC3_UNORM_BLOCK;
+    case TEX_FORMAT_BC7: return VK_FORMAT_BC7_UNORM_BLOCK;
+    default: return VK_FORMAT_R8G8B8A8_UNORM;
+  }
+}
+
+bool tex_format_from_vk(VkFormat vk_format, TexFormat& out_format) {
+  for (int f = 0; f < TEX_FORMAT_COUNT; ++f) {
+    if (tex_format_vk((TexFormat) f) == vk_format) {
+      out_format = (TexFormat) f;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool tex_format_is_block(TexFormat format) {
+  return format != TEX_FORMAT_RGBA8;
+}
+
+static size_t block_bytes(TexFormat format) {
+  return format == TEX_FORMAT_BC1 ? 8 : 16;
+}
+
+size_t tex_image_size(TexFormat format, uint32_t w, uint32_t h) {
+  if (!tex_format_is_block(format)) {
+    return (size_t) w * h * 4;
+  }
+  size_t blocks_w = (w + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  size_t blocks_h = (h + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  return blocks_w * blocks_h * block_bytes(format);
+}
+
+// The principal axis of the first num_channels channels of the pixels,
+// by power iteration on their covariance. Writes the mean and the
+// projections of the pixels onto the axis at the ends of the range.
+static void fit_line(const BlockPixels& pixels, int num_channels,
+    float mean[4], float axis[4], float& t_min, float& t_max) {
+  for (int c = 0; c < 4; ++c) {
+    mean[c] = 0.0f;
+    for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+      mean[c] += pixels[i][c];
+    }
+    mean[c] /= BLOCK_PIXELS;
+  }
+  float cov[4][4] = {};
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    for (int a = 0; a < num_channels; ++a) {
+      for (int b = 0; b < num_channels; ++b) {
+        cov[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+      }
+    }
+  }
+  for (int c = 0; c < 4; ++c) {
+    axis[c] = c < num_channels ? 1.0f : 0.0f;
+  }
+  for (int iter = 0; iter < 8; ++iter) {
+    float next[4] = {};
+    float len = 0.0f;
+    for (int a = 0; a < num_channels; ++a) {
+      for (int b = 0; b < num_channels; ++b) {
+        next[a] += cov[a][b] * axis[b];
+      }
+      len += next[a] * next[a];
+    }
+    // a flat block keeps the gray axis
+    if (len < 1e-8f) {
+      break;
+    }
+    len = std::sqrt(len);
+    for (int a = 0; a < num_channels; ++a) {
+      axis[a] = next[a] / len;
+    }
+  }
+  t_min = 0.0f;
+  t_max = 0.0f;
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    float t = 0.0f;
+    for (int c = 0; c < num_channels; ++c) {
+      t += (pixels[i][c] - mean[c]) * axis[c];
+    }
+    t_min = std::min(t_min, t);
+    t_max = std::max(t_max, t);
+  }
+}
+
+static float endpoint(const float mean[4], const float axis[4], float t,
+    int c) {
+  return clamp(mean[c] + axis[c] * t, 0.0f, 255.0f);
+}
+
+static int color_dist(const uint8_t* a, const int* b, int num_channels) {
+  int dist = 0;
+  for (int c = 0; c < num_channels; ++c) {
+    int d = a[c] - b[c];
+    dist += d * d;
+  }
+  return dist;
+}
+
+static uint16_t pack_565(float r, float g, float b) {
+  int r5 = (int) std::lround(r * 31.0f / 255.0f);
+  int g6 = (int) std::lround(g * 63.0f / 255.0f);
+  int b5 = (int) std::lround(b * 31.0f / 255.0f);
+  return (uint16_t) (r5 << 11 | g6 << 5 | b5);
+}
+
+static void unpack_565(uint16_t v, int out[3]) {
+  int r = (v >> 11) & 31;
+  int g = (v >> 5) & 63;
+  int b = v & 31;
+  out[0] = r << 3 | r >> 2;
+  out[1] = g << 2 | g >> 4;
+  out[2] = b << 3 | b >> 2;
+}
+
+// Always in four color mode, as BC3 requires
+static void encode_bc1_block(const BlockPixels& pixels, uint8_t* out) {
+  float mean[4], axis[4], t_min, t_max;
+  fit_line(pixels, 3, mean, axis, t_min, t_max);
+  uint16_t c0 = pack_565(endpoint(mean, axis, t_max, 0),
+      endpoint(mean, axis, t_max, 1), endpoint(mean, axis, t_max, 2));
+  uint16_t c1 = pack_565(endpoint(mean, axis, t_min, 0),
+      endpoint(mean, axis, t_min, 1), endpoint(mean, axis, t_min, 2));
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+  uint32_t indices = 0;
+  if (c0 != c1) {
+    int palette[4][3];
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+      uint32_t best = 0;
+      int best_dist = color_dist(pixels[i], palette[0], 3);
+      for (uint32_t p = 1; p < 4; ++p) {
+        int dist = color_dist(pixels[i], palette[p], 3);
+        if (dist < best_dist) {
+          best = p;
+          best_dist = dist;
+        }
+      }
+      indices |= best << (2 * i);
+    }
+  }
+  memcpy(out, &c0, 2);
+  memcpy(out + 2, &c1, 2);
+  memcpy(out + 4, &indices, 4);
+}
+
+static void decode_bc1_block(const uint8_t* in, bool four_color,
+    BlockPixels& pixels) {
+  uint16_t c0, c1;
+  uint32_t indices;
+  memcpy(&c0, in, 2);
+  memcpy(&c1, in + 2, 2);
+  memcpy(&indices, in + 4, 4);
+  int palette[4][4];
+  unpack_565(c0, palette[0]);
+  unpack_565(c1, palette[1]);
+  palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+  for (int c = 0; c < 3; ++c) {
+    if (four_color || c0 > c1) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  if (!four_color && c0 <= c1) {
+    palette[3][3] = 0;
+  }
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    const int* color = palette[(indices >> (2 * i)) & 3];
+    for (int c = 0; c < 4; ++c) {
+      pixels[i][c] = (uint8_t) color[c];
+    }
+  }
+}
+
+static void alpha_palette(int a0, int a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1) {
+    for (int i = 2; i < 8; ++i) {
+      palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+    }
+  } else {
+    for (int i = 2; i < 6; ++i) {
+      palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+static void encode_bc3_block(const BlockPixels& pixels, uint8_t* out) {
+  int a0 = 0;
+  int a1 = 255;
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    a0 = std::max(a0, (int) pixels[i][3]);
+    a1 = std::min(a1, (int) pixels[i][3]);
+  }
+  uint64_t indices = 0;
+  if (a0 != a1) {
+    int palette[8];
+    alpha_palette(a0, a1, palette);
+    for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+      uint64_t best = 0;
+      int best_dist = abs(pixels[i][3] - palette[0]);
+      for (uint64_t p = 1; p < 8; ++p) {
+        int dist = abs(pixels[i][3] - palette[p]);
+        if (dist < best_dist) {
+          best = p;
+          best_dist = dist;
+        }
+      }
+      indices |= best << (3 * i);
+    }
+  }
+  out[0] = (uint8_t) a0;
+  out[1] = (uint8_t) a1;
+  memcpy(out + 2, &indices, 6);
+  encode_bc1_block(pixels, out + 8);
+}
+
+static void decode_bc3_block(const uint8_t* in, BlockPixels& pixels) {
+  decode_bc1_block(in + 8, true, pixels);
+  int palette[8];
+  alpha_palette(in[0], in[1], palette);
+  uint64_t indices = 0;
+  memcpy(&indices, in + 2, 6);
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    pixels[i][3] = (uint8_t) palette[(indices >> (3 * i)) & 7];
+  }
+}
+
+// Little-endian bit stream of one 128-bit block
+struct BlockBits {
+  uint8_t* bytes;
+  uint32_t pos;
+};
+
+static void write_bits(BlockBits& bits, uint32_t value, uint32_t num_bits) {
+  for (uint32_t i = 0; i < num_bits; ++i, ++bits.pos) {
+    if ((value >> i) & 1) {
+      bits.bytes[bits.pos / 8] |= (uint8_t) (1 << (bits.pos % 8));
+    }
+  }
+}
+
+static uint32_t read_bits(const uint8_t* bytes, uint32_t& pos,
+    uint32_t num_bits) {
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < num_bits; ++i, ++pos) {
+    value |= (uint32_t) ((bytes[pos / 8] >> (pos % 8)) & 1) << i;
+  }
+  return value;
+}
+
+// Quantizes a BC7 mode 6 endpoint to 7 bits per channel and the shared
+// p-bit that fits it best
+static void quantize_bc7_endpoint(const float value[4], int out_q[4],
+    int& out_pbit) {
+  float best_err = -1.0f;
+  for (int pbit = 0; pbit < 2; ++pbit) {
+    int q[4];
+    float err = 0.0f;
+    for (int c = 0; c < 4; ++c) {
+      q[c] = clamp((int) std::lround((value[c] - pbit) / 2.0f), 0, 127);
+      float d = value[c] - (q[c] * 2 + pbit);
+      err += d * d;
+    }
+    if (best_err < 0.0f || err < best_err) {
+      best_err = err;
+      out_pbit = pbit;
+      memcpy(out_q, q, sizeof(q));
+    }
+  }
+}
+
+// Mode 6: one subset, RGBA endpoints with 7 bits and a p-bit each, and
+// 4-bit indices
+static void encode_bc7_block(const BlockPixels& pixels, uint8_t* out) {
+  float mean[4], axis[4], t_min, t_max;
+  fit_line(pixels, 4, mean, axis, t_min, t_max);
+  int q[2][4];
+  int pbits[2];
+  for (int e = 0; e < 2; ++e) {
+    float value[4];
+    for (int c = 0; c < 4; ++c) {
+      value[c] = endpoint(mean, axis, e == 0 ? t_min : t_max, c);
+    }
+    quantize_bc7_endpoint(value, q[e], pbits[e]);
+  }
+
+  int palette[16][4];
+  for (int w = 0; w < 16; ++w) {
+    for (int c = 0; c < 4; ++c) {
+      int v0 = q[0][c] * 2 + pbits[0];
+      int v1 = q[1][c] * 2 + pbits[1];
+      palette[w][c] = ((64 - BC7_WEIGHTS4[w]) * v0 + BC7_WEIGHTS4[w] * v1 +
+          32) >> 6;
+    }
+  }
+  uint32_t indices[BLOCK_PIXELS];
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    uint32_t best = 0;
+    int best_dist = color_dist(pixels[i], palette[0], 4);
+    for (uint32_t p = 1; p < 16; ++p) {
+      int dist = color_dist(pixels[i], palette[p], 4);
+      if (dist < best_dist) {
+        best = p;
+        best_dist = dist;
+      }
+    }
+    indices[i] = best;
+  }
+  // the first index is stored without its top bit, which must be 0
+  if (indices[0] >= 8) {
+    std::swap(q[0], q[1]);
+    std::swap(pbits[0], pbits[1]);
+    for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+      indices[i] = 15 - indices[i];
+    }
+  }
+
+  memset(out, 0, 16);
+  BlockBits bits = {out, 0};
+  write_bits(bits, 1 << 6, 7);
+  for (int c = 0; c < 4; ++c) {
+    write_bits(bits, q[0][c], 7);
+    write_bits(bits, q[1][c], 7);
+  }
+  write_bits(bits, pbits[0], 1);
+  write_bits(bits, pbits[1], 1);
+  write_bits(bits, indices[0], 3);
+  for (uint32_t i = 1; i < BLOCK_PIXELS; ++i) {
+    write_bits(bits, indices[i], 4);
+  }
+}
+
+static bool decode_bc7_block(const uint8_t* in, BlockPixels& pixels) {
+  uint32_t pos = 0;
+  if (read_bits(in, pos, 7) != 1 << 6) {
+    return false;
+  }
+  int q[2][4];
+  for (int c = 0; c < 4; ++c) {
+    q[0][c] = (int) read_bits(in, pos, 7);
+    q[1][c] = (int) read_bits(in, pos, 7);
+  }
+  int pbit0 = (int) read_bits(in, pos, 1);
+  int pbit1 = (int) read_bits(in, pos, 1);
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    int w = BC7_WEIGHTS4[read_bits(in, pos, i == 0 ? 3 : 4)];
+    for (int c = 0; c < 4; ++c) {
+      int v0 = q[0][c] * 2 + pbit0;
+      int v1 = q[1][c] * 2 + pbit1;
+      pixels[i][c] = (uint8_t) (((64 - w) * v0 + w * v1 + 32) >> 6);
+    }
+  }
+  return true;
+}
+
+void encode_tex_blocks(const uint8_t* rgba, uint32_t w, uint32_t h,
+    TexFormat format, uint8_t* dst, ThreadPool* threads) {
+  if (!tex_format_is_block(format)) {
+    memcpy(dst, rgba, tex_image_size(format, w, h));
+    return;
+  }
+  uint32_t blocks_w = (w + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint32_t blocks_h = (h + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  size_t num_block_bytes = block_bytes(format);
+  auto encode_row = [&](uint32_t by, uint32_t) {
+    for (uint32_t bx = 0; bx < blocks_w; ++bx) {
+      BlockPixels pixels;
+      for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+        uint32_t x = std::min(bx * BLOCK_SIZE + i % BLOCK_SIZE, w - 1);
+        uint32_t y = std::min(by * BLOCK_SIZE + i / BLOCK_SIZE, h - 1);
+        memcpy(pixels[i], rgba + ((size_t) y * w + x) * 4, 4);
+      }
+      uint8_t* out = dst + ((size_t) by * blocks_w + bx) * num_block_bytes;
+      if (format == TEX_FORMAT_BC1) {
+        encode_bc1_block(pixels, out);
+      } else if (format == TEX_FORMAT_BC3) {
+        encode_bc3_block(pixels, out);
+      } else {
+        encode_bc7_block(pixels, out);
+      }
+    }
+  };
+  if (threads != nullptr) {
+    thread_pool_run(*threads, blocks_h, encode_row);
+  } else {
+    for (uint32_t by = 0; by < blocks_h; ++by) {
+      encode_row(by, 0);
+    }
+  }
+}
+
+bool decode_tex_blocks(const uint8_t* blocks, uint32_t w, uint32_t h,
+    TexFormat format, uint8_t* rgba) {
+  if (!tex_format_is_block(format)) {
+    memcpy(rgba, blocks, tex_image_size(format, w, h));
+    return true;
+  }
+  uint32_t blocks_w = (w + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint32_t blocks_h = (h + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  size_t num_block_bytes = block_bytes(format);
+  for (uint32_t by = 0; by < blocks_h; ++by) {
+    for (uint32_t bx = 0; bx < blocks_w; ++bx) {
+      const uint8_t* in = blocks +
+        ((size_t) by * blocks_w + bx) * num_block_bytes;
+      BlockPixels pixels;
+      if (format == TEX_FORMAT_BC1) {
+        decode_bc1_block(in, false, pixels);
+      } else if (format == TEX_FORMAT_BC3) {
+        decode_bc3_block(in, pixels);
+      } else if (!decode_bc7_block(in, pixels)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+        uint32_t x = bx * BLOCK_SIZE + i % BLOCK_SIZE;
+        uint32_t y = by * BLOCK_SIZE + i / BLOCK_SIZE;
+        if (x < w && y < h) {
+          memcpy(rgba + ((size_t) y * w + x) * 4, pixels[i], 4);
+        }
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+#include "byte_planes.h"
+
+#include <cstring>
+
+static void put_varint(vector<uint8_t>& bytes, uint64_t value) {
+  while (value >= 0x80) {
+    bytes.push_back((uint8_t) (value | 0x80));
+    value >>= 7;
+  }
+  bytes.push_back((uint8_t) value);
+}
+
+static bool get_varint(const uint8_t* bytes, size_t num_bytes, size_t& pos,
+    uint64_t& value) {
+  value = 0;
+  for (int shift = 0; pos < num_bytes && shift < 64; shift += 7) {
+    uint8_t byte = bytes[pos++];
+    value |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void encode_byte_planes(const void* words, size_t num_words,
+    size_t word_size, vector<uint8_t>& out_bytes) {
+  const uint8_t* word_bytes = static_cast<const uint8_t*>(words);
+  vector<uint8_t> planes(word_size * num_words);
+  for (size_t i = 0; i < num_words; ++i) {
+    for (size_t p = 0; p < word_size; ++p) {
+      planes[p * num_words + i] = word_bytes[i * word_size + p];
+    }
+  }
+
+  // (zero run, literal run, literals) until the planes are consumed
+  size_t i = 0;
+  while (i < planes.size()) {
+    size_t zero_start = i;
+    while (i < planes.size() && planes[i] == 0) {
+      ++i;
+    }
+    size_t lit_start = i;
+    // a lone zero between literals is cheaper kept as a literal
+    while (i < planes.size() && (planes[i] != 0 ||
+          (i + 1 < planes.size() && planes[i + 1] != 0))) {
+      ++i;
+    }
+    put_varint(out_bytes, lit_start - zero_start);
+    put_varint(out_bytes, i - lit_start);
+    out_bytes.insert(out_bytes.end(), planes.begin() + lit_start,
+        planes.begin() + i);
+  }
+}
+
+size_t decode_byte_planes(const uint8_t* bytes, size_t num_bytes,
+    size_t num_words, size_t word_size, void* out_words) {
+  vector<uint8_t> planes(word_size * num_words);
+  size_t pos = 0;
+  size_t i = 0;
+  while (i < planes.size()) {
+    uint64_t num_zeros;
+    uint64_t num_lits;
+    if (!get_varint(bytes, num_bytes, pos, num_zeros) ||
+        !get_varint(bytes, num_bytes, pos, num_lits) ||
+        num_zeros > planes.size() - i ||
+        num_lits > planes.size() - i - num_zeros ||
+        num_lits > num_bytes - pos) {
+      return 0;
+    }
+    memset(planes.data() + i, 0, num_zeros);
+    i += num_zeros;
+    memcpy(planes.data() + i, bytes + pos, num_lits);
+    i += num_lits;
+    pos += num_lits;
+  }
+
+  uint8_t* word_bytes = static_cast<uint8_t*>(out_words);
+  for (size_t i = 0; i < num_words; ++i) {
+    for (size_t p = 0; p < word_size; ++p) {
+      word_bytes[i * word_size + p] = planes[p * num_words + i];
+    }
+  }
+  return pos;
+}
@@ -0,0 +1,85 @@
+#include "cmd_cache.h"
+
+#include <cassert>
+
+void init_cmd_cache(CmdCache& cache, VkDevice device,
+    uint32_t queue_family_index, uint32_t num_entries) {
+  cache.device = device;
+
+  VkCommandPoolCreateInfo cmd_pool_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .pNext = nullptr,
+    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = queue_family_index
+  };
+  VkResult res = vkCreateCommandPool(device, &cmd_pool_info, nullptr,
+      &cache.cmd_pool);
+  assert(res == VK_SUCCESS);
+
+  vector<VkCommandBuffer> cmd_buffers(num_entries);
+  VkCommandBufferAllocateInfo cmd_buffer_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = cache.cmd_pool,
+    .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+    .commandBufferCount = num_entries
+  };
+  res = vkAllocateCommandBuffers(device, &cmd_buffer_info,
+      cmd_buffers.data());
+  assert(res == VK_SUCCESS);
+
+  cache.entries.resize(num_entries);
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    cache.entries[i].cmd_buffer = cmd_buffers[i];
+  }
+}
+
+void cleanup_cmd_cache(CmdCache& cache) {
+  // destroying the pool frees its command buffers
+  vkDestroyCommandPool(cache.device, cache.cmd_pool, nullptr);
+  cache = CmdCache();
+}
+
+void invalidate_cmd_cache(CmdCache& cache) {
+  cache.generation += 1;
+}
+
+bool cmd_cache_begin(CmdCache& cache, uint32_t index, uint64_t key,
+    VkRenderPass render_pass, uint32_t subpass,
+    VkCommandBuffer& out_cmd_buffer) {
+  CmdCacheEntry& entry = cache.entries[index];
+  out_cmd_buffer = entry.cmd_buffer;
+  if (entry.generation == cache.generation && entry.key == key) {
+    cache.num_hits += 1;
+    return false;
+  }
+
+  // keep the memory, it is about to be used again
+  VkResult res = vkResetCommandBuffer(entry.cmd_buffer, 0);
+  assert(res == VK_SUCCESS);
+
+  // leaving the framebuffer unspecified lets the entry run in any
+  // framebuffer compatible with render_pass
+  VkCommandBufferInheritanceInfo inheritance_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+    .renderPass = render_pass,
+    .subpass = subpass,
+    .framebuffer = VK_NULL_HANDLE
+  };
+  VkCommandBufferBeginInfo begin_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+    .pInheritanceInfo = &inheritance_info
+  };
+  res = vkBeginCommandBuffer(entry.cmd_buffer, &begin_info);
+  assert(res == VK_SUCCESS);
+
+  entry.key = key;
+  entry.generation = cache.generation;
+  cache.num_records += 1;
+  return true;
+}
+
+void cmd_cache_end(CmdCache& cache, uint32_t index) {
+  VkResult res = vkEndCommandBuffer(cache.entries[index].cmd_buffer);
+  assert(res == VK_SUCCESS);
+}
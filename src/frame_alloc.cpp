@@ -0,0 +1,81 @@
+#include "frame_alloc.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+void init_frame_allocator(FrameAllocator& frame_allocator,
+    MemAllocator& allocator, uint32_t num_frames, VkDeviceSize frame_size,
+    VkBufferUsageFlags usage) {
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(allocator.phys_device, &props);
+  VkDeviceSize alignment = std::max((VkDeviceSize) 16,
+      props.limits.minUniformBufferOffsetAlignment);
+
+  // every slice starts on an aligned offset
+  frame_size = (frame_size + alignment - 1) / alignment * alignment;
+
+  VkBufferCreateInfo buffer_info = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = frame_size * num_frames,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  VkResult res = vkCreateBuffer(allocator.device, &buffer_info, nullptr,
+      &frame_allocator.buffer);
+  assert(res == VK_SUCCESS);
+
+  VkMemoryRequirements mem_reqs;
+  vkGetBufferMemoryRequirements(allocator.device, frame_allocator.buffer,
+      &mem_reqs);
+  frame_allocator.buffer_mem = alloc_mem(allocator, mem_reqs,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MEM_TILING_LINEAR);
+  vkBindBufferMemory(allocator.device, frame_allocator.buffer,
+      frame_allocator.buffer_mem.mem, frame_allocator.buffer_mem.offset);
+
+  frame_allocator.data =
+    static_cast<char*>(frame_allocator.buffer_mem.mapped);
+  assert(frame_allocator.data);
+  frame_allocator.num_frames = num_frames;
+  frame_allocator.frame_size = frame_size;
+  frame_allocator.alignment = alignment;
+}
+
+void cleanup_frame_allocator(FrameAllocator& frame_allocator,
+    MemAllocator& allocator) {
+  vkDestroyBuffer(allocator.device, frame_allocator.buffer, nullptr);
+  free_mem(allocator, frame_allocator.buffer_mem);
+  frame_allocator = FrameAllocator();
+}
+
+FrameArena frame_allocator_slice(const FrameAllocator& frame_allocator,
+    uint32_t frame_index) {
+  assert(frame_index < frame_allocator.num_frames);
+  FrameArena arena;
+  arena.base = frame_index * frame_allocator.frame_size;
+  arena.data = frame_allocator.data + arena.base;
+  arena.size = frame_allocator.frame_size;
+  arena.alignment = frame_allocator.alignment;
+  return arena;
+}
+
+void frame_arena_reset(FrameArena& arena) {
+  arena.head = 0;
+}
+
+FrameRegion frame_alloc(FrameArena& arena, VkDeviceSize size) {
+  VkDeviceSize alignment = arena.alignment;
+  VkDeviceSize offset = arena.head;
+  if (offset + size > arena.size) {
+    throw std::runtime_error("frame allocator out of space");
+  }
+  arena.head = (offset + size + alignment - 1) / alignment * alignment;
+  arena.peak_used = std::max(arena.peak_used, arena.head);
+
+  FrameRegion region;
+  region.offset = (uint32_t) (arena.base + offset);
+  region.data = arena.data + offset;
+  return region;
+}
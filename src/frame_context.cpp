@@ -0,0 +1,75 @@
+#include "frame_context.h"
+
+#include <cassert>
+#include <limits>
+
+void init_frame_context(FrameContext& frame, VkDevice device,
+    uint32_t queue_family_index, uint32_t index) {
+  frame.index = index;
+
+  // no RESET_COMMAND_BUFFER_BIT, the pool is only ever reset as a whole
+  VkCommandPoolCreateInfo cmd_pool_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .pNext = nullptr,
+    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+    .queueFamilyIndex = queue_family_index
+  };
+  VkResult res = vkCreateCommandPool(device, &cmd_pool_info, nullptr,
+      &frame.cmd_pool);
+  assert(res == VK_SUCCESS);
+
+  VkCommandBufferAllocateInfo cmd_buffer_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = frame.cmd_pool,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1
+  };
+  res = vkAllocateCommandBuffers(device, &cmd_buffer_info,
+      &frame.cmd_buffer);
+  assert(res == VK_SUCCESS);
+  cmd_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+  res = vkAllocateCommandBuffers(device, &cmd_buffer_info,
+      &frame.overlay_cmd_buffer);
+  assert(res == VK_SUCCESS);
+
+  VkSemaphoreCreateInfo sema_info = {
+    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+  };
+  // created signalled so the first begin_frame_context does not block
+  VkFenceCreateInfo fence_info = {
+    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    .flags = VK_FENCE_CREATE_SIGNALED_BIT
+  };
+  res = vkCreateSemaphore(device, &sema_info, nullptr,
+      &frame.img_available_sema);
+  assert(res == VK_SUCCESS);
+  res = vkCreateSemaphore(device, &sema_info, nullptr,
+      &frame.render_done_sema);
+  assert(res == VK_SUCCESS);
+  res = vkCreateFence(device, &fence_info, nullptr, &frame.in_flight_fence);
+  assert(res == VK_SUCCESS);
+}
+
+void cleanup_frame_context(FrameContext& frame, VkDevice device,
+    Uploader& uploader) {
+  upload_recycle_semaphores(uploader, frame.upload_semas);
+  vkDestroySemaphore(device, frame.render_done_sema, nullptr);
+  vkDestroySemaphore(device, frame.img_available_sema, nullptr);
+  vkDestroyFence(device, frame.in_flight_fence, nullptr);
+  // destroying the pool frees its command buffers
+  vkDestroyCommandPool(device, frame.cmd_pool, nullptr);
+  frame = FrameContext();
+}
+
+void begin_frame_context(FrameContext& frame, VkDevice device,
+    Uploader& uploader) {
+  vkWaitForFences(device, 1, &frame.in_flight_fence, VK_TRUE,
+      std::numeric_limits<uint64_t>::max());
+
+  // one reset for every command buffer of the frame. The pool keeps its
+  // memory for the next recording.
+  VkResult res = vkResetCommandPool(device, frame.cmd_pool, 0);
+  assert(res == VK_SUCCESS);
+  upload_recycle_semaphores(uploader, frame.upload_semas);
+  frame_arena_reset(frame.arena);
+}
@@ -0,0 +1,95 @@
+#include "headless.h"
+
+#include <cassert>
+
+void init_headless_vulkan(HeadlessVulkan& hv) {
+  VkApplicationInfo app_info = {
+    .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+    .pNext = nullptr,
+    .pApplicationName = "my_vulkan_app",
+    .applicationVersion = 1,
+    .pEngineName = "my_vulkan_app",
+    .engineVersion = 1,
+    .apiVersion = VK_API_VERSION_1_0
+  };
+  VkInstanceCreateInfo inst_info = {
+    .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+    .pNext = nullptr,
+    .flags = 0,
+    .pApplicationInfo = &app_info,
+    .enabledLayerCount = 0,
+    .ppEnabledLayerNames = nullptr,
+    .enabledExtensionCount = 0,
+    .ppEnabledExtensionNames = nullptr
+  };
+  VkResult res = vkCreateInstance(&inst_info, nullptr, &hv.inst);
+  if (res == VK_ERROR_INCOMPATIBLE_DRIVER) {
+    printf("cant find a compatible vulkan ICD\n");
+    exit(1);
+  } else if (res) {
+    printf("Error occurred on create instance\n");
+    exit(1);
+  }
+
+  // take the first device with a compute queue
+  uint32_t device_count = 0;
+  vkEnumeratePhysicalDevices(hv.inst, &device_count, nullptr);
+  vector<VkPhysicalDevice> phys_devices(device_count);
+  vkEnumeratePhysicalDevices(hv.inst, &device_count, phys_devices.data());
+  bool found_index = false;
+  for (VkPhysicalDevice phys_device : phys_devices) {
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(phys_device,
+        &queue_family_count, nullptr);
+    vector<VkQueueFamilyProperties> queue_fam_props(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(phys_device,
+        &queue_family_count, queue_fam_props.data());
+    for (uint32_t i = 0; i < queue_family_count; ++i) {
+      if (queue_fam_props[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+        hv.phys_device = phys_device;
+        hv.queue_family_index = i;
+        found_index = true;
+        break;
+      }
+    }
+    if (found_index) {
+      break;
+    }
+  }
+  if (!found_index) {
+    printf("no device with a compute queue\n");
+    exit(1);
+  }
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(hv.phys_device, &props);
+  printf("running headless on %s\n\n", props.deviceName);
+
+  float queue_priority = 1.0f;
+  VkDeviceQueueCreateInfo queue_info = {
+    .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+    .pNext = nullptr,
+    .queueFamilyIndex = hv.queue_family_index,
+    .queueCount = 1,
+    .pQueuePriorities = &queue_priority
+  };
+  VkDeviceCreateInfo device_info = {
+    .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+    .pNext = nullptr,
+    .queueCreateInfoCount = 1,
+    .pQueueCreateInfos = &queue_info,
+    .enabledLayerCount = 0,
+    .ppEnabledLayerNames = nullptr,
+    .enabledExtensionCount = 0,
+    .ppEnabledExtensionNames = nullptr,
+    .pEnabledFeatures = nullptr
+  };
+  res = vkCreateDevice(hv.phys_device, &device_info, nullptr, &hv.device);
+  assert(res == VK_SUCCESS);
+  vkGetDeviceQueue(hv.device, hv.queue_family_index, 0, &hv.queue);
+}
+
+void cleanup_headless_vulkan(HeadlessVulkan& hv) {
+  vkDestroyDevice(hv.device, nullptr);
+  vkDestroyInstance(hv.inst, nullptr);
+  hv = HeadlessVulkan();
+}
@@ -0,0 +1,120 @@
+#include "image_decode.h"
+#include "mapped_file.h"
+// stb_image keeps only its failure reason in a global, so the decodes may
+// run concurrently
+#include "stb_image.h"
+
+#include <cassert>
+#include <cstring>
+
+// A mapped file, with the size of the image it holds
+struct EncodedImage {
+  MappedFile file;
+  bool ok = false;
+  uint32_t w = 0;
+  uint32_t h = 0;
+  VkDeviceSize staging_size = 0;
+};
+
+static void read_encoded_image(const string& path, bool mips,
+    EncodedImage& image) {
+  // the decoder reads the file front to back, and the read-ahead this
+  // starts overlaps the waves before the image's
+  if (!open_mapped_file(image.file, path, FILE_ACCESS_SEQUENTIAL)) {
+    printf("failed to open image %s\n", path.c_str());
+    return;
+  }
+  int w, h, channels;
+  if (!stbi_info_from_memory(image.file.data, (int) image.file.size, &w, &h,
+        &channels)) {
+    printf("failed to read image %s\n", path.c_str());
+    close_mapped_file(image.file);
+    return;
+  }
+  image.ok = true;
+  image.w = (uint32_t) w;
+  image.h = (uint32_t) h;
+  vector<MipLevel> levels;
+  image.staging_size = layout_mip_chain(image.w, image.h,
+      mips ? mip_level_count(image.w, image.h) : 1, levels);
+}
+
+static void decode_image(const string& path, EncodedImage& encoded,
+    DecodedImage& image) {
+  int w, h, channels;
+  stbi_uc* pixels = stbi_load_from_memory(encoded.file.data,
+      (int) encoded.file.size, &w, &h, &channels, STBI_rgb_alpha);
+  close_mapped_file(encoded.file);
+  if (pixels == nullptr || (uint32_t) w != image.w ||
+      (uint32_t) h != image.h) {
+    printf("failed to decode image %s\n", path.c_str());
+    stbi_image_free(pixels);
+    image.ok = false;
+    return;
+  }
+  // stb_image cannot decode into a given buffer, so the base level is
+  // copied once, and the rest of the chain is built in place
+  gen_mip_chain(pixels, image.levels,
+      static_cast<uint8_t*>(image.staging.data));
+  stbi_image_free(pixels);
+}
+
+ImageDecodeStats decode_images(Uploader& uploader, ThreadPool& threads,
+    const vector<string>& paths, bool mips, const DecodedImageFn& on_decoded) {
+  ImageDecodeStats stats;
+  stats.num_images = (uint32_t) paths.size();
+  vector<EncodedImage> encoded(paths.size());
+  thread_pool_run(threads, (uint32_t) paths.size(),
+      [&](uint32_t i, uint32_t) {
+        read_encoded_image(paths[i], mips, encoded[i]);
+      });
+
+  vector<DecodedImage> wave;
+  size_t next = 0;
+  while (next < paths.size()) {
+    // the copies of earlier waves are recorded, so once their batches
+    // retire the whole ring is free for this one
+    upload_flush(uploader);
+    wave.clear();
+    VkDeviceSize wave_size = 0;
+    for (; next < paths.size(); ++next) {
+      const EncodedImage& image = encoded[next];
+      if (!wave.empty() &&
+          wave_size + image.staging_size > IMAGE_DECODE_WAVE_SIZE) {
+        break;
+      }
+      wave_size += image.staging_size;
+      DecodedImage decoded;
+      decoded.index = (uint32_t) next;
+      decoded.ok = image.ok;
+      decoded.w = image.w;
+      decoded.h = image.h;
+      if (image.ok) {
+        assert(image.staging_size <= STAGING_RING_SIZE);
+        layout_mip_chain(image.w, image.h,
+            mips ? mip_level_count(image.w, image.h) : 1, decoded.levels);
+        decoded.staging = upload_stage(uploader, image.staging_size, 16);
+      }
+      wave.push_back(decoded);
+    }
+
+    thread_pool_run(threads, (uint32_t) wave.size(),
+        [&](uint32_t i, uint32_t) {
+          DecodedImage& image = wave[i];
+          if (image.ok) {
+            decode_image(paths[image.index], encoded[image.index], image);
+          }
+        });
+
+    for (DecodedImage& image : wave) {
+      if (image.ok) {
+        stats.decoded_bytes += image.staging.size;
+      } else {
+        stats.num_failed += 1;
+      }
+      on_decoded(image);
+    }
+    stats.num_waves += 1;
+  }
+  return stats;
+}
@@ -0,0 +1,77 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool open_mapped_file(MappedFile& file, const string& path,
+    FileAccess access) {
+  file = MappedFile();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  // the mapping holds its own reference to the file, so the descriptor is
+  // not kept, and any number of files can be mapped at once
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return false;
+  }
+  size_t size = (size_t) file_stat.st_size;
+  if (size == 0) {
+    // mmap rejects empty mappings
+    close(fd);
+    return true;
+  }
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  file.data = static_cast<const uint8_t*>(data);
+  file.size = size;
+
+  // hints only, so failures are ignored
+  if (access == FILE_ACCESS_SEQUENTIAL) {
+    madvise(data, file.size, MADV_SEQUENTIAL);
+    madvise(data, file.size, MADV_WILLNEED);
+  } else {
+    madvise(data, file.size, MADV_RANDOM);
+  }
+  return true;
+}
+
+void close_mapped_file(MappedFile& file) {
+  if (file.data != nullptr) {
+    munmap(const_cast<uint8_t*>(file.data), file.size);
+  }
+  file = MappedFile();
+}
+
+void advise_mapped_file(const MappedFile& file, size_t offset, size_t size) {
+  if (file.data == nullptr || offset >= file.size) {
+    return;
+  }
+  // madvise takes page aligned addresses
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  size_t begin = offset / page_size * page_size;
+  size_t end = offset + std::min(size, file.size - offset);
+  madvise(const_cast<uint8_t*>(file.data) + begin, end - begin,
+      MADV_WILLNEED);
+}
+
+VkShaderModule load_shader_module(VkDevice device, const string& path) {
+  MappedFile file;
+  if (!open_mapped_file(file, path, FILE_ACCESS_SEQUENTIAL) ||
+      file.size == 0) {
+    throw std::runtime_error("failed to read shader " + path);
+  }
+  // the mapping is page aligned, as pCode must be 4 byte aligned
+  VkShaderModule module = create_shader_module(device, file.data,
+      file.size);
+  close_mapped_file(file);
+  return module;
+}
@@ -0,0 +1,268 @@
+#include "mem_alloc.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+static VkDeviceSize align_up(VkDeviceSize val, VkDeviceSize alignment) {
+  return (val + alignment - 1) / alignment * alignment;
+}
+
+uint32_t find_mem_type_index(VkPhysicalDevice& phys_device,
+    uint32_t type_filter,
+    VkMemoryPropertyFlags target_mem_flags) {
+  VkPhysicalDeviceMemoryProperties mem_props;
+  vkGetPhysicalDeviceMemoryProperties(phys_device, &mem_props);
+
+  uint32_t mem_type_index = 0;
+  bool found_mem_type = false;
+  for (uint32_t i = 0; i < mem_props.memoryTypeCount; ++i) {
+    bool mem_type_supported = type_filter & (1 << i);
+    bool has_target_props = (mem_props.memoryTypes[i].propertyFlags &
+      target_mem_flags) == target_mem_flags;
+    if (mem_type_supported && has_target_props) {
+      mem_type_index = i;
+      found_mem_type = true;
+      break;
+    }
+  }
+  assert(found_mem_type);
+  return mem_type_index;
+}
+
+void init_mem_allocator(MemAllocator& allocator,
+    VkPhysicalDevice phys_device, VkDevice device) {
+  allocator.device = device;
+  allocator.phys_device = phys_device;
+  vkGetPhysicalDeviceMemoryProperties(phys_device, &allocator.mem_props);
+}
+
+static void release_block(MemAllocator& allocator, MemBlock& block) {
+  if (block.mapped) {
+    vkUnmapMemory(allocator.device, block.mem);
+  }
+  vkFreeMemory(allocator.device, block.mem, nullptr);
+  allocator.num_device_allocs -= 1;
+  block = MemBlock();
+}
+
+void cleanup_mem_allocator(MemAllocator& allocator) {
+  for (auto& type_pools : allocator.pools) {
+    for (auto& pool : type_pools) {
+      for (MemBlock& block : pool) {
+        if (block.mem != VK_NULL_HANDLE) {
+          if (block.num_allocs > 0) {
+            printf("WARNING mem block freed with %d live allocations\n",
+                block.num_allocs);
+          }
+          release_block(allocator, block);
+        }
+      }
+      pool.clear();
+    }
+  }
+}
+
+static bool create_block(MemAllocator& allocator, uint32_t type_index,
+    VkDeviceSize size, MemBlock& block) {
+  VkMemoryAllocateInfo alloc_info = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = size,
+    .memoryTypeIndex = type_index
+  };
+  VkResult res = vkAllocateMemory(allocator.device, &alloc_info, nullptr,
+      &block.mem);
+  if (res != VK_SUCCESS) {
+    return false;
+  }
+  allocator.num_device_allocs += 1;
+  block.size = size;
+  block.used = 0;
+  block.num_allocs = 0;
+  block.free_ranges = {{0, size}};
+
+  VkMemoryPropertyFlags type_flags =
+    allocator.mem_props.memoryTypes[type_index].propertyFlags;
+  if (type_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    res = vkMapMemory(allocator.device, block.mem, 0, VK_WHOLE_SIZE, 0,
+        &block.mapped);
+    assert(res == VK_SUCCESS);
+  }
+  return true;
+}
+
+// first-fit search over the block's free list
+static bool alloc_from_block(MemBlock& block, VkDeviceSize size,
+    VkDeviceSize alignment, VkDeviceSize& out_offset) {
+  for (size_t i = 0; i < block.free_ranges.size(); ++i) {
+    MemRange range = block.free_ranges[i];
+    VkDeviceSize aligned_offset = align_up(range.offset, alignment);
+    VkDeviceSize padding = aligned_offset - range.offset;
+    if (padding + size > range.size) {
+      continue;
+    }
+    // the padding before the allocation stays free, as does the tail
+    VkDeviceSize tail_offset = aligned_offset + size;
+    VkDeviceSize tail_size = range.offset + range.size - tail_offset;
+    block.free_ranges.erase(block.free_ranges.begin() + i);
+    if (tail_size > 0) {
+      block.free_ranges.insert(block.free_ranges.begin() + i,
+          {tail_offset, tail_size});
+    }
+    if (padding > 0) {
+      block.free_ranges.insert(block.free_ranges.begin() + i,
+          {range.offset, padding});
+    }
+    block.used += size;
+    block.num_allocs += 1;
+    out_offset = aligned_offset;
+    return true;
+  }
+  return false;
+}
+
+MemAlloc alloc_mem(MemAllocator& allocator, const VkMemoryRequirements& reqs,
+    VkMemoryPropertyFlags props, MemTiling tiling) {
+  uint32_t type_index = find_mem_type_index(allocator.phys_device,
+      reqs.memoryTypeBits, props);
+  vector<MemBlock>& pool = allocator.pools[type_index][tiling];
+
+  MemAlloc alloc;
+  alloc.type_index = type_index;
+  alloc.tiling = tiling;
+  alloc.size = reqs.size;
+
+  // try the existing blocks, remembering the first empty slot
+  int empty_slot = -1;
+  bool found = false;
+  for (uint32_t i = 0; i < pool.size() && !found; ++i) {
+    if (pool[i].mem == VK_NULL_HANDLE) {
+      if (empty_slot == -1) {
+        empty_slot = (int) i;
+      }
+      continue;
+    }
+    if (alloc_from_block(pool[i], reqs.size, reqs.alignment, alloc.offset)) {
+      alloc.block_index = i;
+      found = true;
+    }
+  }
+
+  // otherwise start a new block. Keep blocks to a fraction of small heaps.
+  if (!found) {
+    uint32_t heap_index = allocator.mem_props.memoryTypes[type_index].heapIndex;
+    VkDeviceSize heap_size = allocator.mem_props.memoryHeaps[heap_index].size;
+    VkDeviceSize block_size = std::max(
+        std::min(MEM_BLOCK_SIZE, heap_size / 8), reqs.size);
+    if (empty_slot == -1) {
+      empty_slot = (int) pool.size();
+      pool.push_back(MemBlock());
+    }
+    MemBlock& block = pool[empty_slot];
+    bool created = create_block(allocator, type_index, block_size, block);
+    if (!created && block_size > reqs.size) {
+      // the heap may be too fragmented for a full block
+      created = create_block(allocator, type_index, reqs.size, block);
+    }
+    if (!created) {
+      throw std::runtime_error("out of device memory");
+    }
+    block.dedicated = block.size == reqs.size;
+    found = alloc_from_block(block, reqs.size, reqs.alignment, alloc.offset);
+    assert(found);
+    alloc.block_index = empty_slot;
+  }
+
+  MemBlock& block = pool[alloc.block_index];
+  alloc.mem = block.mem;
+  if (block.mapped) {
+    alloc.mapped = static_cast<char*>(block.mapped) + alloc.offset;
+  }
+  return alloc;
+}
+
+void free_mem(MemAllocator& allocator, MemAlloc& alloc) {
+  if (alloc.mem == VK_NULL_HANDLE) {
+    return;
+  }
+  MemBlock& block =
+    allocator.pools[alloc.type_index][alloc.tiling][alloc.block_index];
+  assert(block.mem == alloc.mem);
+
+  // insert the range in offset order, then merge with its neighbours
+  vector<MemRange>& ranges = block.free_ranges;
+  size_t i = 0;
+  while (i < ranges.size() && ranges[i].offset < alloc.offset) {
+    ++i;
+  }
+  ranges.insert(ranges.begin() + i, {alloc.offset, alloc.size});
+  if (i + 1 < ranges.size() &&
+      ranges[i].offset + ranges[i].size == ranges[i + 1].offset) {
+    ranges[i].size += ranges[i + 1].size;
+    ranges.erase(ranges.begin() + i + 1);
+  }
+  if (i > 0 && ranges[i - 1].offset + ranges[i - 1].size == ranges[i].offset) {
+    ranges[i - 1].size += ranges[i].size;
+    ranges.erase(ranges.begin() + i);
+  }
+
+  block.used -= alloc.size;
+  block.num_allocs -= 1;
+  if (block.dedicated && block.num_allocs == 0) {
+    // the slot stays, as block indices of live allocations must not change
+    release_block(allocator, block);
+  }
+  alloc = MemAlloc();
+}
+
+void release_empty_mem_blocks(MemAllocator& allocator) {
+  for (auto& type_pools : allocator.pools) {
+    for (auto& pool : type_pools) {
+      for (MemBlock& block : pool) {
+        if (block.mem != VK_NULL_HANDLE && block.num_allocs == 0) {
+          release_block(allocator, block);
+        }
+      }
+      // trailing empty slots can go, the rest must keep their indices
+      while (!pool.empty() && pool.back().mem == VK_NULL_HANDLE) {
+        pool.pop_back();
+      }
+    }
+  }
+}
+
+vector<MemHeapStats> get_mem_heap_stats(MemAllocator& allocator) {
+  vector<MemHeapStats> stats(allocator.mem_props.memoryHeapCount);
+  for (uint32_t t = 0; t < allocator.mem_props.memoryTypeCount; ++t) {
+    MemHeapStats& heap_stats =
+      stats[allocator.mem_props.memoryTypes[t].heapIndex];
+    for (auto& pool : allocator.pools[t]) {
+      for (MemBlock& block : pool) {
+        if (block.mem == VK_NULL_HANDLE) {
+          continue;
+        }
+        heap_stats.num_blocks += 1;
+        heap_stats.num_allocs += block.num_allocs;
+        heap_stats.block_bytes += block.size;
+        heap_stats.used_bytes += block.used;
+      }
+    }
+  }
+  return stats;
+}
+
+void log_mem_stats(MemAllocator& allocator) {
+  vector<MemHeapStats> stats = get_mem_heap_stats(allocator);
+  printf("device memory (%d vkAllocateMemory allocations):\n",
+      allocator.num_device_allocs);
+  for (size_t i = 0; i < stats.size(); ++i) {
+    MemHeapStats& s = stats[i];
+    if (s.num_blocks == 0) {
+      continue;
+    }
+    printf("heap %lu: blocks: %d, allocs: %d, used: %.2fMB / %.2fMB\n",
+        i, s.num_blocks, s.num_allocs, s.used_bytes / (1024.0 * 1024.0),
+        s.block_bytes / (1024.0 * 1024.0));
+  }
+  printf("\n");
+}
@@ -0,0 +1,257 @@
+#include "mipmaps.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const uint32_t RGBA8_SIZE = 4;
+// a 4x4 tile of RGBA8 texels fills one 64 byte line
+const uint32_t TEX_TILE_SIZE = 4;
+const uint32_t TEX_LINE_SIZE = 64;
+const uint32_t TEX_CACHE_WAYS = 4;
+const uint32_t TEX_CACHE_SETS = 16 * 1024 / TEX_LINE_SIZE / TEX_CACHE_WAYS;
+const uint32_t RASTER_TILE_SIZE = 8;
+
+uint32_t mip_level_count(uint32_t w, uint32_t h) {
+  uint32_t num_levels = 1;
+  for (uint32_t size = std::max(w, h); size > 1; size /= 2) {
+    num_levels += 1;
+  }
+  return num_levels;
+}
+
+VkDeviceSize layout_mip_chain(uint32_t w, uint32_t h, uint32_t num_levels,
+    vector<MipLevel>& out_levels) {
+  out_levels.resize(num_levels);
+  VkDeviceSize offset = 0;
+  for (uint32_t level = 0; level < num_levels; ++level) {
+    out_levels[level] = {offset, w, h};
+    offset += (VkDeviceSize) w * h * RGBA8_SIZE;
+    w = std::max(w / 2, 1u);
+    h = std::max(h / 2, 1u);
+  }
+  return offset;
+}
+
+bool supports_linear_blit(VkPhysicalDevice phys_device, VkFormat format) {
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(phys_device, format, &props);
+  VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+    VK_FORMAT_FEATURE_BLIT_DST_BIT |
+    VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (props.optimalTilingFeatures & needed) == needed;
+}
+
+void record_mip_blits(VkCommandBuffer cmd_buffer, VkImage image,
+    uint32_t w, uint32_t h, uint32_t num_levels) {
+  VkImageMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = image,
+    .subresourceRange = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = 0,
+      .levelCount = 1,
+      .baseArrayLayer = 0,
+      .layerCount = 1
+    }
+  };
+  int32_t src_w = (int32_t) w;
+  int32_t src_h = (int32_t) h;
+  for (uint32_t level = 1; level < num_levels; ++level) {
+    // the previous level becomes the blit source once it is written
+    barrier.subresourceRange.baseMipLevel = level - 1;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    vkCmdPipelineBarrier(cmd_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+
+    int32_t dst_w = std::max(src_w / 2, 1);
+    int32_t dst_h = std::max(src_h / 2, 1);
+    VkImageBlit blit = {
+      .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1},
+      .srcOffsets = {{0, 0, 0}, {src_w, src_h, 1}},
+      .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+      .dstOffsets = {{0, 0, 0}, {dst_w, dst_h, 1}}
+    };
+    vkCmdBlitImage(cmd_buffer,
+        image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &blit, VK_FILTER_LINEAR);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    vkCmdPipelineBarrier(cmd_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+    src_w = dst_w;
+    src_h = dst_h;
+  }
+}
+
+// Averages dst pixels [first_x, dst_w) of one row from source rows r0, r1
+static void downsample_row_scalar(const uint8_t* r0, const uint8_t* r1,
+    uint32_t w, uint32_t first_x, uint32_t dst_w, uint8_t* dst_row) {
+  for (uint32_t x = first_x; x < dst_w; ++x) {
+    uint32_t x0 = 2 * x * RGBA8_SIZE;
+    uint32_t x1 = std::min(2 * x + 1, w - 1) * RGBA8_SIZE;
+    for (uint32_t c = 0; c < RGBA8_SIZE; ++c) {
+      uint32_t sum = r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c];
+      dst_row[x * RGBA8_SIZE + c] = (uint8_t) ((sum + 2) / 4);
+    }
+  }
+}
+
+void downsample_rgba8_scalar(const uint8_t* src, uint32_t w, uint32_t h,
+    uint8_t* dst) {
+  uint32_t dst_w = std::max(w / 2, 1u);
+  uint32_t dst_h = std::max(h / 2, 1u);
+  for (uint32_t y = 0; y < dst_h; ++y) {
+    const uint8_t* r0 = src + (size_t) 2 * y * w * RGBA8_SIZE;
+    const uint8_t* r1 = src +
+      (size_t) std::min(2 * y + 1, h - 1) * w * RGBA8_SIZE;
+    downsample_row_scalar(r0, r1, w, 0, dst_w,
+        dst + (size_t) y * dst_w * RGBA8_SIZE);
+  }
+}
+
+void downsample_rgba8(const uint8_t* src, uint32_t w, uint32_t h,
+    uint8_t* dst) {
+#ifdef __SSE2__
+  uint32_t dst_w = std::max(w / 2, 1u);
+  uint32_t dst_h = std::max(h / 2, 1u);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+  for (uint32_t y = 0; y < dst_h; ++y) {
+    const uint8_t* r0 = src + (size_t) 2 * y * w * RGBA8_SIZE;
+    const uint8_t* r1 = src +
+      (size_t) std::min(2 * y + 1, h - 1) * w * RGBA8_SIZE;
+    uint8_t* dst_row = dst + (size_t) y * dst_w * RGBA8_SIZE;
+    // two dst pixels from four src pixels of each row
+    uint32_t x = 0;
+    for (; w >= 2 && x + 2 <= dst_w; x += 2) {
+      __m128i a = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(r0 + 2 * x * RGBA8_SIZE));
+      __m128i b = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(r1 + 2 * x * RGBA8_SIZE));
+      // 16-bit sums of the two rows, pixels 0-1 and 2-3
+      __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+          _mm_unpacklo_epi8(b, zero));
+      __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+          _mm_unpackhi_epi8(b, zero));
+      // then of horizontal pairs, in the low half of each
+      lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+      hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+      __m128i sum = _mm_unpacklo_epi64(lo, hi);
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(dst_row + x * RGBA8_SIZE),
+          _mm_packus_epi16(sum, zero));
+    }
+    downsample_row_scalar(r0, r1, w, x, dst_w, dst_row);
+  }
+#else
+  downsample_rgba8_scalar(src, w, h, dst);
+#endif
+}
+
+void gen_mip_chain(const uint8_t* pixels, const vector<MipLevel>& levels,
+    uint8_t* dst) {
+  assert(!levels.empty());
+  memcpy(dst + levels[0].offset, pixels,
+      (size_t) levels[0].w * levels[0].h * RGBA8_SIZE);
+  for (size_t level = 1; level < levels.size(); ++level) {
+    const MipLevel& src = levels[level - 1];
+    downsample_rgba8(dst + src.offset, src.w, src.h,
+        dst + levels[level].offset);
+  }
+}
+
+MipSampling model_mip_sampling(uint32_t w, uint32_t h, uint32_t screen_size,
+    bool use_mips) {
+  MipSampling sampling;
+  if (use_mips) {
+    // the level where a pixel covers about a texel, as the sampler picks
+    float ratio = std::max(w, h) / (float) std::max(screen_size, 1u);
+    int level = (int) std::floor(std::log2(std::max(ratio, 1.0f)));
+    sampling.level = (uint32_t) std::min(level,
+        (int) mip_level_count(w, h) - 1);
+  }
+  uint32_t level_w = std::max(w >> sampling.level, 1u);
+  uint32_t level_h = std::max(h >> sampling.level, 1u);
+  uint32_t tiles_w = (level_w + TEX_TILE_SIZE - 1) / TEX_TILE_SIZE;
+  uint32_t tiles_h = (level_h + TEX_TILE_SIZE - 1) / TEX_TILE_SIZE;
+
+  vector<bool> seen((size_t) tiles_w * tiles_h, false);
+  // each set is ordered most recently used first
+  vector<uint64_t> cache(TEX_CACHE_SETS * TEX_CACHE_WAYS, ~0ull);
+  uint64_t num_unique = 0;
+  uint64_t num_fetched = 0;
+  for (uint32_t ty = 0; ty < screen_size; ty += RASTER_TILE_SIZE) {
+    for (uint32_t tx = 0; tx < screen_size; tx += RASTER_TILE_SIZE) {
+      uint32_t end_y = std::min(ty + RASTER_TILE_SIZE, screen_size);
+      uint32_t end_x = std::min(tx + RASTER_TILE_SIZE, screen_size);
+      for (uint32_t py = ty; py < end_y; ++py) {
+        for (uint32_t px = tx; px < end_x; ++px) {
+          float u = (px + 0.5f) / screen_size * level_w - 0.5f;
+          float v = (py + 0.5f) / screen_size * level_h - 0.5f;
+          uint32_t x0 = (uint32_t) clamp((int) std::floor(u), 0,
+              (int) level_w - 1);
+          uint32_t y0 = (uint32_t) clamp((int) std::floor(v), 0,
+              (int) level_h - 1);
+          uint32_t xs[2] = {x0, std::min(x0 + 1, level_w - 1)};
+          uint32_t ys[2] = {y0, std::min(y0 + 1, level_h - 1)};
+          // the bilinear footprint
+          uint64_t last_line = ~0ull;
+          for (uint32_t y : ys) {
+            for (uint32_t x : xs) {
+              uint64_t line = (uint64_t) (y / TEX_TILE_SIZE) * tiles_w +
+                x / TEX_TILE_SIZE;
+              if (line == last_line) {
+                continue;
+              }
+              last_line = line;
+              if (!seen[line]) {
+                seen[line] = true;
+                num_unique += 1;
+              }
+              // hashed, so that power of two pitches do not alias
+              uint64_t set = (line * 0x9e3779b97f4a7c15ull >> 32) %
+                TEX_CACHE_SETS;
+              uint64_t* ways = &cache[set * TEX_CACHE_WAYS];
+              uint32_t way = 0;
+              while (way < TEX_CACHE_WAYS - 1 && ways[way] != line) {
+                ++way;
+              }
+              if (ways[way] != line) {
+                num_fetched += 1;
+              }
+              for (; way > 0; --way) {
+                ways[way] = ways[way - 1];
+              }
+              ways[0] = line;
+            }
+          }
+        }
+      }
+    }
+  }
+  sampling.unique_bytes = num_unique * TEX_LINE_SIZE;
+  sampling.fetched_bytes = num_fetched * TEX_LINE_SIZE;
+  return sampling;
+}
@@ -0,0 +1,74 @@
+#include "morph.h"
+
+#include <cmath>
+
+MorphNodes::MorphNodes(size_t num_nodes) :
+  pos_vec(num_nodes), vel_vec(num_nodes), neighbors_vec(num_nodes),
+  data_vec(num_nodes) {}
+
+MorphNodes::MorphNodes(const vector<MorphNode>& nodes) :
+  MorphNodes(nodes.size()) {
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    pos_vec[i] = nodes[i].pos;
+    vel_vec[i] = nodes[i].vel;
+    neighbors_vec[i] = nodes[i].neighbors;
+    data_vec[i] = nodes[i].data;
+  }
+}
+
+MorphNode MorphNodes::node_at(size_t i) const {
+  return MorphNode(pos_vec[i], vel_vec[i], neighbors_vec[i], data_vec[i]);
+}
+
+array<vec4*, MORPH_BUF_COUNT> MorphNodes::buffers() {
+  return {{
+    pos_vec.data(), vel_vec.data(), neighbors_vec.data(), data_vec.data()
+  }};
+}
+
+MorphUserParams default_morph_params() {
+  return {{
+    vec4(0.01f, 1.0f, 0.9f, 0.1f), vec4(0.0f), vec4(0.0f), vec4(0.0f)
+  }};
+}
+
+string raw_node_str(const MorphNode& node) {
+  return vec4_str(node.pos) + " " + vec4_str(node.vel) + " " +
+    vec4_str(node.neighbors) + " " + vec4_str(node.data);
+}
+
+void log_nodes(const MorphNodes& node_vecs) {
+  printf("%lu nodes:\n", node_vecs.size());
+  for (size_t i = 0; i < node_vecs.size(); ++i) {
+    MorphNode node = node_vecs.node_at(i);
+    printf("%4lu %s\n", i, raw_node_str(node).c_str());
+  }
+  printf("\n\n");
+}
+
+vec3 gen_sphere(vec2 unit) {
+  float v_angle = unit[1] * M_PI;
+  float h_angle = unit[0] * 2.0 * M_PI;
+  return vec3(
+      sin(v_angle) * cos(h_angle),
+      sin(v_angle) * sin(h_angle),
+      cos(v_angle));
+}
+
+vec3 gen_square(vec2 unit) {
+  return vec3(unit, 0);
+}
+
+vec3 gen_plane(vec2 unit) {
+  vec2 plane_pos = 10.0f * (unit - 0.5f);
+  return vec3(plane_pos[0], 0.0f, plane_pos[1]);
+}
+
+int coord_to_index(ivec2 coord, ivec2 samples) {
+  if ((0 <= coord[0] && coord[0] < samples[0]) &&
+      (0 <= coord[1] && coord[1] < samples[1])) {
+    return coord[0] % samples[0] + samples[0] * (coord[1] % samples[1]);
+  } else {
+    return -1;
+  }
+}
@@ -0,0 +1,180 @@
+#include "morph_checkpoints.h"
+#include "byte_planes.h"
+
+#include <cassert>
+
+static size_t nodes_mem_size(size_t num_nodes) {
+  return num_nodes * MORPH_BUF_COUNT * sizeof(vec4);
+}
+
+// Each word is XORed with the same component of the previous node, which
+// zeroes the sign and exponent bits of smooth data and most of the
+// neighbor indices, then coded as byte planes
+static void compress_nodes(MorphNodes& nodes, vector<uint8_t>& out_bytes) {
+  size_t num_words = nodes.size() * 4;
+  vector<uint32_t> deltas(num_words);
+  out_bytes.clear();
+  for (vec4* buffer : nodes.buffers()) {
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(buffer);
+    for (size_t i = 0; i < num_words; ++i) {
+      deltas[i] = words[i] ^ (i >= 4 ? words[i - 4] : 0);
+    }
+    encode_byte_planes(deltas.data(), num_words, sizeof(uint32_t),
+        out_bytes);
+  }
+}
+
+static void decompress_nodes(const vector<uint8_t>& bytes, size_t num_nodes,
+    MorphNodes& out_nodes) {
+  out_nodes = MorphNodes(num_nodes);
+  size_t num_words = num_nodes * 4;
+  size_t pos = 0;
+  for (vec4* buffer : out_nodes.buffers()) {
+    uint32_t* words = reinterpret_cast<uint32_t*>(buffer);
+    size_t num_read = decode_byte_planes(bytes.data() + pos,
+        bytes.size() - pos, num_words, sizeof(uint32_t), words);
+    assert(num_read > 0 || num_words == 0);
+    pos += num_read;
+    for (size_t i = 4; i < num_words; ++i) {
+      words[i] ^= words[i - 4];
+    }
+  }
+}
+
+void init_checkpoint_store(CheckpointStore& store, size_t mem_budget,
+    const string& spill_path) {
+  store.mem_budget = mem_budget;
+  store.spill_path = spill_path;
+}
+
+void cleanup_checkpoint_store(CheckpointStore& store) {
+  clear_checkpoint_store(store);
+  if (!store.spill_path.empty()) {
+    remove(store.spill_path.c_str());
+  }
+}
+
+void clear_checkpoint_store(CheckpointStore& store) {
+  store.checkpoints.clear();
+  store.mem_used = 0;
+  if (store.spill_file.is_open()) {
+    store.spill_file.close();
+  }
+  store.spill_end = 0;
+}
+
+size_t checkpoint_store_size(const CheckpointStore& store) {
+  return store.checkpoints.size();
+}
+
+bool checkpoint_store_has(const CheckpointStore& store, int iter_num) {
+  return store.checkpoints.count(iter_num) > 0;
+}
+
+static bool open_spill_file(CheckpointStore& store) {
+  if (store.spill_path.empty()) {
+    return false;
+  }
+  if (!store.spill_file.is_open()) {
+    store.spill_file.open(store.spill_path,
+        ios::in | ios::out | ios::binary | ios::trunc);
+    store.spill_end = 0;
+    if (!store.spill_file.is_open()) {
+      printf("failed to open checkpoint spill file %s\n",
+          store.spill_path.c_str());
+      store.spill_path.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+// Moves the least recently used checkpoints out of memory until the
+// budget is met. keep_iter is never evicted.
+static void evict_checkpoints(CheckpointStore& store, int keep_iter) {
+  while (store.mem_used > store.mem_budget) {
+    auto victim = store.checkpoints.end();
+    for (auto it = store.checkpoints.begin(); it != store.checkpoints.end();
+        ++it) {
+      if (it->second.in_memory && it->first != keep_iter &&
+          (victim == store.checkpoints.end() ||
+           it->second.last_use < victim->second.last_use)) {
+        victim = it;
+      }
+    }
+    if (victim == store.checkpoints.end()) {
+      return;
+    }
+
+    MorphCheckpoint& checkpoint = victim->second;
+    if (!checkpoint.on_disk && open_spill_file(store)) {
+      vector<uint8_t> bytes;
+      compress_nodes(checkpoint.nodes, bytes);
+      store.spill_file.seekp(store.spill_end);
+      store.spill_file.write(reinterpret_cast<const char*>(bytes.data()),
+          bytes.size());
+      if (store.spill_file.good()) {
+        checkpoint.on_disk = true;
+        checkpoint.file_offset = store.spill_end;
+        checkpoint.file_size = bytes.size();
+        store.spill_end += bytes.size();
+        store.num_spills += 1;
+        store.spilled_bytes += bytes.size();
+      } else {
+        store.spill_file.clear();
+      }
+    }
+    store.mem_used -= nodes_mem_size(checkpoint.num_nodes);
+    if (checkpoint.on_disk) {
+      checkpoint.nodes = MorphNodes();
+      checkpoint.in_memory = false;
+    } else {
+      store.checkpoints.erase(victim);
+      store.num_drops += 1;
+    }
+  }
+}
+
+void checkpoint_store_put(CheckpointStore& store, int iter_num,
+    MorphNodes&& nodes) {
+  MorphCheckpoint& checkpoint = store.checkpoints[iter_num];
+  if (checkpoint.in_memory) {
+    store.mem_used -= nodes_mem_size(checkpoint.num_nodes);
+  }
+  checkpoint = MorphCheckpoint();
+  checkpoint.num_nodes = nodes.size();
+  checkpoint.nodes = std::move(nodes);
+  checkpoint.in_memory = true;
+  checkpoint.last_use = ++store.use_clock;
+  store.mem_used += nodes_mem_size(checkpoint.num_nodes);
+  evict_checkpoints(store, iter_num);
+}
+
+int checkpoint_store_find(const CheckpointStore& store, int iter_num) {
+  auto it = store.checkpoints.upper_bound(iter_num);
+  if (it == store.checkpoints.begin()) {
+    return -1;
+  }
+  --it;
+  return it->first;
+}
+
+MorphNodes& checkpoint_store_get(CheckpointStore& store, int iter_num) {
+  auto it = store.checkpoints.find(iter_num);
+  assert(it != store.checkpoints.end());
+  MorphCheckpoint& checkpoint = it->second;
+  checkpoint.last_use = ++store.use_clock;
+  if (!checkpoint.in_memory) {
+    vector<uint8_t> bytes(checkpoint.file_size);
+    store.spill_file.seekg(checkpoint.file_offset);
+    store.spill_file.read(reinterpret_cast<char*>(bytes.data()),
+        bytes.size());
+    assert(store.spill_file.good());
+    decompress_nodes(bytes, checkpoint.num_nodes, checkpoint.nodes);
+    checkpoint.in_memory = true;
+    store.mem_used += nodes_mem_size(checkpoint.num_nodes);
+    store.num_reloads += 1;
+    evict_checkpoints(store, iter_num);
+  }
+  return checkpoint.nodes;
+}
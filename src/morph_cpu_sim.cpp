@@ -0,0 +1,429 @@
+#include "morph_cpu_sim.h"
+#include "morph_reorder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "glm/simd/geometric.h"
+
+void init_morph_cpu_sim(MorphCpuSim& sim, ThreadPool& threads,
+    MorphNodeFormat format) {
+  sim.threads = &threads;
+  sim.format = format;
+  sim.user_params = default_morph_params();
+}
+
+void cleanup_morph_cpu_sim(MorphCpuSim& sim) {
+  sim = MorphCpuSim();
+}
+
+void morph_cpu_sim_write_nodes(MorphCpuSim& sim,
+    const MorphNodes& node_vecs) {
+  for (MorphNodeBuffers& node_set : sim.node_sets) {
+    resize_morph_buffers(node_set, sim.format, node_vecs.size());
+  }
+  pack_morph_nodes(node_vecs, sim.format, sim.node_sets[0].ptrs());
+  sim.cur_set = 0;
+  sim.iter_num = 0;
+}
+
+void morph_cpu_sim_write_zygote(MorphCpuSim& sim, ivec2 samples,
+    MorphShapeFn shape, vector<uint32_t>& out_indices) {
+  size_t num_nodes = morph_zygote_num_nodes(samples);
+  for (MorphNodeBuffers& node_set : sim.node_sets) {
+    resize_morph_buffers(node_set, sim.format, num_nodes);
+  }
+  out_indices.resize(morph_zygote_num_indices(samples));
+  gen_morph_zygote(samples, shape, sim.format, sim.node_sets[0].ptrs(),
+      out_indices.data(), sim.threads);
+  sim.cur_set = 0;
+  sim.iter_num = 0;
+}
+
+MorphNodes morph_cpu_sim_read_nodes(MorphCpuSim& sim) {
+  const MorphNodeBuffers& node_set = sim.node_sets[sim.cur_set];
+  MorphNodes node_vecs;
+  unpack_morph_nodes(node_set.ptrs(), node_set.format, node_set.size(),
+      node_vecs);
+  return node_vecs;
+}
+
+struct StepParams {
+  float growth;
+  float smoothing;
+  float damping;
+  float dt;
+};
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+
+// The same arithmetic as the scalar version below, four lanes at a time
+// with w kept at zero. Divisions and square roots are exact, not the
+// rsqrt approximations, so the results stay within rounding of the GPU's.
+// Returns the distance travelled.
+static inline float update_node(vec4& pos_out, vec4& vel_out,
+    const vec4 adj[4], const StepParams& p) {
+  const glm_vec4 xyz_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  const glm_vec4 w_mask = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+  const glm_vec4 dt = _mm_set1_ps(p.dt);
+
+  glm_vec4 pos = _mm_and_ps(pos_out.data, xyz_mask);
+  glm_vec4 right = _mm_and_ps(adj[0].data, xyz_mask);
+  glm_vec4 up = _mm_and_ps(adj[1].data, xyz_mask);
+  glm_vec4 left = _mm_and_ps(adj[2].data, xyz_mask);
+  glm_vec4 down = _mm_and_ps(adj[3].data, xyz_mask);
+  glm_vec4 avg = _mm_mul_ps(_mm_set1_ps(0.25f),
+      _mm_add_ps(_mm_add_ps(right, up), _mm_add_ps(left, down)));
+  glm_vec4 normal = glm_vec4_cross(_mm_sub_ps(right, left),
+      _mm_sub_ps(up, down));
+  float normal_len = _mm_cvtss_f32(glm_vec4_length(normal));
+  normal = normal_len > 0.0f ?
+    _mm_div_ps(normal, _mm_set1_ps(normal_len)) :
+    _mm_set_ps(0.0f, 0.0f, 1.0f, 0.0f);
+
+  glm_vec4 accel = _mm_add_ps(
+      _mm_mul_ps(_mm_set1_ps(p.smoothing), _mm_sub_ps(avg, pos)),
+      _mm_mul_ps(_mm_set1_ps(p.growth), normal));
+  glm_vec4 vel = _mm_and_ps(vel_out.data, xyz_mask);
+  vel = _mm_mul_ps(_mm_set1_ps(p.damping),
+      _mm_add_ps(vel, _mm_mul_ps(dt, accel)));
+  pos = _mm_add_ps(pos, _mm_mul_ps(dt, vel));
+
+  pos_out.data = _mm_or_ps(pos, _mm_and_ps(pos_out.data, w_mask));
+  vel_out.data = _mm_or_ps(vel, _mm_and_ps(vel_out.data, w_mask));
+  return p.dt * _mm_cvtss_f32(glm_vec4_length(vel));
+}
+
+#else
+
+static inline float update_node(vec4& pos_out, vec4& vel_out,
+    const vec4 adj[4], const StepParams& p) {
+  vec3 pos = vec3(pos_out);
+  vec3 vel = vec3(vel_out);
+  // right, up, left, down
+  vec3 avg = 0.25f * (vec3(adj[0]) + vec3(adj[1]) + vec3(adj[2]) +
+      vec3(adj[3]));
+  vec3 normal = cross(vec3(adj[0]) - vec3(adj[2]),
+      vec3(adj[1]) - vec3(adj[3]));
+  float normal_len = length(normal);
+  normal = normal_len > 0.0f ? normal / normal_len : vec3(0.0f, 1.0f, 0.0f);
+
+  vec3 accel = p.smoothing * (avg - pos) + p.growth * normal;
+  vel = p.damping * (vel + p.dt * accel);
+  pos = pos + p.dt * vel;
+
+  pos_out = vec4(pos, pos_out.w);
+  vel_out = vec4(vel, vel_out.w);
+  return p.dt * length(vel);
+}
+
+#endif
+
+// Converts count half4s to vec4s, or back
+typedef void (*HalfToFloatFn)(const uvec2* src, vec4* dst, size_t count);
+typedef void (*FloatToHalfFn)(const vec4* src, uvec2* dst, size_t count);
+
+static void half_to_float(const uvec2* src, vec4* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = vec4(unpackHalf2x16(src[i].x), unpackHalf2x16(src[i].y));
+  }
+}
+
+// Rounds to nearest even like F16C, so that the results do not depend on
+// the CPU. glm's packHalf2x16 truncates.
+static uint32_t float_to_half_bits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  uint32_t sign = (bits >> 16) & 0x8000;
+  uint32_t abs_bits = bits & 0x7fffffff;
+  if (abs_bits >= 0x47800000) {
+    // too large, infinite or NaN
+    return sign | 0x7c00 | (abs_bits > 0x7f800000 ? 0x200 : 0);
+  }
+  uint32_t shift = 13;
+  uint32_t half;
+  if (abs_bits >= 0x38800000) {
+    // normal, rebias the exponent from 127 to 15
+    half = abs_bits - 0x38000000;
+  } else {
+    // subnormal, in units of 2^-24
+    uint32_t exponent = abs_bits >> 23;
+    if (exponent < 102) {
+      return sign;
+    }
+    half = (abs_bits & 0x7fffff) | 0x800000;
+    shift = 126 - exponent;
+  }
+  uint32_t rest = half & ((1u << shift) - 1);
+  uint32_t tie = 1u << (shift - 1);
+  half >>= shift;
+  // a carry out of the mantissa correctly bumps the exponent
+  if (rest > tie || (rest == tie && (half & 1))) {
+    half += 1;
+  }
+  return sign | half;
+}
+
+static void float_to_half(const vec4* src, uvec2* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = uvec2(
+        float_to_half_bits(src[i].x) | float_to_half_bits(src[i].y) << 16,
+        float_to_half_bits(src[i].z) | float_to_half_bits(src[i].w) << 16);
+  }
+}
+
+#if (GLM_ARCH & GLM_ARCH_SSE2_BIT) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+// glm's half conversions are bit manipulation in software and cost more
+// than the bandwidth they save. F16C does them in one instruction, but is
+// not in the baseline instruction set, so these are compiled for it on
+// their own and only picked if the CPU has it.
+__attribute__((target("f16c")))
+static void half_to_float_f16c(const uvec2* src, vec4* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i].data = _mm_cvtph_ps(_mm_loadl_epi64(
+          reinterpret_cast<const __m128i*>(&src[i])));
+  }
+}
+
+__attribute__((target("f16c")))
+static void float_to_half_f16c(const vec4* src, uvec2* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&dst[i]),
+        _mm_cvtps_ph(src[i].data, _MM_FROUND_TO_NEAREST_INT));
+  }
+}
+
+#define MORPH_F16C
+
+#endif
+
+struct HalfConverters {
+  HalfToFloatFn to_float;
+  FloatToHalfFn to_half;
+};
+
+static HalfConverters pick_half_converters() {
+#ifdef MORPH_F16C
+  if (__builtin_cpu_supports("f16c")) {
+    return {half_to_float_f16c, float_to_half_f16c};
+  }
+#endif
+  return {half_to_float, float_to_half};
+}
+
+// xyz in the compact formats, with w zero
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+
+// Loaded straight into a register. Going through memory, or glm's
+// packed_vec3 constructors, stalls on store forwarding.
+static inline vec4 load_xyz(const void* buf, size_t i) {
+  const float* xyz = static_cast<const float*>(buf) + 3 * i;
+  vec4 v;
+  v.data = _mm_movelh_ps(
+      _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(xyz))),
+      _mm_load_ss(xyz + 2));
+  return v;
+}
+
+static inline void store_xyz(void* buf, size_t i, const vec4& v) {
+  float* xyz = static_cast<float*>(buf) + 3 * i;
+  _mm_store_sd(reinterpret_cast<double*>(xyz), _mm_castps_pd(v.data));
+  _mm_store_ss(xyz + 2, _mm_movehl_ps(v.data, v.data));
+}
+
+#else
+
+static inline vec4 load_xyz(const void* buf, size_t i) {
+  const float* xyz = static_cast<const float*>(buf) + 3 * i;
+  return vec4(xyz[0], xyz[1], xyz[2], 0.0f);
+}
+
+static inline void store_xyz(void* buf, size_t i, const vec4& v) {
+  float* xyz = static_cast<float*>(buf) + 3 * i;
+  xyz[0] = v.x;
+  xyz[1] = v.y;
+  xyz[2] = v.z;
+}
+
+#endif
+
+// Nodes per block of half vels. They are converted a block at a time, so
+// the indirect call to the converter is not paid per node.
+const size_t MORPH_HALF_BLOCK_SIZE = 256;
+
+// The layout is a template parameter so that the loop has no per-node
+// format branches
+template<bool COMPACT, bool HALF>
+static void step_nodes(const MorphNodeBuffers& in, MorphNodeBuffers& out,
+    const StepParams& params, size_t first, size_t end) {
+  static const HalfConverters half = pick_half_converters();
+  const void* pos_in = in.bufs[0].data();
+  const void* vel_in = in.bufs[1].data();
+  const void* neighbors_in = in.bufs[2].data();
+  const void* data_in = in.bufs[3].data();
+  void* pos_out = out.bufs[0].data();
+  void* vel_out = out.bufs[1].data();
+  void* neighbors_out = out.bufs[2].data();
+  void* data_out = out.bufs[3].data();
+
+  vec4 half_vels[MORPH_HALF_BLOCK_SIZE];
+  for (size_t block = first; block < end; block += MORPH_HALF_BLOCK_SIZE) {
+    size_t block_end = std::min(block + MORPH_HALF_BLOCK_SIZE, end);
+    if (HALF) {
+      half.to_float(static_cast<const uvec2*>(vel_in) + block, half_vels,
+          block_end - block);
+    }
+    for (size_t i = block; i < block_end; ++i) {
+      vec4 pos;
+      vec4 adj[4];
+      if (COMPACT) {
+        pos = load_xyz(pos_in, i);
+        const uvec4& neighbors =
+          static_cast<const uvec4*>(neighbors_in)[i];
+        for (int n = 0; n < 4; ++n) {
+          adj[n] = neighbors[n] == MORPH_NO_NEIGHBOR ? pos :
+            load_xyz(pos_in, neighbors[n]);
+        }
+        static_cast<uvec4*>(neighbors_out)[i] = neighbors;
+      } else {
+        pos = static_cast<const vec4*>(pos_in)[i];
+        const vec4& neighbors = static_cast<const vec4*>(neighbors_in)[i];
+        for (int n = 0; n < 4; ++n) {
+          adj[n] = neighbors[n] < 0.0f ? pos :
+            static_cast<const vec4*>(pos_in)[(int) neighbors[n]];
+        }
+        static_cast<vec4*>(neighbors_out)[i] = neighbors;
+      }
+
+      vec4 vel;
+      if (HALF) {
+        vel = half_vels[i - block];
+      } else if (COMPACT) {
+        vel = load_xyz(vel_in, i);
+      } else {
+        vel = static_cast<const vec4*>(vel_in)[i];
+      }
+
+      float travelled = update_node(pos, vel, adj, params);
+
+      if (COMPACT) {
+        store_xyz(pos_out, i, pos);
+        static_cast<float*>(data_out)[i] =
+          static_cast<const float*>(data_in)[i] + travelled;
+      } else {
+        static_cast<vec4*>(pos_out)[i] = pos;
+        vec4 data = static_cast<const vec4*>(data_in)[i];
+        data.x += travelled;
+        static_cast<vec4*>(data_out)[i] = data;
+      }
+      if (HALF) {
+        half_vels[i - block] = vel;
+      } else if (COMPACT) {
+        store_xyz(vel_out, i, vel);
+      } else {
+        static_cast<vec4*>(vel_out)[i] = vel;
+      }
+    }
+    if (HALF) {
+      half.to_half(half_vels, static_cast<uvec2*>(vel_out) + block,
+          block_end - block);
+    }
+  }
+}
+
+void morph_cpu_sim_step(const MorphNodeBuffers& in, MorphNodeBuffers& out,
+    const MorphUserParams& user_params, size_t first, size_t end) {
+  assert(in.format == out.format && in.size() == out.size());
+  StepParams params = {
+    user_params[0].x, user_params[0].y, user_params[0].z, user_params[0].w
+  };
+  switch (in.format) {
+    case MORPH_FORMAT_FULL:
+      step_nodes<false, false>(in, out, params, first, end);
+      break;
+    case MORPH_FORMAT_COMPACT:
+      step_nodes<true, false>(in, out, params, first, end);
+      break;
+    case MORPH_FORMAT_COMPACT_HALF:
+      step_nodes<true, true>(in, out, params, first, end);
+      break;
+    default:
+      assert(false);
+  }
+}
+
+void morph_cpu_sim_run(MorphCpuSim& sim, int num_iters) {
+  size_t num_nodes = sim.node_sets[sim.cur_set].size();
+  uint32_t num_chunks = (uint32_t)
+    ((num_nodes + MORPH_CPU_CHUNK_SIZE - 1) / MORPH_CPU_CHUNK_SIZE);
+  for (int iter = 0; iter < num_iters; ++iter) {
+    const MorphNodeBuffers& in = sim.node_sets[sim.cur_set];
+    MorphNodeBuffers& out = sim.node_sets[1 - sim.cur_set];
+    if (num_chunks > 0) {
+      thread_pool_run(*sim.threads, num_chunks,
+          [&](uint32_t chunk, uint32_t) {
+            size_t first = (size_t) chunk * MORPH_CPU_CHUNK_SIZE;
+            size_t end = std::min(first + MORPH_CPU_CHUNK_SIZE, num_nodes);
+            morph_cpu_sim_step(in, out, sim.user_params, first, end);
+          });
+    }
+    sim.cur_set = 1 - sim.cur_set;
+    sim.iter_num += 1;
+  }
+}
+
+void run_morph_cpu_pipeline(MorphCpuSim& sim, MorphControls& controls) {
+  auto start_init_data = chrono::steady_clock::now();
+  ivec2 zygote_samples(controls.num_zygote_samples);
+  MorphShapeFn shape = morph_shape_fn((MorphShape) controls.zygote_shape);
+  MorphOrdering ordering = (MorphOrdering) controls.ordering;
+  vector<uint32_t> indices;
+  size_t num_nodes = morph_zygote_num_nodes(zygote_samples);
+  assert(num_nodes <= max_morph_nodes(sim.format));
+  if (ordering == MORPH_ORDER_NONE) {
+    morph_cpu_sim_write_zygote(sim, zygote_samples, shape, indices);
+  } else {
+    MorphNodes node_vecs;
+    gen_morph_zygote(zygote_samples, shape, node_vecs, indices, sim.threads);
+    reorder_morph_nodes(node_vecs, indices, ordering, controls.log_locality);
+    morph_cpu_sim_write_nodes(sim, node_vecs);
+  }
+  if (controls.log_input_nodes) {
+    printf("input nodes:\n");
+    log_nodes(morph_cpu_sim_read_nodes(sim));
+  }
+  auto end_init_data = chrono::steady_clock::now();
+
+  auto start_sim = chrono::steady_clock::now();
+  int iters_left = controls.num_iters;
+  while (iters_left > 0) {
+    int num_iters = controls.reorder_interval > 0 ?
+      std::min(controls.reorder_interval, iters_left) : iters_left;
+    morph_cpu_sim_run(sim, num_iters);
+    iters_left -= num_iters;
+    if (iters_left > 0) {
+      morph_cpu_sim_reorder(sim, indices, ordering, controls.log_locality);
+    }
+  }
+  auto end_sim = chrono::steady_clock::now();
+
+  if (controls.log_durations) {
+    chrono::duration<double, milli> init_data_duration =
+      end_init_data - start_init_data;
+    chrono::duration<double, milli> sim_duration = end_sim - start_sim;
+    printf("init data: %.2fms\ncpu sim: %.2fms (%d iters, %lu nodes, "
+        "%u threads, %s format)\n", init_data_duration.count(),
+        sim_duration.count(), controls.num_iters, num_nodes,
+        thread_pool_size(*sim.threads), morph_format_name(sim.format));
+  }
+  if (controls.log_output_nodes) {
+    printf("output nodes:\n");
+    log_nodes(morph_cpu_sim_read_nodes(sim));
+  }
+}
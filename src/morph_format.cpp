@@ -0,0 +1,164 @@
+#include "morph_format.h"
+
+#include <cassert>
+#include <cstring>
+
+const char* morph_format_name(MorphNodeFormat format) {
+  switch (format) {
+    case MORPH_FORMAT_FULL: return "full";
+    case MORPH_FORMAT_COMPACT: return "compact";
+    case MORPH_FORMAT_COMPACT_HALF: return "compact half";
+    default: return "unknown";
+  }
+}
+
+array<uint32_t, MORPH_BUF_COUNT> morph_buffer_strides(
+    MorphNodeFormat format) {
+  // pos, vel, neighbors, data
+  switch (format) {
+    case MORPH_FORMAT_COMPACT: return {{12, 12, 16, 4}};
+    case MORPH_FORMAT_COMPACT_HALF: return {{12, 8, 16, 4}};
+    default: return {{16, 16, 16, 16}};
+  }
+}
+
+uint32_t morph_bytes_per_node(MorphNodeFormat format) {
+  uint32_t num_bytes = 0;
+  for (uint32_t stride : morph_buffer_strides(format)) {
+    num_bytes += stride;
+  }
+  return num_bytes;
+}
+
+size_t max_morph_nodes(MorphNodeFormat format) {
+  return MORPH_NODE_BUDGET / morph_bytes_per_node(format);
+}
+
+array<void*, MORPH_BUF_COUNT> MorphNodeBuffers::ptrs() {
+  return {{
+    bufs[0].data(), bufs[1].data(), bufs[2].data(), bufs[3].data()
+  }};
+}
+
+array<const void*, MORPH_BUF_COUNT> MorphNodeBuffers::ptrs() const {
+  return {{
+    bufs[0].data(), bufs[1].data(), bufs[2].data(), bufs[3].data()
+  }};
+}
+
+void resize_morph_buffers(MorphNodeBuffers& buffers, MorphNodeFormat format,
+    size_t num_nodes) {
+  array<uint32_t, MORPH_BUF_COUNT> strides = morph_buffer_strides(format);
+  buffers.format = format;
+  buffers.num_nodes = num_nodes;
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    size_t num_bytes = num_nodes * strides[i];
+    buffers.bufs[i].resize((num_bytes + sizeof(uvec4) - 1) / sizeof(uvec4));
+  }
+}
+
+// xyz, the w of the unpacked vec4 is zero
+static void pack_xyz(const vec4* src, packed_vec3* dst, size_t num_nodes) {
+  for (size_t i = 0; i < num_nodes; ++i) {
+    dst[i] = packed_vec3(vec3(src[i]));
+  }
+}
+
+static void unpack_xyz(const packed_vec3* src, vec4* dst, size_t num_nodes) {
+  for (size_t i = 0; i < num_nodes; ++i) {
+    dst[i] = vec4(vec3(src[i]), 0.0f);
+  }
+}
+
+// xyz as halves, the fourth half is zero
+static void pack_half_xyz(const vec4* src, uvec2* dst, size_t num_nodes) {
+  for (size_t i = 0; i < num_nodes; ++i) {
+    dst[i] = uvec2(packHalf2x16(vec2(src[i].x, src[i].y)),
+        packHalf2x16(vec2(src[i].z, 0.0f)));
+  }
+}
+
+static void unpack_half_xyz(const uvec2* src, vec4* dst, size_t num_nodes) {
+  for (size_t i = 0; i < num_nodes; ++i) {
+    dst[i] = vec4(unpackHalf2x16(src[i].x), unpackHalf2x16(src[i].y).x,
+        0.0f);
+  }
+}
+
+void pack_morph_nodes(const MorphNodes& nodes, MorphNodeFormat format,
+    const array<void*, MORPH_BUF_COUNT>& dst) {
+  size_t num_nodes = nodes.size();
+  if (format == MORPH_FORMAT_FULL) {
+    size_t vec_bytes = num_nodes * sizeof(vec4);
+    memcpy(dst[0], nodes.pos_vec.data(), vec_bytes);
+    memcpy(dst[1], nodes.vel_vec.data(), vec_bytes);
+    memcpy(dst[2], nodes.neighbors_vec.data(), vec_bytes);
+    memcpy(dst[3], nodes.data_vec.data(), vec_bytes);
+    return;
+  }
+  pack_xyz(nodes.pos_vec.data(), static_cast<packed_vec3*>(dst[0]),
+      num_nodes);
+  if (format == MORPH_FORMAT_COMPACT_HALF) {
+    pack_half_xyz(nodes.vel_vec.data(), static_cast<uvec2*>(dst[1]),
+        num_nodes);
+  } else {
+    pack_xyz(nodes.vel_vec.data(), static_cast<packed_vec3*>(dst[1]),
+        num_nodes);
+  }
+  uvec4* neighbors = static_cast<uvec4*>(dst[2]);
+  float* data = static_cast<float*>(dst[3]);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    // -1 converts to MORPH_NO_NEIGHBOR
+    neighbors[i] = uvec4(ivec4(nodes.neighbors_vec[i]));
+    data[i] = nodes.data_vec[i].x;
+  }
+}
+
+void unpack_morph_buffer(const void* src, MorphNodeFormat format,
+    int buf_index, size_t num_nodes, vector<vec4>& out) {
+  out.resize(num_nodes);
+  if (format == MORPH_FORMAT_FULL) {
+    memcpy(out.data(), src, num_nodes * sizeof(vec4));
+    return;
+  }
+  switch (buf_index) {
+    case 0:
+      unpack_xyz(static_cast<const packed_vec3*>(src), out.data(),
+          num_nodes);
+      break;
+    case 1:
+      if (format == MORPH_FORMAT_COMPACT_HALF) {
+        unpack_half_xyz(static_cast<const uvec2*>(src), out.data(),
+            num_nodes);
+      } else {
+        unpack_xyz(static_cast<const packed_vec3*>(src), out.data(),
+            num_nodes);
+      }
+      break;
+    case 2: {
+      const uvec4* neighbors = static_cast<const uvec4*>(src);
+      for (size_t i = 0; i < num_nodes; ++i) {
+        out[i] = vec4(ivec4(neighbors[i]));
+      }
+      break;
+    }
+    default: {
+      const float* data = static_cast<const float*>(src);
+      for (size_t i = 0; i < num_nodes; ++i) {
+        out[i] = vec4(data[i], 0.0f, 0.0f, 0.0f);
+      }
+    }
+  }
+}
+
+void unpack_morph_nodes(const array<const void*, MORPH_BUF_COUNT>& src,
+    MorphNodeFormat format, size_t num_nodes, MorphNodes& out_nodes) {
+  out_nodes = MorphNodes();
+  array<vector<vec4>*, MORPH_BUF_COUNT> outs = {{
+    &out_nodes.pos_vec, &out_nodes.vel_vec, &out_nodes.neighbors_vec,
+    &out_nodes.data_vec
+  }};
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    unpack_morph_buffer(src[i], format, i, num_nodes, *outs[i]);
+  }
+}
@@ -0,0 +1,274 @@
+#include "morph_readback.h"
+
+#include <cassert>
+#include <limits>
+
+static void consumer_loop(MorphReadback& readback) {
+  while (true) {
+    uint32_t slot_index;
+    {
+      unique_lock<mutex> guard(readback.lock);
+      readback.ready_cv.wait(guard, [&] {
+        return readback.stopping || !readback.ready.empty();
+      });
+      if (readback.ready.empty()) {
+        return;
+      }
+      slot_index = readback.ready.front();
+      readback.ready.pop_front();
+    }
+
+    MorphReadbackSlot& slot = *readback.slots[slot_index];
+    MorphReadbackResult result;
+    result.iter_num = slot.iter_num;
+    result.buf_mask = slot.buf_mask;
+    array<vector<vec4>*, MORPH_BUF_COUNT> outs = {{
+      &result.nodes.pos_vec, &result.nodes.vel_vec,
+      &result.nodes.neighbors_vec, &result.nodes.data_vec
+    }};
+    const char* mapped = static_cast<const char*>(slot.buffer_mem.mapped);
+    for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+      if (slot.buf_mask & (1 << i)) {
+        unpack_morph_buffer(mapped + i * slot.capacity * sizeof(vec4),
+            slot.format, i, slot.num_nodes, *outs[i]);
+      }
+    }
+    // the slot can take the next copy while the consumer works
+    {
+      lock_guard<mutex> guard(readback.lock);
+      slot.state = MORPH_SLOT_FREE;
+    }
+    readback.free_cv.notify_all();
+
+    if (readback.consume) {
+      readback.consume(result);
+    }
+    readback.num_delivered += 1;
+  }
+}
+
+void init_morph_readback(MorphReadback& readback, MemAllocator& allocator,
+    uint32_t queue_family_index, VkQueue queue, uint32_t num_slots,
+    const MorphReadbackFn& consume) {
+  readback.allocator = &allocator;
+  readback.device = allocator.device;
+  readback.queue = queue;
+  readback.consume = consume;
+
+  VkCommandPoolCreateInfo cmd_pool_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .pNext = nullptr,
+    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = queue_family_index
+  };
+  VkResult res = vkCreateCommandPool(readback.device, &cmd_pool_info,
+      nullptr, &readback.cmd_pool);
+  assert(res == VK_SUCCESS);
+
+  for (uint32_t i = 0; i < num_slots; ++i) {
+    unique_ptr<MorphReadbackSlot> slot(new MorphReadbackSlot());
+    VkCommandBufferAllocateInfo cmd_buffer_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = readback.cmd_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1
+    };
+    res = vkAllocateCommandBuffers(readback.device, &cmd_buffer_info,
+        &slot->cmd_buffer);
+    assert(res == VK_SUCCESS);
+    VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      .flags = 0
+    };
+    res = vkCreateFence(readback.device, &fence_info, nullptr, &slot->fence);
+    assert(res == VK_SUCCESS);
+    readback.slots.push_back(std::move(slot));
+  }
+
+  readback.consumer = thread(consumer_loop, std::ref(readback));
+}
+
+static void free_slot_buffer(MorphReadback& readback,
+    MorphReadbackSlot& slot) {
+  if (slot.buffer != VK_NULL_HANDLE) {
+    vkDestroyBuffer(readback.device, slot.buffer, nullptr);
+    free_mem(*readback.allocator, slot.buffer_mem);
+    slot.buffer = VK_NULL_HANDLE;
+    slot.capacity = 0;
+  }
+}
+
+void cleanup_morph_readback(MorphReadback& readback) {
+  for (auto& slot : readback.slots) {
+    if (slot->state == MORPH_SLOT_IN_FLIGHT) {
+      vkWaitForFences(readback.device, 1, &slot->fence, VK_TRUE,
+          std::numeric_limits<uint64_t>::max());
+    }
+  }
+  // deliver what finished, then let the consumer drain and exit
+  morph_readback_poll(readback);
+  {
+    lock_guard<mutex> guard(readback.lock);
+    readback.stopping = true;
+  }
+  readback.ready_cv.notify_all();
+  readback.consumer.join();
+
+  for (auto& slot : readback.slots) {
+    free_slot_buffer(readback, *slot);
+    vkDestroyFence(readback.device, slot->fence, nullptr);
+  }
+  vkDestroyCommandPool(readback.device, readback.cmd_pool, nullptr);
+  readback.slots.clear();
+  readback.ready.clear();
+  readback.cmd_pool = VK_NULL_HANDLE;
+  readback.stopping = false;
+}
+
+static void reserve_slot(MorphReadback& readback, MorphReadbackSlot& slot,
+    uint32_t num_nodes) {
+  if (num_nodes <= slot.capacity) {
+    return;
+  }
+  free_slot_buffer(readback, slot);
+  slot.capacity = num_nodes;
+  VkBufferCreateInfo buffer_info = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = MORPH_BUF_COUNT * num_nodes * sizeof(vec4),
+    .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  VkResult res = vkCreateBuffer(readback.device, &buffer_info, nullptr,
+      &slot.buffer);
+  assert(res == VK_SUCCESS);
+  VkMemoryRequirements mem_reqs;
+  vkGetBufferMemoryRequirements(readback.device, slot.buffer, &mem_reqs);
+  slot.buffer_mem = alloc_mem(*readback.allocator, mem_reqs,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MEM_TILING_LINEAR);
+  assert(slot.buffer_mem.mapped);
+  vkBindBufferMemory(readback.device, slot.buffer, slot.buffer_mem.mem,
+      slot.buffer_mem.offset);
+  release_empty_mem_blocks(*readback.allocator);
+}
+
+bool morph_readback_request(MorphReadback& readback, MorphSim& sim,
+    uint32_t buf_mask) {
+  readback.num_requested += 1;
+  morph_readback_poll(readback);
+  MorphReadbackSlot& slot = *readback.slots[readback.next_slot];
+  if (slot.state != MORPH_SLOT_FREE) {
+    readback.num_dropped += 1;
+    return false;
+  }
+  readback.next_slot = (readback.next_slot + 1) % readback.slots.size();
+
+  reserve_slot(readback, slot, std::max(sim.num_nodes, 1u));
+  slot.iter_num = sim.iter_num;
+  slot.num_nodes = sim.num_nodes;
+  slot.buf_mask = buf_mask & MORPH_READBACK_ALL;
+  slot.format = sim.format;
+
+  VkCommandBuffer cmd_buffer = slot.cmd_buffer;
+  VkResult res = vkResetCommandBuffer(cmd_buffer, 0);
+  assert(res == VK_SUCCESS);
+  VkCommandBufferBeginInfo begin_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+  };
+  res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+  assert(res == VK_SUCCESS);
+  VkMemoryBarrier compute_barrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+  };
+  vkCmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &compute_barrier, 0, nullptr,
+      0, nullptr);
+  array<uint32_t, MORPH_BUF_COUNT> strides = morph_buffer_strides(sim.format);
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    if (!(slot.buf_mask & (1 << i)) || sim.num_nodes == 0) {
+      continue;
+    }
+    VkBufferCopy copy_region = {
+      .srcOffset = 0,
+      .dstOffset = i * slot.capacity * sizeof(vec4),
+      .size = sim.num_nodes * strides[i]
+    };
+    vkCmdCopyBuffer(cmd_buffer, sim.buffer_sets[sim.cur_set].buffers[i],
+        slot.buffer, 1, &copy_region);
+  }
+  VkMemoryBarrier host_barrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_HOST_READ_BIT
+  };
+  vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier, 0, nullptr,
+      0, nullptr);
+  // later sim work on the same queue overwrites the copied set, and must
+  // not start before the copies have read it
+  VkMemoryBarrier sim_barrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+  };
+  vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0, 1, &sim_barrier, 0, nullptr, 0, nullptr);
+  res = vkEndCommandBuffer(cmd_buffer);
+  assert(res == VK_SUCCESS);
+
+  VkSubmitInfo submit_info = {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &cmd_buffer
+  };
+  res = vkQueueSubmit(readback.queue, 1, &submit_info, slot.fence);
+  assert(res == VK_SUCCESS);
+  slot.state = MORPH_SLOT_IN_FLIGHT;
+  return true;
+}
+
+void morph_readback_poll(MorphReadback& readback) {
+  bool any_ready = false;
+  // slots are used round robin, so next_slot holds the oldest copy
+  uint32_t num_slots = (uint32_t) readback.slots.size();
+  for (uint32_t n = 0; n < num_slots; ++n) {
+    uint32_t i = (readback.next_slot + n) % num_slots;
+    MorphReadbackSlot& slot = *readback.slots[i];
+    if (slot.state != MORPH_SLOT_IN_FLIGHT) {
+      continue;
+    }
+    // keep deliveries in request order
+    if (vkGetFenceStatus(readback.device, slot.fence) != VK_SUCCESS) {
+      break;
+    }
+    vkResetFences(readback.device, 1, &slot.fence);
+    slot.state = MORPH_SLOT_CONSUMING;
+    lock_guard<mutex> guard(readback.lock);
+    readback.ready.push_back(i);
+    any_ready = true;
+  }
+  if (any_ready) {
+    readback.ready_cv.notify_one();
+  }
+}
+
+void morph_readback_wait(MorphReadback& readback) {
+  MorphReadbackSlot& slot = *readback.slots[readback.next_slot];
+  if (slot.state == MORPH_SLOT_IN_FLIGHT) {
+    VkResult res = vkWaitForFences(readback.device, 1, &slot.fence, VK_TRUE,
+        std::numeric_limits<uint64_t>::max());
+    assert(res == VK_SUCCESS);
+    // the slot holds the oldest copy, so this delivers it
+    morph_readback_poll(readback);
+  }
+  unique_lock<mutex> guard(readback.lock);
+  readback.free_cv.wait(guard, [&] {
+    return slot.state == MORPH_SLOT_FREE;
+  });
+}
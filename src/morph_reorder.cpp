@@ -0,0 +1,293 @@
+#include "morph_reorder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <deque>
+
+const char* morph_ordering_name(MorphOrdering ordering) {
+  switch (ordering) {
+    case MORPH_ORDER_NONE: return "none";
+    case MORPH_ORDER_MORTON: return "morton";
+    case MORPH_ORDER_RCM: return "rcm";
+    default: return "unknown";
+  }
+}
+
+// A small set-associative LRU cache of line addresses
+struct CacheModel {
+  static const uint32_t line_size = 64;
+  static const uint32_t num_sets = 64;
+  static const uint32_t num_ways = 8;
+  array<array<uint64_t, num_ways>, num_sets> tags;
+  array<array<uint64_t, num_ways>, num_sets> last_use;
+  uint64_t clock = 0;
+  uint64_t num_accesses = 0;
+  uint64_t num_misses = 0;
+
+  CacheModel() {
+    for (auto& set : tags) {
+      set.fill(~0ull);
+    }
+    for (auto& set : last_use) {
+      set.fill(0);
+    }
+  }
+
+  void access(uint64_t addr) {
+    uint64_t line = addr / line_size;
+    uint32_t set = line % num_sets;
+    num_accesses += 1;
+    clock += 1;
+    uint32_t victim = 0;
+    for (uint32_t way = 0; way < num_ways; ++way) {
+      if (tags[set][way] == line) {
+        last_use[set][way] = clock;
+        return;
+      }
+      if (last_use[set][way] < last_use[set][victim]) {
+        victim = way;
+      }
+    }
+    num_misses += 1;
+    tags[set][victim] = line;
+    last_use[set][victim] = clock;
+  }
+};
+
+MorphLocality measure_morph_locality(const MorphNodes& nodes) {
+  MorphLocality locality;
+  size_t num_nodes = nodes.size();
+  if (num_nodes == 0) {
+    return locality;
+  }
+  CacheModel cache;
+  uint64_t sum_distance = 0;
+  uint64_t num_neighbors = 0;
+  uint64_t sum_group_lines = 0;
+  vector<uint64_t> group_lines;
+  for (size_t group = 0; group < num_nodes; group += MORPH_WORKGROUP_SIZE) {
+    size_t group_end = std::min(group + MORPH_WORKGROUP_SIZE, num_nodes);
+    group_lines.clear();
+    for (size_t i = group; i < group_end; ++i) {
+      cache.access(i * sizeof(vec4));
+      group_lines.push_back(i * sizeof(vec4) / CacheModel::line_size);
+      for (int n = 0; n < 4; ++n) {
+        int neighbor = (int) nodes.neighbors_vec[i][n];
+        if (neighbor < 0) {
+          continue;
+        }
+        cache.access(neighbor * sizeof(vec4));
+        group_lines.push_back(neighbor * sizeof(vec4) /
+            CacheModel::line_size);
+        uint32_t distance = (uint32_t) std::abs(neighbor - (int) i);
+        sum_distance += distance;
+        num_neighbors += 1;
+        locality.max_neighbor_distance =
+          std::max(locality.max_neighbor_distance, distance);
+      }
+    }
+    std::sort(group_lines.begin(), group_lines.end());
+    sum_group_lines += std::unique(group_lines.begin(), group_lines.end()) -
+      group_lines.begin();
+  }
+  size_t num_groups =
+    (num_nodes + MORPH_WORKGROUP_SIZE - 1) / MORPH_WORKGROUP_SIZE;
+  locality.mean_neighbor_distance = num_neighbors > 0 ?
+    (double) sum_distance / num_neighbors : 0.0;
+  locality.cache_miss_rate = (double) cache.num_misses / cache.num_accesses;
+  locality.lines_per_group = (double) sum_group_lines / num_groups;
+  return locality;
+}
+
+void log_morph_locality(const char* label, const MorphLocality& locality) {
+  printf("%s: neighbor distance mean %.1f max %u, L1 model miss rate "
+      "%.2f%%, %.1f lines per %u-node group\n", label,
+      locality.mean_neighbor_distance, locality.max_neighbor_distance,
+      100.0 * locality.cache_miss_rate, locality.lines_per_group,
+      MORPH_WORKGROUP_SIZE);
+}
+
+// Spreads the low 10 bits of v so that there are two zero bits between
+// each of them
+static uint32_t spread_bits(uint32_t v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+static vector<uint32_t> morton_order(const MorphNodes& nodes) {
+  size_t num_nodes = nodes.size();
+  vec3 lo(std::numeric_limits<float>::max());
+  vec3 hi(-std::numeric_limits<float>::max());
+  for (const vec4& pos : nodes.pos_vec) {
+    lo = min(lo, vec3(pos));
+    hi = max(hi, vec3(pos));
+  }
+  vec3 scale = 1023.0f / max(hi - lo, vec3(1e-20f));
+
+  vector<pair<uint32_t, uint32_t>> codes(num_nodes);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    uvec3 q = uvec3(clamp((vec3(nodes.pos_vec[i]) - lo) * scale, 0.0f,
+          1023.0f));
+    uint32_t code = spread_bits(q.x) | (spread_bits(q.y) << 1) |
+      (spread_bits(q.z) << 2);
+    codes[i] = make_pair(code, (uint32_t) i);
+  }
+  // ties keep their current order
+  std::stable_sort(codes.begin(), codes.end(),
+      [](const pair<uint32_t, uint32_t>& a,
+        const pair<uint32_t, uint32_t>& b) { return a.first < b.first; });
+  vector<uint32_t> order(num_nodes);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    order[i] = codes[i].second;
+  }
+  return order;
+}
+
+static int node_degree(const MorphNodes& nodes, uint32_t i) {
+  int degree = 0;
+  for (int n = 0; n < 4; ++n) {
+    degree += nodes.neighbors_vec[i][n] >= 0.0f ? 1 : 0;
+  }
+  return degree;
+}
+
+static vector<uint32_t> rcm_order(const MorphNodes& nodes) {
+  uint32_t num_nodes = (uint32_t) nodes.size();
+  vector<uint32_t> order;
+  order.reserve(num_nodes);
+  vector<bool> visited(num_nodes, false);
+  deque<uint32_t> queue;
+  array<uint32_t, 4> adj;
+
+  // one breadth-first pass per connected component, each starting from a
+  // node of lowest degree
+  vector<uint32_t> starts(num_nodes);
+  for (uint32_t i = 0; i < num_nodes; ++i) {
+    starts[i] = i;
+  }
+  std::stable_sort(starts.begin(), starts.end(),
+      [&](uint32_t a, uint32_t b) {
+        return node_degree(nodes, a) < node_degree(nodes, b);
+      });
+  for (uint32_t start : starts) {
+    if (visited[start]) {
+      continue;
+    }
+    visited[start] = true;
+    queue.push_back(start);
+    while (!queue.empty()) {
+      uint32_t i = queue.front();
+      queue.pop_front();
+      order.push_back(i);
+      int num_adj = 0;
+      for (int n = 0; n < 4; ++n) {
+        int neighbor = (int) nodes.neighbors_vec[i][n];
+        if (neighbor >= 0 && !visited[neighbor]) {
+          visited[neighbor] = true;
+          adj[num_adj++] = (uint32_t) neighbor;
+        }
+      }
+      std::sort(adj.begin(), adj.begin() + num_adj,
+          [&](uint32_t a, uint32_t b) {
+            return node_degree(nodes, a) < node_degree(nodes, b);
+          });
+      queue.insert(queue.end(), adj.begin(), adj.begin() + num_adj);
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+vector<uint32_t> compute_morph_order(const MorphNodes& nodes,
+    MorphOrdering ordering) {
+  switch (ordering) {
+    case MORPH_ORDER_MORTON:
+      return morton_order(nodes);
+    case MORPH_ORDER_RCM:
+      return rcm_order(nodes);
+    default: {
+      vector<uint32_t> order(nodes.size());
+      for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = (uint32_t) i;
+      }
+      return order;
+    }
+  }
+}
+
+void apply_morph_order(const vector<uint32_t>& order, MorphNodes& nodes,
+    vector<uint32_t>& indices) {
+  size_t num_nodes = nodes.size();
+  assert(order.size() == num_nodes);
+  vector<uint32_t> new_index(num_nodes);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    new_index[order[i]] = (uint32_t) i;
+  }
+
+  MorphNodes reordered(num_nodes);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    uint32_t old = order[i];
+    reordered.pos_vec[i] = nodes.pos_vec[old];
+    reordered.vel_vec[i] = nodes.vel_vec[old];
+    reordered.data_vec[i] = nodes.data_vec[old];
+    vec4 neighbors = nodes.neighbors_vec[old];
+    for (int n = 0; n < 4; ++n) {
+      if (neighbors[n] >= 0.0f) {
+        neighbors[n] = (float) new_index[(uint32_t) neighbors[n]];
+      }
+    }
+    reordered.neighbors_vec[i] = neighbors;
+  }
+  nodes = std::move(reordered);
+
+  for (uint32_t& index : indices) {
+    index = new_index[index];
+  }
+}
+
+void reorder_morph_nodes(MorphNodes& nodes, vector<uint32_t>& indices,
+    MorphOrdering ordering, bool log) {
+  if (ordering == MORPH_ORDER_NONE) {
+    return;
+  }
+  if (log) {
+    log_morph_locality("before reorder", measure_morph_locality(nodes));
+  }
+  apply_morph_order(compute_morph_order(nodes, ordering), nodes, indices);
+  if (log) {
+    char label[64];
+    snprintf(label, sizeof(label), "after %s reorder",
+        morph_ordering_name(ordering));
+    log_morph_locality(label, measure_morph_locality(nodes));
+  }
+}
+
+void morph_sim_reorder(MorphSim& sim, vector<uint32_t>& indices,
+    MorphOrdering ordering, bool log) {
+  if (ordering == MORPH_ORDER_NONE) {
+    return;
+  }
+  int iter_num = sim.iter_num;
+  MorphNodes node_vecs = morph_sim_read_nodes(sim);
+  reorder_morph_nodes(node_vecs, indices, ordering, log);
+  morph_sim_write_nodes(sim, node_vecs);
+  morph_sim_write_indices(sim, indices);
+  sim.iter_num = iter_num;
+}
+
+void morph_cpu_sim_reorder(MorphCpuSim& sim, vector<uint32_t>& indices,
+    MorphOrdering ordering, bool log) {
+  if (ordering == MORPH_ORDER_NONE) {
+    return;
+  }
+  int iter_num = sim.iter_num;
+  MorphNodes node_vecs = morph_cpu_sim_read_nodes(sim);
+  reorder_morph_nodes(node_vecs, indices, ordering, log);
+  morph_cpu_sim_write_nodes(sim, node_vecs);
+  sim.iter_num = iter_num;
+}
@@ -0,0 +1,669 @@
+#include "morph_sim.h"
+#include "morph_reorder.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+const char* morph_shader_path(MorphNodeFormat format) {
+  return format == MORPH_FORMAT_FULL ? "../shaders/morph.spv" :
+    "../shaders/morph_compact.spv";
+}
+
+static VkPipeline create_compute_pipeline(VkDevice device,
+    VkPipelineCache pipeline_cache, VkPipelineLayout layout,
+    const string& shader_path, const VkSpecializationInfo& spec_info) {
+  VkShaderModule module = load_shader_module(device, shader_path);
+  VkComputePipelineCreateInfo pipeline_info = {
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+      .module = module,
+      .pName = "main",
+      .pSpecializationInfo = &spec_info
+    },
+    .layout = layout,
+    .basePipelineHandle = VK_NULL_HANDLE,
+    .basePipelineIndex = -1
+  };
+  VkPipeline pipeline;
+  VkResult res = vkCreateComputePipelines(device, pipeline_cache, 1,
+      &pipeline_info, nullptr, &pipeline);
+  assert(res == VK_SUCCESS);
+  vkDestroyShaderModule(device, module, nullptr);
+  return pipeline;
+}
+
+// Storage buffer bindings 0 to num_bindings - 1, and a pipeline layout
+// with push constants of push_size bytes
+static void create_compute_layouts(VkDevice device, uint32_t num_bindings,
+    uint32_t push_size, VkDescriptorSetLayout& desc_set_layout,
+    VkPipelineLayout& pipeline_layout) {
+  vector<VkDescriptorSetLayoutBinding> bindings(num_bindings);
+  for (uint32_t i = 0; i < bindings.size(); ++i) {
+    bindings[i] = {
+      .binding = i,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .pImmutableSamplers = nullptr
+    };
+  }
+  VkDescriptorSetLayoutCreateInfo layout_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = (uint32_t) bindings.size(),
+    .pBindings = bindings.data()
+  };
+  VkResult res = vkCreateDescriptorSetLayout(device, &layout_info,
+      nullptr, &desc_set_layout);
+  assert(res == VK_SUCCESS);
+
+  VkPushConstantRange push_range = {
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .offset = 0,
+    .size = push_size
+  };
+  VkPipelineLayoutCreateInfo pipeline_layout_info = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &desc_set_layout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &push_range
+  };
+  res = vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr,
+      &pipeline_layout);
+  assert(res == VK_SUCCESS);
+}
+
+void init_morph_sim(MorphSim& sim, MemAllocator& allocator,
+    uint32_t queue_family_index, VkQueue queue,
+    VkPipelineCache pipeline_cache, const string& shader_path,
+    const string& zygote_shader_path, MorphNodeFormat format) {
+  sim.allocator = &allocator;
+  sim.device = allocator.device;
+  sim.queue = queue;
+  sim.format = format;
+  sim.user_params = default_morph_params();
+
+  // a compute-only queue rejects barriers naming graphics stages, so the
+  // draw reads are only synchronized on a queue that can draw
+  uint32_t num_families = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(allocator.phys_device,
+      &num_families, nullptr);
+  vector<VkQueueFamilyProperties> family_props(num_families);
+  vkGetPhysicalDeviceQueueFamilyProperties(allocator.phys_device,
+      &num_families, family_props.data());
+  assert(queue_family_index < num_families);
+  sim.read_stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+    VK_PIPELINE_STAGE_TRANSFER_BIT;
+  sim.read_access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+  if (family_props[queue_family_index].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+    sim.read_stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    sim.read_access |= VK_ACCESS_INDEX_READ_BIT |
+      VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+  }
+
+  // bindings 0-3 are read, 4-7 are written
+  create_compute_layouts(sim.device, 2 * MORPH_BUF_COUNT,
+      sizeof(MorphSimParams), sim.desc_set_layout, sim.pipeline_layout);
+  // bindings 0-3 are the nodes, 4 the indices
+  create_compute_layouts(sim.device, MORPH_BUF_COUNT + 1,
+      sizeof(MorphZygoteParams), sim.zygote_desc_set_layout,
+      sim.zygote_pipeline_layout);
+
+  // HALF_PRECISION and COMPACT. morph.comp has no constants and
+  // morph_compact.comp only the first, the rest are ignored.
+  array<VkBool32, 2> spec_data = {{
+    format == MORPH_FORMAT_COMPACT_HALF, format != MORPH_FORMAT_FULL
+  }};
+  array<VkSpecializationMapEntry, 2> spec_entries;
+  for (uint32_t i = 0; i < spec_entries.size(); ++i) {
+    spec_entries[i] = {
+      .constantID = i,
+      .offset = i * (uint32_t) sizeof(VkBool32),
+      .size = sizeof(VkBool32)
+    };
+  }
+  VkSpecializationInfo spec_info = {
+    .mapEntryCount = (uint32_t) spec_entries.size(),
+    .pMapEntries = spec_entries.data(),
+    .dataSize = sizeof(spec_data),
+    .pData = spec_data.data()
+  };
+  sim.pipeline = create_compute_pipeline(sim.device, pipeline_cache,
+      sim.pipeline_layout, shader_path, spec_info);
+  sim.zygote_pipeline = create_compute_pipeline(sim.device, pipeline_cache,
+      sim.zygote_pipeline_layout, zygote_shader_path, spec_info);
+
+  VkDescriptorPoolSize pool_size = {
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    2 * 2 * MORPH_BUF_COUNT + MORPH_BUF_COUNT + 1
+  };
+  VkDescriptorPoolCreateInfo desc_pool_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .maxSets = 3,
+    .poolSizeCount = 1,
+    .pPoolSizes = &pool_size
+  };
+  VkResult res = vkCreateDescriptorPool(sim.device, &desc_pool_info, nullptr,
+      &sim.desc_pool);
+  assert(res == VK_SUCCESS);
+  array<VkDescriptorSetLayout, 2> set_layouts = {{
+    sim.desc_set_layout, sim.desc_set_layout
+  }};
+  VkDescriptorSetAllocateInfo desc_set_alloc_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    .descriptorPool = sim.desc_pool,
+    .descriptorSetCount = (uint32_t) set_layouts.size(),
+    .pSetLayouts = set_layouts.data()
+  };
+  res = vkAllocateDescriptorSets(sim.device, &desc_set_alloc_info,
+      sim.desc_sets.data());
+  assert(res == VK_SUCCESS);
+  VkDescriptorSetAllocateInfo zygote_desc_set_alloc_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    .descriptorPool = sim.desc_pool,
+    .descriptorSetCount = 1,
+    .pSetLayouts = &sim.zygote_desc_set_layout
+  };
+  res = vkAllocateDescriptorSets(sim.device, &zygote_desc_set_alloc_info,
+      &sim.zygote_desc_set);
+  assert(res == VK_SUCCESS);
+
+  VkCommandPoolCreateInfo cmd_pool_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .pNext = nullptr,
+    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = queue_family_index
+  };
+  res = vkCreateCommandPool(sim.device, &cmd_pool_info, nullptr,
+      &sim.cmd_pool);
+  assert(res == VK_SUCCESS);
+  VkCommandBufferAllocateInfo cmd_buffer_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = sim.cmd_pool,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1
+  };
+  res = vkAllocateCommandBuffers(sim.device, &cmd_buffer_info,
+      &sim.cmd_buffer);
+  assert(res == VK_SUCCESS);
+  VkFenceCreateInfo fence_info = {
+    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    .flags = 0
+  };
+  res = vkCreateFence(sim.device, &fence_info, nullptr, &sim.fence);
+  assert(res == VK_SUCCESS);
+}
+
+static void free_sim_buffers(MorphSim& sim) {
+  for (MorphBufferSet& set : sim.buffer_sets) {
+    for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+      vkDestroyBuffer(sim.device, set.buffers[i], nullptr);
+      free_mem(*sim.allocator, set.buffers_mem[i]);
+    }
+  }
+  vkDestroyBuffer(sim.device, sim.index_buffer, nullptr);
+  free_mem(*sim.allocator, sim.index_buffer_mem);
+  sim.index_buffer = VK_NULL_HANDLE;
+  vkDestroyBuffer(sim.device, sim.host_buffer, nullptr);
+  free_mem(*sim.allocator, sim.host_buffer_mem);
+  sim.host_buffer = VK_NULL_HANDLE;
+  sim.max_nodes = 0;
+}
+
+void cleanup_morph_sim(MorphSim& sim) {
+  if (sim.max_nodes > 0) {
+    free_sim_buffers(sim);
+  }
+  vkDestroyFence(sim.device, sim.fence, nullptr);
+  vkDestroyCommandPool(sim.device, sim.cmd_pool, nullptr);
+  vkDestroyDescriptorPool(sim.device, sim.desc_pool, nullptr);
+  vkDestroyPipeline(sim.device, sim.zygote_pipeline, nullptr);
+  vkDestroyPipelineLayout(sim.device, sim.zygote_pipeline_layout, nullptr);
+  vkDestroyDescriptorSetLayout(sim.device, sim.zygote_desc_set_layout,
+      nullptr);
+  vkDestroyPipeline(sim.device, sim.pipeline, nullptr);
+  vkDestroyPipelineLayout(sim.device, sim.pipeline_layout, nullptr);
+  vkDestroyDescriptorSetLayout(sim.device, sim.desc_set_layout, nullptr);
+  sim = MorphSim();
+}
+
+static void create_sim_buffer(MorphSim& sim, VkDeviceSize size,
+    VkBufferUsageFlags usage, VkMemoryPropertyFlags props,
+    VkBuffer& buffer, MemAlloc& buffer_mem) {
+  VkBufferCreateInfo buffer_info = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  VkResult res = vkCreateBuffer(sim.device, &buffer_info, nullptr, &buffer);
+  assert(res == VK_SUCCESS);
+  VkMemoryRequirements mem_reqs;
+  vkGetBufferMemoryRequirements(sim.device, buffer, &mem_reqs);
+  buffer_mem = alloc_mem(*sim.allocator, mem_reqs, props, MEM_TILING_LINEAR);
+  vkBindBufferMemory(sim.device, buffer, buffer_mem.mem, buffer_mem.offset);
+}
+
+void morph_sim_reserve(MorphSim& sim, uint32_t num_nodes) {
+  if (num_nodes <= sim.max_nodes) {
+    return;
+  }
+  uint32_t max_num_nodes = (uint32_t) max_morph_nodes(sim.format);
+  assert(num_nodes <= max_num_nodes);
+  if (sim.max_nodes > 0) {
+    // readback copies are submitted to the sim's queue without waiting,
+    // and may still be reading the old buffers
+    VkResult res = vkQueueWaitIdle(sim.queue);
+    assert(res == VK_SUCCESS);
+    free_sim_buffers(sim);
+  }
+  // grow geometrically so that slowly growing sample counts do not
+  // reallocate every time
+  sim.max_nodes = std::max(num_nodes, std::min(2 * sim.max_nodes,
+        max_num_nodes));
+
+  array<uint32_t, MORPH_BUF_COUNT> strides = morph_buffer_strides(sim.format);
+  VkDeviceSize region_size = sim.max_nodes * sizeof(vec4);
+  for (MorphBufferSet& set : sim.buffer_sets) {
+    for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+      create_sim_buffer(sim, sim.max_nodes * strides[i],
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+          set.buffers[i], set.buffers_mem[i]);
+    }
+  }
+  // a grid of n nodes has fewer than n quads
+  create_sim_buffer(sim, MORPH_INDICES_PER_NODE * sim.max_nodes *
+        sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      sim.index_buffer, sim.index_buffer_mem);
+  create_sim_buffer(sim, MORPH_BUF_COUNT * region_size,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      sim.host_buffer, sim.host_buffer_mem);
+  assert(sim.host_buffer_mem.mapped);
+  // the old buffers' blocks are only reused while they fit the new ones
+  release_empty_mem_blocks(*sim.allocator);
+
+  // point each set's reads at its own buffers and its writes at the other's
+  for (uint32_t s = 0; s < 2; ++s) {
+    array<VkDescriptorBufferInfo, 2 * MORPH_BUF_COUNT> buffer_infos;
+    for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+      buffer_infos[i] = {sim.buffer_sets[s].buffers[i], 0, VK_WHOLE_SIZE};
+      buffer_infos[MORPH_BUF_COUNT + i] =
+        {sim.buffer_sets[1 - s].buffers[i], 0, VK_WHOLE_SIZE};
+    }
+    VkWriteDescriptorSet desc_write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = sim.desc_sets[s],
+      .dstBinding = 0,
+      .dstArrayElement = 0,
+      .descriptorCount = (uint32_t) buffer_infos.size(),
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pImageInfo = nullptr,
+      .pBufferInfo = buffer_infos.data(),
+      .pTexelBufferView = nullptr
+    };
+    vkUpdateDescriptorSets(sim.device, 1, &desc_write, 0, nullptr);
+  }
+  // the zygote is generated into the first set
+  array<VkDescriptorBufferInfo, MORPH_BUF_COUNT + 1> zygote_buffer_infos;
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    zygote_buffer_infos[i] =
+      {sim.buffer_sets[0].buffers[i], 0, VK_WHOLE_SIZE};
+  }
+  zygote_buffer_infos[MORPH_BUF_COUNT] = {sim.index_buffer, 0, VK_WHOLE_SIZE};
+  VkWriteDescriptorSet zygote_desc_write = {
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = sim.zygote_desc_set,
+    .dstBinding = 0,
+    .dstArrayElement = 0,
+    .descriptorCount = (uint32_t) zygote_buffer_infos.size(),
+    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    .pImageInfo = nullptr,
+    .pBufferInfo = zygote_buffer_infos.data(),
+    .pTexelBufferView = nullptr
+  };
+  vkUpdateDescriptorSets(sim.device, 1, &zygote_desc_write, 0, nullptr);
+  sim.num_nodes = 0;
+  sim.num_indices = 0;
+  sim.cur_set = 0;
+  sim.iter_num = 0;
+}
+
+static VkCommandBuffer begin_sim_cmds(MorphSim& sim) {
+  VkResult res = vkResetCommandBuffer(sim.cmd_buffer, 0);
+  assert(res == VK_SUCCESS);
+  VkCommandBufferBeginInfo begin_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+  };
+  res = vkBeginCommandBuffer(sim.cmd_buffer, &begin_info);
+  assert(res == VK_SUCCESS);
+  return sim.cmd_buffer;
+}
+
+static void submit_sim_cmds_and_wait(MorphSim& sim) {
+  VkResult res = vkEndCommandBuffer(sim.cmd_buffer);
+  assert(res == VK_SUCCESS);
+  VkSubmitInfo submit_info = {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &sim.cmd_buffer
+  };
+  res = vkQueueSubmit(sim.queue, 1, &submit_info, sim.fence);
+  assert(res == VK_SUCCESS);
+  vkWaitForFences(sim.device, 1, &sim.fence, VK_TRUE,
+      std::numeric_limits<uint64_t>::max());
+  vkResetFences(sim.device, 1, &sim.fence);
+}
+
+static void record_memory_barrier(VkCommandBuffer cmd_buffer,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access,
+    VkPipelineStageFlags dst_stage, VkAccessFlags dst_access) {
+  VkMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = src_access,
+    .dstAccessMask = dst_access
+  };
+  vkCmdPipelineBarrier(cmd_buffer, src_stage, dst_stage, 0,
+      1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+static array<void*, MORPH_BUF_COUNT> mapped_regions(MorphSim& sim) {
+  VkDeviceSize region_size = sim.max_nodes * sizeof(vec4);
+  char* host_data = static_cast<char*>(sim.host_buffer_mem.mapped);
+  array<void*, MORPH_BUF_COUNT> regions;
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    regions[i] = host_data + i * region_size;
+  }
+  return regions;
+}
+
+// Copies num_nodes from the host buffer into the first buffer set and
+// makes them the new state
+static void upload_host_nodes(MorphSim& sim, uint32_t num_nodes) {
+  VkDeviceSize region_size = sim.max_nodes * sizeof(vec4);
+  array<uint32_t, MORPH_BUF_COUNT> strides = morph_buffer_strides(sim.format);
+  VkCommandBuffer cmd_buffer = begin_sim_cmds(sim);
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    VkDeviceSize num_bytes = num_nodes * strides[i];
+    VkBufferCopy copy_region = {
+      .srcOffset = i * region_size,
+      .dstOffset = 0,
+      .size = num_bytes
+    };
+    if (num_bytes > 0) {
+      vkCmdCopyBuffer(cmd_buffer, sim.host_buffer,
+          sim.buffer_sets[0].buffers[i], 1, &copy_region);
+    }
+  }
+  record_memory_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+  submit_sim_cmds_and_wait(sim);
+
+  sim.num_nodes = num_nodes;
+  sim.cur_set = 0;
+  sim.iter_num = 0;
+}
+
+void morph_sim_write_nodes(MorphSim& sim, MorphNodes& node_vecs) {
+  uint32_t num_nodes = (uint32_t) node_vecs.size();
+  morph_sim_reserve(sim, num_nodes);
+  pack_morph_nodes(node_vecs, sim.format, mapped_regions(sim));
+  upload_host_nodes(sim, num_nodes);
+}
+
+void morph_sim_write_zygote(MorphSim& sim, ivec2 samples, MorphShapeFn shape,
+    vector<uint32_t>& out_indices) {
+  uint32_t num_nodes = (uint32_t) morph_zygote_num_nodes(samples);
+  morph_sim_reserve(sim, num_nodes);
+  out_indices.resize(morph_zygote_num_indices(samples));
+  gen_morph_zygote(samples, shape, sim.format, mapped_regions(sim),
+      out_indices.data(), sim.threads);
+  upload_host_nodes(sim, num_nodes);
+  morph_sim_write_indices(sim, out_indices);
+}
+
+void morph_sim_write_indices(MorphSim& sim, const vector<uint32_t>& indices) {
+  VkDeviceSize num_bytes = indices.size() * sizeof(uint32_t);
+  assert(indices.size() <= MORPH_INDICES_PER_NODE * sim.max_nodes);
+  sim.num_indices = (uint32_t) indices.size();
+  if (num_bytes == 0) {
+    return;
+  }
+  memcpy(sim.host_buffer_mem.mapped, indices.data(), num_bytes);
+  VkCommandBuffer cmd_buffer = begin_sim_cmds(sim);
+  VkBufferCopy copy_region = {
+    .srcOffset = 0,
+    .dstOffset = 0,
+    .size = num_bytes
+  };
+  vkCmdCopyBuffer(cmd_buffer, sim.host_buffer, sim.index_buffer, 1,
+      &copy_region);
+  record_memory_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+      sim.read_stages, sim.read_access);
+  submit_sim_cmds_and_wait(sim);
+}
+
+void record_morph_zygote(MorphSim& sim, VkCommandBuffer cmd_buffer,
+    ivec2 samples, MorphShape shape) {
+  uint32_t num_nodes = (uint32_t) morph_zygote_num_nodes(samples);
+  assert(num_nodes <= sim.max_nodes);
+  sim.num_nodes = num_nodes;
+  sim.num_indices = (uint32_t) morph_zygote_num_indices(samples);
+  sim.cur_set = 0;
+  sim.iter_num = 0;
+  if (num_nodes == 0) {
+    return;
+  }
+  MorphZygoteParams params = {};
+  params.samples = samples;
+  params.shape = (int32_t) shape;
+  vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+      sim.zygote_pipeline);
+  vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+      sim.zygote_pipeline_layout, 0, 1, &sim.zygote_desc_set, 0, nullptr);
+  vkCmdPushConstants(cmd_buffer, sim.zygote_pipeline_layout,
+      VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+  vkCmdDispatch(cmd_buffer,
+      (samples.x + MORPH_ZYGOTE_TILE_SIZE - 1) / MORPH_ZYGOTE_TILE_SIZE,
+      (samples.y + MORPH_ZYGOTE_TILE_SIZE - 1) / MORPH_ZYGOTE_TILE_SIZE, 1);
+  record_memory_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+      sim.read_stages, sim.read_access);
+}
+
+void morph_sim_gen_zygote(MorphSim& sim, ivec2 samples, MorphShape shape) {
+  morph_sim_reserve(sim, (uint32_t) morph_zygote_num_nodes(samples));
+  record_morph_zygote(sim, begin_sim_cmds(sim), samples, shape);
+  submit_sim_cmds_and_wait(sim);
+}
+
+vector<uint32_t> morph_sim_read_indices(MorphSim& sim) {
+  vector<uint32_t> indices(sim.num_indices);
+  VkDeviceSize num_bytes = indices.size() * sizeof(uint32_t);
+  if (num_bytes == 0) {
+    return indices;
+  }
+  VkCommandBuffer cmd_buffer = begin_sim_cmds(sim);
+  VkBufferCopy copy_region = {
+    .srcOffset = 0,
+    .dstOffset = 0,
+    .size = num_bytes
+  };
+  vkCmdCopyBuffer(cmd_buffer, sim.index_buffer, sim.host_buffer, 1,
+      &copy_region);
+  record_memory_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+  submit_sim_cmds_and_wait(sim);
+  memcpy(indices.data(), sim.host_buffer_mem.mapped, num_bytes);
+  return indices;
+}
+
+MorphNodes morph_sim_read_nodes(MorphSim& sim) {
+  MorphNodes node_vecs;
+  if (sim.num_nodes == 0) {
+    return node_vecs;
+  }
+  VkDeviceSize region_size = sim.max_nodes * sizeof(vec4);
+  array<uint32_t, MORPH_BUF_COUNT> strides = morph_buffer_strides(sim.format);
+
+  VkCommandBuffer cmd_buffer = begin_sim_cmds(sim);
+  record_memory_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    VkBufferCopy copy_region = {
+      .srcOffset = 0,
+      .dstOffset = i * region_size,
+      .size = sim.num_nodes * strides[i]
+    };
+    vkCmdCopyBuffer(cmd_buffer, sim.buffer_sets[sim.cur_set].buffers[i],
+        sim.host_buffer, 1, &copy_region);
+  }
+  record_memory_barrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+  submit_sim_cmds_and_wait(sim);
+
+  const char* host_data =
+    static_cast<const char*>(sim.host_buffer_mem.mapped);
+  array<const void*, MORPH_BUF_COUNT> host_regions;
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    host_regions[i] = host_data + i * region_size;
+  }
+  unpack_morph_nodes(host_regions, sim.format, sim.num_nodes, node_vecs);
+  return node_vecs;
+}
+
+void record_morph_iters(MorphSim& sim, VkCommandBuffer cmd_buffer,
+    int num_iters) {
+  if (sim.num_nodes == 0) {
+    // nothing to simulate, but keep the count consistent
+    sim.iter_num += std::max(num_iters, 0);
+    return;
+  }
+  MorphSimParams params = {};
+  params.num_nodes = (int32_t) sim.num_nodes;
+  for (int i = 0; i < MORPH_NUM_USER_PARAMS; ++i) {
+    params.user[i] = sim.user_params[i];
+  }
+  uint32_t num_groups =
+    (sim.num_nodes + MORPH_WORKGROUP_SIZE - 1) / MORPH_WORKGROUP_SIZE;
+
+  vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+      sim.pipeline);
+  for (int i = 0; i < num_iters; ++i) {
+    params.iter_num = sim.iter_num;
+    vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        sim.pipeline_layout, 0, 1, &sim.desc_sets[sim.cur_set], 0, nullptr);
+    vkCmdPushConstants(cmd_buffer, sim.pipeline_layout,
+        VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+    vkCmdDispatch(cmd_buffer, num_groups, 1, 1);
+    // the next iteration reads what this one wrote, and overwrites what
+    // this one read
+    record_memory_barrier(cmd_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+    sim.cur_set = 1 - sim.cur_set;
+    sim.iter_num += 1;
+  }
+}
+
+void morph_sim_run(MorphSim& sim, int num_iters) {
+  if (num_iters <= 0) {
+    return;
+  }
+  if (sim.num_nodes == 0) {
+    sim.iter_num += num_iters;
+    return;
+  }
+  VkCommandBuffer cmd_buffer = begin_sim_cmds(sim);
+  record_morph_iters(sim, cmd_buffer, num_iters);
+  submit_sim_cmds_and_wait(sim);
+}
+
+void run_morph_pipeline(MorphSim& sim, MorphControls& controls) {
+  auto start_init_data = chrono::steady_clock::now();
+  ivec2 zygote_samples(controls.num_zygote_samples);
+  MorphShapeFn shape = morph_shape_fn((MorphShape) controls.zygote_shape);
+  MorphOrdering ordering = (MorphOrdering) controls.ordering;
+  vector<uint32_t> indices;
+  assert(morph_zygote_num_nodes(zygote_samples) <=
+      max_morph_nodes(sim.format));
+  if (ordering == MORPH_ORDER_NONE && controls.gpu_zygote) {
+    morph_sim_gen_zygote(sim, zygote_samples,
+        (MorphShape) controls.zygote_shape);
+    if (controls.log_render_data) {
+      indices = morph_sim_read_indices(sim);
+    }
+  } else if (ordering == MORPH_ORDER_NONE) {
+    // straight into the staging buffer
+    morph_sim_write_zygote(sim, zygote_samples, shape, indices);
+  } else {
+    MorphNodes node_vecs;
+    gen_morph_zygote(zygote_samples, shape, node_vecs, indices, sim.threads);
+    reorder_morph_nodes(node_vecs, indices, ordering, controls.log_locality);
+    morph_sim_write_nodes(sim, node_vecs);
+    morph_sim_write_indices(sim, indices);
+  }
+
+  // debug logging
+  if (controls.log_render_data) {
+    printf("\n\nindex data (%lu):\n", indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      ivec3 face(indices[i], indices[i + 1], indices[i + 2]);
+      printf("%4lu %s\n", i, glm::to_string(face).c_str());
+    }
+  }
+  if (controls.log_input_nodes) {
+    printf("input nodes:\n");
+    log_nodes(morph_sim_read_nodes(sim));
+  }
+  auto end_init_data = chrono::steady_clock::now();
+
+  auto start_sim = chrono::steady_clock::now();
+  int iters_left = controls.num_iters;
+  while (iters_left > 0) {
+    int num_iters = controls.reorder_interval > 0 ?
+      std::min(controls.reorder_interval, iters_left) : iters_left;
+    morph_sim_run(sim, num_iters);
+    iters_left -= num_iters;
+    if (iters_left > 0) {
+      morph_sim_reorder(sim, indices, ordering, controls.log_locality);
+    }
+  }
+  auto end_sim = chrono::steady_clock::now();
+
+  if (controls.log_durations) {
+    chrono::duration<double, milli> init_data_duration =
+      end_init_data - start_init_data;
+    chrono::duration<double, milli> sim_duration = end_sim - start_sim;
+    printf("init data: %.2fms\nsim: %.2fms (%d iters, %u nodes)\n",
+        init_data_duration.count(), sim_duration.count(), controls.num_iters,
+        sim.num_nodes);
+  }
+  if (controls.log_output_nodes) {
+    MorphNodes out_node_vecs = morph_sim_read_nodes(sim);
+    printf("output nodes:\n");
+    log_nodes(out_node_vecs);
+  }
+}
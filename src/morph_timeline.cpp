@@ -0,0 +1,108 @@
+#include "morph_timeline.h"
+#include "morph_reorder.h"
+
+#include <algorithm>
+#include <cassert>
+
+void init_morph_timeline(MorphTimeline& timeline, size_t mem_budget,
+    const string& spill_path) {
+  init_checkpoint_store(timeline.checkpoints, mem_budget, spill_path);
+}
+
+void cleanup_morph_timeline(MorphTimeline& timeline) {
+  cleanup_checkpoint_store(timeline.checkpoints);
+}
+
+void invalidate_morph_timeline(MorphTimeline& timeline) {
+  timeline.num_zygote_samples = -1;
+  timeline.live = false;
+  clear_checkpoint_store(timeline.checkpoints);
+  timeline.indices.clear();
+}
+
+static bool params_match(MorphTimeline& timeline, const MorphSim& sim,
+    const MorphControls& controls) {
+  return timeline.num_zygote_samples == controls.num_zygote_samples &&
+    timeline.user_params == sim.user_params &&
+    timeline.ordering == controls.ordering &&
+    timeline.zygote_shape == controls.zygote_shape &&
+    timeline.gpu_zygote == controls.gpu_zygote;
+}
+
+// The zygote is cheap to regenerate, so unlike later iterations it is not
+// checkpointed unless reordering makes it expensive
+static void restore_zygote(MorphTimeline& timeline, MorphSim& sim,
+    const MorphControls& controls) {
+  ivec2 zygote_samples(controls.num_zygote_samples);
+  MorphShapeFn shape = morph_shape_fn((MorphShape) controls.zygote_shape);
+  MorphOrdering ordering = (MorphOrdering) controls.ordering;
+  if (ordering == MORPH_ORDER_NONE && controls.gpu_zygote) {
+    morph_sim_gen_zygote(sim, zygote_samples,
+        (MorphShape) controls.zygote_shape);
+    timeline.indices.clear();
+    return;
+  }
+  if (ordering == MORPH_ORDER_NONE) {
+    morph_sim_write_zygote(sim, zygote_samples, shape, timeline.indices);
+    return;
+  }
+  MorphNodes node_vecs;
+  gen_morph_zygote(zygote_samples, shape, node_vecs, timeline.indices,
+      sim.threads);
+  reorder_morph_nodes(node_vecs, timeline.indices, ordering,
+      controls.log_locality);
+  morph_sim_write_nodes(sim, node_vecs);
+  morph_sim_write_indices(sim, timeline.indices);
+  checkpoint_store_put(timeline.checkpoints, 0, std::move(node_vecs));
+}
+
+void morph_timeline_seek(MorphTimeline& timeline, MorphSim& sim,
+    const MorphControls& controls, int target_iter) {
+  assert(target_iter >= 0);
+  timeline.last_iters_run = 0;
+  timeline.last_restored_iter = -1;
+  if (!params_match(timeline, sim, controls)) {
+    invalidate_morph_timeline(timeline);
+    timeline.num_zygote_samples = controls.num_zygote_samples;
+    timeline.user_params = sim.user_params;
+    timeline.ordering = controls.ordering;
+    timeline.zygote_shape = controls.zygote_shape;
+    timeline.gpu_zygote = controls.gpu_zygote;
+  }
+
+  // restore if the live state is unusable, or if a checkpoint is closer to
+  // the target than the live state
+  int checkpoint_iter = checkpoint_store_find(timeline.checkpoints,
+      target_iter);
+  bool live_usable = timeline.live && sim.iter_num <= target_iter;
+  if (!live_usable || checkpoint_iter > sim.iter_num) {
+    if (checkpoint_iter == -1) {
+      restore_zygote(timeline, sim, controls);
+      checkpoint_iter = 0;
+    } else {
+      morph_sim_write_nodes(sim,
+          checkpoint_store_get(timeline.checkpoints, checkpoint_iter));
+      sim.iter_num = checkpoint_iter;
+    }
+    timeline.live = true;
+    timeline.last_restored_iter = checkpoint_iter;
+  }
+
+  // advance in steps that end on checkpoint boundaries
+  int interval = std::max(timeline.checkpoint_interval, 1);
+  int loop_start = controls.loop_at_end ? controls.start_iter_num : -1;
+  while (sim.iter_num < target_iter) {
+    int next_checkpoint = (sim.iter_num / interval + 1) * interval;
+    if (sim.iter_num < loop_start && loop_start < next_checkpoint) {
+      next_checkpoint = loop_start;
+    }
+    int stop_iter = std::min(next_checkpoint, target_iter);
+    timeline.last_iters_run += stop_iter - sim.iter_num;
+    morph_sim_run(sim, stop_iter - sim.iter_num);
+    if (sim.iter_num == next_checkpoint &&
+        !checkpoint_store_has(timeline.checkpoints, sim.iter_num)) {
+      checkpoint_store_put(timeline.checkpoints, sim.iter_num,
+          morph_sim_read_nodes(sim));
+    }
+  }
+}
@@ -0,0 +1,501 @@
+#include "morph_trajectory.h"
+#include "byte_planes.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+const float QUANT_MAX = 65535.0f;
+
+static bool is_quantized(uint32_t flags, int buf_index) {
+  // neighbor indices must stay exact
+  return (flags & MORPH_TRAJ_QUANTIZE) && buf_index != 2;
+}
+
+static size_t word_size(uint32_t flags, int buf_index) {
+  return is_quantized(flags, buf_index) ? sizeof(uint16_t) :
+    sizeof(uint32_t);
+}
+
+static uint32_t num_chunks(uint32_t num_nodes, uint32_t chunk_nodes) {
+  return (num_nodes + chunk_nodes - 1) / chunk_nodes;
+}
+
+static uint32_t num_buffers(uint32_t buf_mask) {
+  uint32_t count = 0;
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    count += (buf_mask >> i) & 1;
+  }
+  return count;
+}
+
+static array<vector<vec4>*, MORPH_BUF_COUNT> node_arrays(MorphNodes& nodes) {
+  return {{
+    &nodes.pos_vec, &nodes.vel_vec, &nodes.neighbors_vec, &nodes.data_vec
+  }};
+}
+
+// Fills words with the 16-bit fixed point of values over each chunk's
+// range, and ranges with a (min, extent) pair per chunk
+static void quantize(const vector<vec4>& values, uint32_t chunk_nodes,
+    vector<uint8_t>& words, vector<vec4>& ranges) {
+  uint32_t num_nodes = (uint32_t) values.size();
+  uint16_t* out = reinterpret_cast<uint16_t*>(words.data());
+  ranges.resize(2 * num_chunks(num_nodes, chunk_nodes));
+  for (uint32_t first = 0; first < num_nodes; first += chunk_nodes) {
+    uint32_t end = std::min(first + chunk_nodes, num_nodes);
+    vec4 lo = values[first];
+    vec4 hi = values[first];
+    for (uint32_t i = first; i < end; ++i) {
+      lo = min(lo, values[i]);
+      hi = max(hi, values[i]);
+    }
+    vec4 extent = hi - lo;
+    vec4 scale = QUANT_MAX / max(extent, vec4(1e-30f));
+    for (uint32_t i = first; i < end; ++i) {
+      vec4 q = clamp(round((values[i] - lo) * scale), 0.0f, QUANT_MAX);
+      for (int c = 0; c < 4; ++c) {
+        out[4 * i + c] = (uint16_t) q[c];
+      }
+    }
+    ranges[2 * (first / chunk_nodes)] = lo;
+    ranges[2 * (first / chunk_nodes) + 1] = extent;
+  }
+}
+
+static void dequantize(const vector<uint8_t>& words,
+    const vector<vec4>& ranges, uint32_t num_nodes, uint32_t chunk_nodes,
+    vector<vec4>& values) {
+  const uint16_t* in = reinterpret_cast<const uint16_t*>(words.data());
+  values.resize(num_nodes);
+  for (uint32_t i = 0; i < num_nodes; ++i) {
+    uint32_t chunk = i / chunk_nodes;
+    vec4 q(in[4 * i], in[4 * i + 1], in[4 * i + 2], in[4 * i + 3]);
+    values[i] = ranges[2 * chunk] + q * (ranges[2 * chunk + 1] / QUANT_MAX);
+  }
+}
+
+static void write_frame(MorphTrajectoryWriter& writer, int iter_num,
+    MorphNodes& nodes) {
+  uint32_t num_nodes = (uint32_t) nodes.size();
+  bool keyframe = !(writer.flags & MORPH_TRAJ_DELTA) ||
+    writer.index.size() % MORPH_TRAJ_KEYFRAME_INTERVAL == 0 ||
+    num_nodes != writer.prev_num_nodes;
+
+  array<vector<uint8_t>, MORPH_BUF_COUNT> words;
+  array<vector<vec4>, MORPH_BUF_COUNT> ranges;
+  array<vector<vec4>*, MORPH_BUF_COUNT> arrays = node_arrays(nodes);
+  for (int b = 0; b < MORPH_BUF_COUNT; ++b) {
+    if (!(writer.buf_mask & (1 << b))) {
+      continue;
+    }
+    words[b].resize(num_nodes * 4 * word_size(writer.flags, b));
+    if (is_quantized(writer.flags, b)) {
+      quantize(*arrays[b], MORPH_TRAJ_CHUNK_NODES, words[b], ranges[b]);
+    } else if (num_nodes > 0) {
+      memcpy(words[b].data(), arrays[b]->data(), words[b].size());
+    }
+  }
+
+  uint32_t chunks = num_chunks(num_nodes, MORPH_TRAJ_CHUNK_NODES);
+  vector<uint32_t> chunk_sizes;
+  chunk_sizes.reserve(chunks * num_buffers(writer.buf_mask));
+  vector<uint8_t> body;
+  vector<uint8_t> delta;
+  for (uint32_t c = 0; c < chunks; ++c) {
+    uint32_t first = c * MORPH_TRAJ_CHUNK_NODES;
+    uint32_t count = std::min(MORPH_TRAJ_CHUNK_NODES, num_nodes - first);
+    for (int b = 0; b < MORPH_BUF_COUNT; ++b) {
+      if (!(writer.buf_mask & (1 << b))) {
+        continue;
+      }
+      size_t chunk_start = body.size();
+      if (is_quantized(writer.flags, b)) {
+        const uint8_t* range =
+          reinterpret_cast<const uint8_t*>(&ranges[b][2 * c]);
+        body.insert(body.end(), range, range + 2 * sizeof(vec4));
+      }
+      size_t ws = word_size(writer.flags, b);
+      size_t offset = first * 4 * ws;
+      size_t num_bytes = count * 4 * ws;
+      const uint8_t* chunk_words = words[b].data() + offset;
+      if (!keyframe) {
+        delta.resize(num_bytes);
+        const uint8_t* prev = writer.prev_words[b].data() + offset;
+        for (size_t i = 0; i < num_bytes; ++i) {
+          delta[i] = chunk_words[i] ^ prev[i];
+        }
+        chunk_words = delta.data();
+      }
+      encode_byte_planes(chunk_words, count * 4, ws, body);
+      chunk_sizes.push_back((uint32_t) (body.size() - chunk_start));
+    }
+  }
+  writer.prev_words = std::move(words);
+  writer.prev_num_nodes = num_nodes;
+
+  MorphTrajFrameHeader header = {
+    MORPH_TRAJ_FRAME_MAGIC, iter_num, num_nodes,
+    keyframe ? MORPH_TRAJ_KEYFRAME : 0u,
+    chunk_sizes.size() * sizeof(uint32_t) + body.size()
+  };
+  writer.file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  writer.file.write(reinterpret_cast<const char*>(chunk_sizes.data()),
+      chunk_sizes.size() * sizeof(uint32_t));
+  writer.file.write(reinterpret_cast<const char*>(body.data()), body.size());
+  if (!writer.file.good()) {
+    printf("failed to write trajectory frame %d\n", iter_num);
+    writer.file.clear();
+    writer.file.seekp(writer.file_end);
+    // the next frame must not be a delta against this one
+    writer.prev_num_nodes = ~0u;
+    writer.num_dropped += 1;
+    return;
+  }
+
+  MorphTrajIndexEntry entry = {iter_num, header.flags, writer.file_end};
+  writer.index.push_back(entry);
+  uint64_t frame_size = sizeof(header) + header.payload_size;
+  writer.file_end += frame_size;
+  writer.num_written += 1;
+  writer.file_bytes += frame_size;
+  for (int b = 0; b < MORPH_BUF_COUNT; ++b) {
+    if (writer.buf_mask & (1 << b)) {
+      writer.raw_bytes += num_nodes * sizeof(vec4);
+    }
+  }
+}
+
+static void writer_loop(MorphTrajectoryWriter& writer) {
+  while (true) {
+    pair<int, MorphNodes> frame;
+    {
+      unique_lock<mutex> guard(writer.lock);
+      writer.pending_cv.wait(guard, [&] {
+        return writer.stopping || !writer.pending.empty();
+      });
+      if (writer.pending.empty()) {
+        return;
+      }
+      frame = std::move(writer.pending.front());
+      writer.pending.pop_front();
+    }
+    writer.space_cv.notify_all();
+    write_frame(writer, frame.first, frame.second);
+  }
+}
+
+static MorphTrajHeader make_header(const MorphTrajectoryWriter& writer,
+    uint64_t index_offset, uint32_t num_frames) {
+  MorphTrajHeader header = {
+    MORPH_TRAJ_MAGIC, MORPH_TRAJ_VERSION, writer.flags, writer.buf_mask,
+    MORPH_TRAJ_CHUNK_NODES, MORPH_TRAJ_KEYFRAME_INTERVAL, index_offset,
+    num_frames, 0
+  };
+  return header;
+}
+
+bool open_morph_trajectory(MorphTrajectoryWriter& writer, const string& path,
+    uint32_t flags, uint32_t buf_mask) {
+  assert(!writer.open);
+  // close joined the previous writer thread, so only appends can race
+  // with the reset below, and they check open under the lock
+  assert(!writer.writer.joinable());
+  writer.file.open(path, ios::out | ios::binary | ios::trunc);
+  if (!writer.file.is_open()) {
+    printf("failed to open trajectory file %s\n", path.c_str());
+    return false;
+  }
+  {
+    lock_guard<mutex> guard(writer.lock);
+    writer.flags = flags;
+    writer.buf_mask = buf_mask & ((1 << MORPH_BUF_COUNT) - 1);
+    writer.pending.clear();
+    writer.stopping = false;
+  }
+  writer.index.clear();
+  writer.prev_num_nodes = ~0u;
+  writer.num_written = 0;
+  writer.num_dropped = 0;
+  writer.raw_bytes = 0;
+
+  MorphTrajHeader header = make_header(writer, 0, 0);
+  writer.file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  writer.file_end = sizeof(header);
+  writer.file_bytes = sizeof(header);
+  writer.writer = thread(writer_loop, std::ref(writer));
+  writer.open = true;
+  return true;
+}
+
+static bool queue_frame(MorphTrajectoryWriter& writer, int iter_num,
+    MorphNodes&& nodes, bool wait) {
+  array<vector<vec4>*, MORPH_BUF_COUNT> arrays = node_arrays(nodes);
+  {
+    // open and buf_mask change under the lock, so a frame is never queued
+    // for a file that is closing or checked against another file's mask
+    unique_lock<mutex> guard(writer.lock);
+    if (wait) {
+      writer.space_cv.wait(guard, [&] {
+        return !writer.open ||
+          writer.pending.size() < MORPH_TRAJ_MAX_PENDING;
+      });
+    }
+    if (!writer.open) {
+      return false;
+    }
+    for (int b = 0; b < MORPH_BUF_COUNT; ++b) {
+      if ((writer.buf_mask & (1 << b)) &&
+          arrays[b]->size() != nodes.size()) {
+        writer.num_dropped += 1;
+        return false;
+      }
+    }
+    if (writer.pending.size() >= MORPH_TRAJ_MAX_PENDING) {
+      writer.num_dropped += 1;
+      return false;
+    }
+    writer.pending.emplace_back(iter_num, std::move(nodes));
+  }
+  writer.pending_cv.notify_one();
+  return true;
+}
+
+bool morph_trajectory_append(MorphTrajectoryWriter& writer, int iter_num,
+    MorphNodes&& nodes) {
+  return queue_frame(writer, iter_num, std::move(nodes), false);
+}
+
+bool morph_trajectory_append_wait(MorphTrajectoryWriter& writer,
+    int iter_num, MorphNodes&& nodes) {
+  return queue_frame(writer, iter_num, std::move(nodes), true);
+}
+
+void close_morph_trajectory(MorphTrajectoryWriter& writer) {
+  {
+    lock_guard<mutex> guard(writer.lock);
+    if (!writer.open) {
+      return;
+    }
+    writer.open = false;
+    writer.stopping = true;
+  }
+  writer.pending_cv.notify_all();
+  writer.space_cv.notify_all();
+  writer.writer.join();
+
+  writer.file.seekp(writer.file_end);
+  writer.file.write(reinterpret_cast<const char*>(writer.index.data()),
+      writer.index.size() * sizeof(MorphTrajIndexEntry));
+  MorphTrajHeader header = make_header(writer, writer.file_end,
+      (uint32_t) writer.index.size());
+  writer.file.seekp(0);
+  writer.file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  writer.file.close();
+  writer.file_bytes += writer.index.size() * sizeof(MorphTrajIndexEntry);
+}
+
+bool open_morph_trajectory_reader(MorphTrajectoryReader& reader,
+    const string& path) {
+  reader = MorphTrajectoryReader();
+  if (!open_mapped_file(reader.file, path, FILE_ACCESS_RANDOM)) {
+    printf("failed to open trajectory file %s\n", path.c_str());
+    return false;
+  }
+  if (reader.file.size < sizeof(MorphTrajHeader)) {
+    printf("%s is not a trajectory file\n", path.c_str());
+    close_morph_trajectory_reader(reader);
+    return false;
+  }
+
+  memcpy(&reader.header, reader.file.data, sizeof(reader.header));
+  const MorphTrajHeader& header = reader.header;
+  if (header.magic != MORPH_TRAJ_MAGIC ||
+      header.version != MORPH_TRAJ_VERSION || header.chunk_nodes == 0) {
+    printf("%s is not a trajectory file\n", path.c_str());
+    close_morph_trajectory_reader(reader);
+    return false;
+  }
+
+  uint64_t index_size =
+    (uint64_t) header.num_frames * sizeof(MorphTrajIndexEntry);
+  if (header.index_offset != 0 &&
+      header.index_offset + index_size <= reader.file.size) {
+    reader.frames.resize(header.num_frames);
+    memcpy(reader.frames.data(), reader.file.data + header.index_offset,
+        index_size);
+    return true;
+  }
+
+  // never closed, walk the frame headers
+  uint64_t offset = sizeof(MorphTrajHeader);
+  while (offset + sizeof(MorphTrajFrameHeader) <= reader.file.size) {
+    MorphTrajFrameHeader frame;
+    memcpy(&frame, reader.file.data + offset, sizeof(frame));
+    uint64_t frame_end = offset + sizeof(frame) + frame.payload_size;
+    if (frame.magic != MORPH_TRAJ_FRAME_MAGIC ||
+        frame_end > reader.file.size) {
+      break;
+    }
+    MorphTrajIndexEntry entry = {frame.iter_num, frame.flags, offset};
+    reader.frames.push_back(entry);
+    offset = frame_end;
+  }
+  return true;
+}
+
+void close_morph_trajectory_reader(MorphTrajectoryReader& reader) {
+  close_mapped_file(reader.file);
+  reader = MorphTrajectoryReader();
+}
+
+int morph_trajectory_find(const MorphTrajectoryReader& reader, int iter_num) {
+  int found = -1;
+  for (size_t i = 0; i < reader.frames.size(); ++i) {
+    if (reader.frames[i].iter_num <= iter_num &&
+        (found == -1 || reader.frames[i].iter_num >=
+         reader.frames[found].iter_num)) {
+      found = (int) i;
+    }
+  }
+  return found;
+}
+
+// Decodes frame into reader.words and reader.ranges, on top of the
+// previous frame's words unless it is a keyframe
+static bool decode_frame(MorphTrajectoryReader& reader, size_t frame) {
+  reader.decoded_frame = -1;
+  const MorphTrajHeader& header = reader.header;
+  uint64_t offset = reader.frames[frame].offset;
+  MorphTrajFrameHeader frame_header;
+  if (offset + sizeof(frame_header) > reader.file.size) {
+    return false;
+  }
+  memcpy(&frame_header, reader.file.data + offset, sizeof(frame_header));
+  uint64_t payload_end = offset + sizeof(frame_header) +
+    frame_header.payload_size;
+  if (frame_header.magic != MORPH_TRAJ_FRAME_MAGIC ||
+      payload_end > reader.file.size) {
+    return false;
+  }
+  uint32_t num_nodes = frame_header.num_nodes;
+  bool keyframe = frame_header.flags & MORPH_TRAJ_KEYFRAME;
+  if (!keyframe && num_nodes != reader.decoded_num_nodes) {
+    return false;
+  }
+
+  uint32_t chunks = num_chunks(num_nodes, header.chunk_nodes);
+  uint64_t table_size = (uint64_t) chunks * num_buffers(header.buf_mask) *
+    sizeof(uint32_t);
+  const uint8_t* table = reader.file.data + offset + sizeof(frame_header);
+  const uint8_t* chunk_data = table + table_size;
+  const uint8_t* end = reader.file.data + payload_end;
+  if (chunk_data > end) {
+    return false;
+  }
+
+  for (int b = 0; b < MORPH_BUF_COUNT; ++b) {
+    if (header.buf_mask & (1 << b)) {
+      reader.words[b].resize(num_nodes * 4 * word_size(header.flags, b));
+      reader.ranges[b].resize(2 * chunks);
+    }
+  }
+  vector<uint8_t> chunk_words;
+  size_t table_index = 0;
+  for (uint32_t c = 0; c < chunks; ++c) {
+    uint32_t first = c * header.chunk_nodes;
+    uint32_t count = std::min(header.chunk_nodes, num_nodes - first);
+    for (int b = 0; b < MORPH_BUF_COUNT; ++b) {
+      if (!(header.buf_mask & (1 << b))) {
+        continue;
+      }
+      uint32_t chunk_size;
+      memcpy(&chunk_size, table + sizeof(uint32_t) * table_index++,
+          sizeof(chunk_size));
+      if (chunk_size > (size_t) (end - chunk_data)) {
+        return false;
+      }
+      const uint8_t* chunk = chunk_data;
+      size_t coded_size = chunk_size;
+      chunk_data += chunk_size;
+      if (is_quantized(header.flags, b)) {
+        if (coded_size < 2 * sizeof(vec4)) {
+          return false;
+        }
+        memcpy(&reader.ranges[b][2 * c], chunk, 2 * sizeof(vec4));
+        chunk += 2 * sizeof(vec4);
+        coded_size -= 2 * sizeof(vec4);
+      }
+
+      size_t ws = word_size(header.flags, b);
+      size_t num_bytes = count * 4 * ws;
+      chunk_words.resize(num_bytes);
+      if (decode_byte_planes(chunk, coded_size, count * 4, ws,
+            chunk_words.data()) != coded_size) {
+        return false;
+      }
+      uint8_t* words = reader.words[b].data() + first * 4 * ws;
+      if (keyframe) {
+        memcpy(words, chunk_words.data(), num_bytes);
+      } else {
+        for (size_t i = 0; i < num_bytes; ++i) {
+          words[i] ^= chunk_words[i];
+        }
+      }
+    }
+  }
+  reader.decoded_frame = (int) frame;
+  reader.decoded_num_nodes = num_nodes;
+  return true;
+}
+
+bool morph_trajectory_read(MorphTrajectoryReader& reader, size_t frame,
+    MorphNodes& out_nodes) {
+  if (frame >= reader.frames.size()) {
+    return false;
+  }
+  size_t keyframe = frame;
+  while (keyframe > 0 &&
+      !(reader.frames[keyframe].flags & MORPH_TRAJ_KEYFRAME)) {
+    --keyframe;
+  }
+  // continue from the last decoded frame when it is on the way
+  size_t start = keyframe;
+  if (reader.decoded_frame >= (int) keyframe &&
+      reader.decoded_frame <= (int) frame) {
+    start = (size_t) reader.decoded_frame + 1;
+  }
+  // the file is mapped for random access, so read the frames to decode
+  // ahead in one go
+  uint64_t range_end = frame + 1 < reader.frames.size() ?
+    reader.frames[frame + 1].offset : reader.file.size;
+  if (start <= frame && range_end > reader.frames[start].offset) {
+    advise_mapped_file(reader.file, reader.frames[start].offset,
+        range_end - reader.frames[start].offset);
+  }
+  for (size_t f = start; f <= frame; ++f) {
+    if (!decode_frame(reader, f)) {
+      return false;
+    }
+  }
+
+  const MorphTrajHeader& header = reader.header;
+  uint32_t num_nodes = reader.decoded_num_nodes;
+  out_nodes = MorphNodes();
+  array<vector<vec4>*, MORPH_BUF_COUNT> arrays = node_arrays(out_nodes);
+  for (int b = 0; b < MORPH_BUF_COUNT; ++b) {
+    if (!(header.buf_mask & (1 << b))) {
+      continue;
+    }
+    if (is_quantized(header.flags, b)) {
+      dequantize(reader.words[b], reader.ranges[b], num_nodes,
+          header.chunk_nodes, *arrays[b]);
+    } else {
+      arrays[b]->resize(num_nodes);
+      memcpy(arrays[b]->data(), reader.words[b].data(),
+          reader.words[b].size());
+    }
+  }
+  return true;
+}
@@ -0,0 +1,120 @@
+#include "morph_verify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Maps the float's bits to an integer line on which adjacent floats are
+// adjacent integers, with -0.0 and 0.0 both at zero
+static int64_t ordered_bits(float f) {
+  int32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits < 0 ? -(int64_t) (bits & 0x7fffffff) : (int64_t) bits;
+}
+
+MorphTolerance morph_tolerance_for(MorphNodeFormat format) {
+  MorphTolerance tol;
+  if (format == MORPH_FORMAT_COMPACT_HALF) {
+    // a few half ULPs, in float ULPs
+    tol.max_ulps = 4 << 13;
+    tol.abs_tol = 1e-3f;
+  }
+  return tol;
+}
+
+uint32_t ulp_distance(float a, float b) {
+  if (std::isnan(a) || std::isnan(b)) {
+    return std::numeric_limits<uint32_t>::max();
+  }
+  int64_t dist = ordered_bits(a) - ordered_bits(b);
+  dist = dist < 0 ? -dist : dist;
+  return (uint32_t) std::min(dist,
+      (int64_t) std::numeric_limits<uint32_t>::max());
+}
+
+MorphCompareResult compare_morph_nodes(const MorphNodes& nodes,
+    const MorphNodes& ref_nodes, const MorphTolerance& tol) {
+  MorphCompareResult result;
+  if (nodes.size() != ref_nodes.size()) {
+    result.sizes_match = false;
+    return result;
+  }
+  array<const vector<vec4>*, MORPH_BUF_COUNT> bufs = {{
+    &nodes.pos_vec, &nodes.vel_vec, &nodes.neighbors_vec, &nodes.data_vec
+  }};
+  array<const vector<vec4>*, MORPH_BUF_COUNT> ref_bufs = {{
+    &ref_nodes.pos_vec, &ref_nodes.vel_vec, &ref_nodes.neighbors_vec,
+    &ref_nodes.data_vec
+  }};
+  for (int b = 0; b < MORPH_BUF_COUNT; ++b) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      for (int c = 0; c < 4; ++c) {
+        float value = (*bufs[b])[i][c];
+        float ref_value = (*ref_bufs[b])[i][c];
+        uint32_t ulps = ulp_distance(value, ref_value);
+        float abs_err = std::fabs(value - ref_value);
+        result.num_values += 1;
+        if (ulps > tol.max_ulps && !(abs_err <= tol.abs_tol)) {
+          result.num_mismatches += 1;
+        }
+        if (ulps > result.max_ulps) {
+          result.max_ulps = ulps;
+          result.worst_node = i;
+          result.worst_buffer = b;
+        }
+        if (abs_err > result.max_abs_err) {
+          result.max_abs_err = abs_err;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+void log_compare_result(const MorphCompareResult& result) {
+  if (!result.sizes_match) {
+    printf("node counts differ\n");
+    return;
+  }
+  const char* buffer_names[MORPH_BUF_COUNT] = {
+    "pos", "vel", "neighbors", "data"
+  };
+  printf("%lu/%lu values out of tolerance, max %u ulps (%s of node %lu), "
+      "max abs err %g\n", result.num_mismatches, result.num_values,
+      result.max_ulps, buffer_names[result.worst_buffer], result.worst_node,
+      result.max_abs_err);
+}
+
+bool verify_morph_sim(MorphSim& sim, MorphCpuSim& cpu_sim,
+    const MorphControls& controls, const MorphTolerance& tol,
+    int check_interval) {
+  MorphNodes node_vecs;
+  vector<uint32_t> indices;
+  gen_morph_zygote(ivec2(controls.num_zygote_samples),
+      morph_shape_fn((MorphShape) controls.zygote_shape), node_vecs, indices,
+      cpu_sim.threads);
+  morph_sim_write_nodes(sim, node_vecs);
+  morph_cpu_sim_write_nodes(cpu_sim, node_vecs);
+  cpu_sim.user_params = sim.user_params;
+
+  check_interval = std::max(check_interval, 1);
+  while (sim.iter_num < controls.num_iters) {
+    int num_iters = std::min(check_interval,
+        controls.num_iters - sim.iter_num);
+    morph_sim_run(sim, num_iters);
+    morph_cpu_sim_run(cpu_sim, num_iters);
+    MorphCompareResult result = compare_morph_nodes(
+        morph_sim_read_nodes(sim), morph_cpu_sim_read_nodes(cpu_sim), tol);
+    if (!result.sizes_match || result.num_mismatches > 0) {
+      printf("gpu and cpu diverge by iteration %d: ", sim.iter_num);
+      log_compare_result(result);
+      return false;
+    }
+    if (sim.iter_num >= controls.num_iters) {
+      printf("gpu and cpu match after %d iterations: ", sim.iter_num);
+      log_compare_result(result);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,153 @@
+#include "morph_zygote.h"
+
+#include <algorithm>
+
+const char* morph_shape_name(MorphShape shape) {
+  switch (shape) {
+    case MORPH_SHAPE_PLANE: return "plane";
+    case MORPH_SHAPE_SQUARE: return "square";
+    case MORPH_SHAPE_SPHERE: return "sphere";
+    default: return "unknown";
+  }
+}
+
+MorphShapeFn morph_shape_fn(MorphShape shape) {
+  switch (shape) {
+    case MORPH_SHAPE_SQUARE: return gen_square;
+    case MORPH_SHAPE_SPHERE: return gen_sphere;
+    default: return gen_plane;
+  }
+}
+
+size_t morph_zygote_num_nodes(ivec2 samples) {
+  samples = max(samples, ivec2(0));
+  return (size_t) samples.x * samples.y;
+}
+
+size_t morph_zygote_num_indices(ivec2 samples) {
+  samples = max(samples, ivec2(1));
+  return 6 * (size_t) (samples.x - 1) * (samples.y - 1);
+}
+
+// The layout is a template parameter so that the row loop has no
+// per-node format branches
+template<bool COMPACT, bool HALF>
+static void gen_zygote_rows(ivec2 samples, MorphShapeFn shape,
+    const array<void*, MORPH_BUF_COUNT>& dst, uint32_t* out_indices,
+    int first_row, int end_row) {
+  vec2 unit_size = vec2(max(samples - 1, ivec2(1)));
+  for (int y = first_row; y < end_row; ++y) {
+    uint32_t row_start = (uint32_t) y * samples.x;
+    uint32_t* face_indices = out_indices +
+      (size_t) y * 6 * std::max(samples.x - 1, 0);
+    for (int x = 0; x < samples.x; ++x) {
+      uint32_t index = row_start + x;
+      vec3 pos = shape(vec2(x, y) / unit_size);
+      if (COMPACT) {
+        static_cast<packed_vec3*>(dst[0])[index] = packed_vec3(pos);
+      } else {
+        static_cast<vec4*>(dst[0])[index] = vec4(pos, 0.0f);
+      }
+
+      // right, up, left, down
+      bool has_right = x + 1 < samples.x;
+      bool has_up = y + 1 < samples.y;
+      uint32_t right = index + 1;
+      uint32_t up = index + samples.x;
+      uint32_t left = index - 1;
+      uint32_t down = index - samples.x;
+      if (COMPACT) {
+        static_cast<uvec4*>(dst[2])[index] = uvec4(
+            has_right ? right : MORPH_NO_NEIGHBOR,
+            has_up ? up : MORPH_NO_NEIGHBOR,
+            x > 0 ? left : MORPH_NO_NEIGHBOR,
+            y > 0 ? down : MORPH_NO_NEIGHBOR);
+      } else {
+        static_cast<vec4*>(dst[2])[index] = vec4(
+            has_right ? (float) right : -1.0f,
+            has_up ? (float) up : -1.0f,
+            x > 0 ? (float) left : -1.0f,
+            y > 0 ? (float) down : -1.0f);
+      }
+      if (HALF) {
+        static_cast<uvec2*>(dst[1])[index] = uvec2(0);
+      } else if (COMPACT) {
+        static_cast<packed_vec3*>(dst[1])[index] = packed_vec3(0.0f);
+      } else {
+        static_cast<vec4*>(dst[1])[index] = vec4(0.0f);
+      }
+      if (COMPACT) {
+        static_cast<float*>(dst[3])[index] = 0.0f;
+      } else {
+        static_cast<vec4*>(dst[3])[index] = vec4(0.0f);
+      }
+
+      // the lower-left vert of each quad emits its two triangles
+      if (has_right && has_up) {
+        uint32_t opposite = up + 1;
+        face_indices[0] = index;
+        face_indices[1] = right;
+        face_indices[2] = opposite;
+        face_indices[3] = index;
+        face_indices[4] = opposite;
+        face_indices[5] = up;
+        face_indices += 6;
+      }
+    }
+  }
+}
+
+static void gen_zygote_rows(ivec2 samples, MorphShapeFn shape,
+    MorphNodeFormat format, const array<void*, MORPH_BUF_COUNT>& dst,
+    uint32_t* out_indices, int first_row, int end_row) {
+  switch (format) {
+    case MORPH_FORMAT_COMPACT:
+      gen_zygote_rows<true, false>(samples, shape, dst, out_indices,
+          first_row, end_row);
+      break;
+    case MORPH_FORMAT_COMPACT_HALF:
+      gen_zygote_rows<true, true>(samples, shape, dst, out_indices,
+          first_row, end_row);
+      break;
+    default:
+      gen_zygote_rows<false, false>(samples, shape, dst, out_indices,
+          first_row, end_row);
+  }
+}
+
+void gen_morph_zygote(ivec2 samples, MorphShapeFn shape,
+    MorphNodeFormat format, const array<void*, MORPH_BUF_COUNT>& dst,
+    uint32_t* out_indices, ThreadPool* threads) {
+  if (morph_zygote_num_nodes(samples) == 0) {
+    return;
+  }
+  uint32_t num_tasks = (uint32_t)
+    ((samples.y + MORPH_ZYGOTE_ROWS_PER_TASK - 1) /
+     MORPH_ZYGOTE_ROWS_PER_TASK);
+  if (threads == nullptr || num_tasks == 1) {
+    gen_zygote_rows(samples, shape, format, dst, out_indices, 0, samples.y);
+    return;
+  }
+  thread_pool_run(*threads, num_tasks,
+      [&](uint32_t task, uint32_t) {
+        int first_row = (int) task * MORPH_ZYGOTE_ROWS_PER_TASK;
+        int end_row = std::min(first_row + MORPH_ZYGOTE_ROWS_PER_TASK,
+            samples.y);
+        gen_zygote_rows(samples, shape, format, dst, out_indices,
+            first_row, end_row);
+      });
+}
+
+void gen_morph_zygote(ivec2 samples, MorphShapeFn shape,
+    MorphNodes& out_nodes, vector<uint32_t>& out_indices,
+    ThreadPool* threads) {
+  size_t num_nodes = morph_zygote_num_nodes(samples);
+  out_nodes.pos_vec.resize(num_nodes);
+  out_nodes.vel_vec.resize(num_nodes);
+  out_nodes.neighbors_vec.resize(num_nodes);
+  out_nodes.data_vec.resize(num_nodes);
+  out_indices.resize(morph_zygote_num_indices(samples));
+  array<vec4*, MORPH_BUF_COUNT> bufs = out_nodes.buffers();
+  gen_morph_zygote(samples, shape, MORPH_FORMAT_FULL,
+      {{bufs[0], bufs[1], bufs[2], bufs[3]}}, out_indices.data(), threads);
+}
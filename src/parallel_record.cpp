@@ -0,0 +1,97 @@
+#include "parallel_record.h"
+
+#include <cassert>
+
+void init_parallel_recorder(ParallelRecorder& recorder, VkDevice device,
+    uint32_t queue_family_index, uint32_t num_frames, ThreadPool& threads) {
+  recorder.device = device;
+  recorder.threads = &threads;
+  recorder.num_frames = num_frames;
+
+  uint32_t num_threads = thread_pool_size(threads);
+  recorder.pools.resize(num_frames * num_threads);
+  for (RecordPool& pool : recorder.pools) {
+    // the pool is reset as a whole, so its buffers need no reset bit
+    VkCommandPoolCreateInfo cmd_pool_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .pNext = nullptr,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+      .queueFamilyIndex = queue_family_index
+    };
+    VkResult res = vkCreateCommandPool(device, &cmd_pool_info, nullptr,
+        &pool.cmd_pool);
+    assert(res == VK_SUCCESS);
+  }
+}
+
+void cleanup_parallel_recorder(ParallelRecorder& recorder) {
+  for (RecordPool& pool : recorder.pools) {
+    vkDestroyCommandPool(recorder.device, pool.cmd_pool, nullptr);
+  }
+  recorder.pools.clear();
+  recorder.recorded.clear();
+}
+
+// Hands out the next unused secondary of the pool, allocating one if needed
+static VkCommandBuffer next_cmd_buffer(VkDevice device, RecordPool& pool) {
+  if (pool.num_used == pool.cmd_buffers.size()) {
+    VkCommandBufferAllocateInfo cmd_buffer_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = pool.cmd_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+      .commandBufferCount = 1
+    };
+    VkCommandBuffer cmd_buffer;
+    VkResult res = vkAllocateCommandBuffers(device, &cmd_buffer_info,
+        &cmd_buffer);
+    assert(res == VK_SUCCESS);
+    pool.cmd_buffers.push_back(cmd_buffer);
+  }
+  return pool.cmd_buffers[pool.num_used++];
+}
+
+vector<VkCommandBuffer>& parallel_record(ParallelRecorder& recorder,
+    uint32_t frame_index, uint32_t num_chunks, VkRenderPass render_pass,
+    uint32_t subpass, const RecordChunkFn& record_chunk) {
+  assert(frame_index < recorder.num_frames);
+  uint32_t num_threads = thread_pool_size(*recorder.threads);
+  RecordPool* frame_pools = &recorder.pools[frame_index * num_threads];
+
+  // one reset per pool instead of one per command buffer
+  for (uint32_t i = 0; i < num_threads; ++i) {
+    VkResult res = vkResetCommandPool(recorder.device,
+        frame_pools[i].cmd_pool, 0);
+    assert(res == VK_SUCCESS);
+    frame_pools[i].num_used = 0;
+  }
+
+  recorder.recorded.resize(num_chunks);
+  VkDevice device = recorder.device;
+  vector<VkCommandBuffer>& recorded = recorder.recorded;
+  thread_pool_run(*recorder.threads, num_chunks,
+      [&](uint32_t chunk, uint32_t thread_index) {
+    VkCommandBuffer cmd_buffer = next_cmd_buffer(device,
+        frame_pools[thread_index]);
+
+    VkCommandBufferInheritanceInfo inheritance_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+      .renderPass = render_pass,
+      .subpass = subpass,
+      .framebuffer = VK_NULL_HANDLE
+    };
+    VkCommandBufferBeginInfo begin_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+        VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+      .pInheritanceInfo = &inheritance_info
+    };
+    VkResult res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+    assert(res == VK_SUCCESS);
+    record_chunk(cmd_buffer, chunk);
+    res = vkEndCommandBuffer(cmd_buffer);
+    assert(res == VK_SUCCESS);
+
+    recorded[chunk] = cmd_buffer;
+  });
+  return recorded;
+}
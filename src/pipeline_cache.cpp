@@ -0,0 +1,82 @@
+#include "pipeline_cache.h"
+#include "mapped_file.h"
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+
+// The version one header at the start of the cache data, as laid out in
+// the spec. The 1.1 headers do not declare a struct for it.
+struct PipelineCacheHeader {
+  uint32_t headerSize;
+  uint32_t headerVersion;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+static_assert(sizeof(PipelineCacheHeader) == 16 + VK_UUID_SIZE,
+    "the pipeline cache header has no padding");
+
+static bool is_cache_compatible(VkPhysicalDevice phys_device,
+    const MappedFile& data) {
+  PipelineCacheHeader header;
+  if (data.size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data.data, sizeof(header));
+
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(phys_device, &props);
+  return header.headerSize >= sizeof(header) &&
+    header.headerSize <= data.size &&
+    header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+    header.vendorID == props.vendorID &&
+    header.deviceID == props.deviceID &&
+    memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID,
+        VK_UUID_SIZE) == 0;
+}
+
+VkPipelineCache load_pipeline_cache(VkPhysicalDevice phys_device,
+    VkDevice device, const string& path, bool& out_warm) {
+  MappedFile data;
+  open_mapped_file(data, path, FILE_ACCESS_SEQUENTIAL);
+
+  out_warm = data.size > 0 && is_cache_compatible(phys_device, data);
+  if (data.size > 0 && !out_warm) {
+    printf("discarding incompatible pipeline cache %s\n", path.c_str());
+  }
+
+  VkPipelineCacheCreateInfo cache_info = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    .initialDataSize = out_warm ? data.size : 0,
+    .pInitialData = out_warm ? data.data : nullptr
+  };
+  VkPipelineCache cache;
+  VkResult res = vkCreatePipelineCache(device, &cache_info, nullptr, &cache);
+  assert(res == VK_SUCCESS);
+  close_mapped_file(data);
+  return cache;
+}
+
+void save_pipeline_cache(VkDevice device, VkPipelineCache cache,
+    const string& path) {
+  size_t size = 0;
+  VkResult res = vkGetPipelineCacheData(device, cache, &size, nullptr);
+  assert(res == VK_SUCCESS);
+  vector<char> data(size);
+  res = vkGetPipelineCacheData(device, cache, &size, data.data());
+  assert(res == VK_SUCCESS);
+
+  // write to a temp file first so a crash cannot leave a torn cache
+  string tmp_path = path + ".tmp";
+  ofstream file(tmp_path, ios::binary | ios::trunc);
+  file.write(data.data(), size);
+  file.close();
+  if (file.good()) {
+    rename(tmp_path.c_str(), path.c_str());
+  } else {
+    printf("failed to write pipeline cache %s\n", path.c_str());
+  }
+
+  vkDestroyPipelineCache(device, cache, nullptr);
+}
@@ -0,0 +1,92 @@
+#include "staging.h"
+
+#include <cassert>
+
+void init_staging_ring(StagingRing& ring, MemAllocator& allocator,
+    VkDeviceSize size) {
+  VkBufferCreateInfo buffer_info = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  VkResult res = vkCreateBuffer(allocator.device, &buffer_info, nullptr,
+      &ring.buffer);
+  assert(res == VK_SUCCESS);
+
+  VkMemoryRequirements mem_reqs;
+  vkGetBufferMemoryRequirements(allocator.device, ring.buffer, &mem_reqs);
+  ring.buffer_mem = alloc_mem(allocator, mem_reqs,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MEM_TILING_LINEAR);
+  vkBindBufferMemory(allocator.device, ring.buffer, ring.buffer_mem.mem,
+      ring.buffer_mem.offset);
+
+  ring.data = static_cast<char*>(ring.buffer_mem.mapped);
+  assert(ring.data);
+  ring.size = size;
+  ring.head = 0;
+  ring.used = 0;
+  ring.unsubmitted_bytes = 0;
+  ring.in_flight.clear();
+}
+
+void cleanup_staging_ring(StagingRing& ring, MemAllocator& allocator) {
+  if (!ring.in_flight.empty()) {
+    printf("WARNING staging ring destroyed with %lu submissions in flight\n",
+        ring.in_flight.size());
+  }
+  vkDestroyBuffer(allocator.device, ring.buffer, nullptr);
+  free_mem(allocator, ring.buffer_mem);
+  ring = StagingRing();
+}
+
+bool staging_alloc(StagingRing& ring, VkDeviceSize size,
+    VkDeviceSize alignment, StagingRegion& out_region) {
+  assert(size <= ring.size);
+  if (ring.used == 0) {
+    ring.head = 0;
+  }
+
+  VkDeviceSize offset = (ring.head + alignment - 1) / alignment * alignment;
+  if (offset + size > ring.size) {
+    // skip the rest of the ring and start again at the front
+    offset = 0;
+  }
+  VkDeviceSize skipped = offset >= ring.head ?
+    offset - ring.head : ring.size - ring.head;
+  VkDeviceSize num_bytes = skipped + size;
+  if (ring.used + num_bytes > ring.size) {
+    return false;
+  }
+
+  ring.head = offset + size;
+  if (ring.head == ring.size) {
+    ring.head = 0;
+  }
+  ring.used += num_bytes;
+  ring.unsubmitted_bytes += num_bytes;
+
+  out_region.buffer = ring.buffer;
+  out_region.offset = offset;
+  out_region.size = size;
+  out_region.data = ring.data + offset;
+  return true;
+}
+
+void staging_submit(StagingRing& ring, uint64_t fence_value) {
+  if (ring.unsubmitted_bytes == 0) {
+    return;
+  }
+  ring.in_flight.push_back({fence_value, ring.unsubmitted_bytes});
+  ring.unsubmitted_bytes = 0;
+}
+
+void staging_retire(StagingRing& ring, uint64_t completed_value) {
+  while (!ring.in_flight.empty() &&
+      ring.in_flight.front().fence_value <= completed_value) {
+    ring.used -= ring.in_flight.front().num_bytes;
+    ring.in_flight.pop_front();
+  }
+}
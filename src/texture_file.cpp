@@ -0,0 +1,119 @@
+#include "texture_file.h"
+#include "mipmaps.h"
+
+#include <cstring>
+#include <fstream>
+
+static uint64_t align_up(uint64_t offset) {
+  return (offset + TEX_FILE_ALIGNMENT - 1) / TEX_FILE_ALIGNMENT *
+    TEX_FILE_ALIGNMENT;
+}
+
+bool bake_texture_file(const string& path, const uint8_t* rgba, uint32_t w,
+    uint32_t h, TexFormat format, bool mips, ThreadPool* threads) {
+  vector<MipLevel> mip_levels;
+  uint32_t num_levels = mips ? mip_level_count(w, h) : 1;
+  VkDeviceSize chain_size = layout_mip_chain(w, h, num_levels, mip_levels);
+  vector<uint8_t> chain((size_t) chain_size);
+  gen_mip_chain(rgba, mip_levels, chain.data());
+
+  TexFileHeader header;
+  memcpy(header.identifier, TEX_FILE_IDENTIFIER, sizeof(header.identifier));
+  header.vk_format = (uint32_t) tex_format_vk(format);
+  header.width = w;
+  header.height = h;
+  header.level_count = num_levels;
+  vector<TexFileLevel> levels(num_levels);
+  uint64_t offset = align_up(sizeof(header) +
+      num_levels * sizeof(TexFileLevel));
+  for (uint32_t i = 0; i < num_levels; ++i) {
+    levels[i].byte_offset = offset;
+    levels[i].byte_length = tex_image_size(format, mip_levels[i].w,
+        mip_levels[i].h);
+    offset = align_up(offset + levels[i].byte_length);
+  }
+
+  vector<uint8_t> bytes((size_t) offset, 0);
+  memcpy(bytes.data(), &header, sizeof(header));
+  memcpy(bytes.data() + sizeof(header), levels.data(),
+      num_levels * sizeof(TexFileLevel));
+  for (uint32_t i = 0; i < num_levels; ++i) {
+    encode_tex_blocks(chain.data() + mip_levels[i].offset, mip_levels[i].w,
+        mip_levels[i].h, format, bytes.data() + levels[i].byte_offset,
+        threads);
+  }
+
+  ofstream file(path, ios::out | ios::binary | ios::trunc);
+  file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  if (!file.good()) {
+    printf("failed to write texture %s\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool open_texture_file(TextureFile& tex, const string& path) {
+  // every level is read once, in order
+  if (!open_mapped_file(tex.file, path, FILE_ACCESS_SEQUENTIAL)) {
+    return false;
+  }
+  uint64_t file_size = tex.file.size;
+
+  TexFileHeader& header = tex.header;
+  if (file_size < sizeof(header)) {
+    printf("%s is not a baked texture\n", path.c_str());
+    close_mapped_file(tex.file);
+    return false;
+  }
+  memcpy(&header, tex.file.data, sizeof(header));
+  if (memcmp(header.identifier, TEX_FILE_IDENTIFIER,
+        sizeof(header.identifier)) != 0 ||
+      !tex_format_from_vk((VkFormat) header.vk_format, tex.format) ||
+      header.width == 0 || header.height == 0 || header.level_count == 0 ||
+      header.level_count > mip_level_count(header.width, header.height)) {
+    printf("%s is not a baked texture\n", path.c_str());
+    close_mapped_file(tex.file);
+    return false;
+  }
+  uint64_t index_size = header.level_count * sizeof(TexFileLevel);
+  bool valid = sizeof(header) + index_size <= file_size;
+  if (valid) {
+    tex.levels.resize(header.level_count);
+    memcpy(tex.levels.data(), tex.file.data + sizeof(header), index_size);
+  }
+  for (uint32_t i = 0; valid && i < header.level_count; ++i) {
+    const TexFileLevel& level = tex.levels[i];
+    valid = level.byte_length == tex_image_size(tex.format,
+        texture_level_width(tex, i), texture_level_height(tex, i)) &&
+      level.byte_offset <= file_size &&
+      level.byte_length <= file_size - level.byte_offset;
+  }
+  if (!valid) {
+    printf("%s is truncated or corrupt\n", path.c_str());
+    close_mapped_file(tex.file);
+    return false;
+  }
+  return true;
+}
+
+void close_texture_file(TextureFile& tex) {
+  close_mapped_file(tex.file);
+  tex.levels.clear();
+}
+
+uint32_t texture_level_width(const TextureFile& tex, uint32_t level) {
+  return std::max(tex.header.width >> level, 1u);
+}
+
+uint32_t texture_level_height(const TextureFile& tex, uint32_t level) {
+  return std::max(tex.header.height >> level, 1u);
+}
+
+const uint8_t* texture_level_data(const TextureFile& tex, uint32_t level) {
+  return tex.file.data + tex.levels[level].byte_offset;
+}
+
+void read_texture_level(const TextureFile& tex, uint32_t level, void* dst) {
+  memcpy(dst, texture_level_data(tex, level),
+      (size_t) tex.levels[level].byte_length);
+}
@@ -0,0 +1,83 @@
+#include "thread_pool.h"
+
+#include <cassert>
+
+static void worker_loop(ThreadPool& pool, uint32_t thread_index) {
+  uint64_t last_job_id = 0;
+  while (true) {
+    {
+      unique_lock<mutex> guard(pool.lock);
+      pool.work_cv.wait(guard, [&] {
+        return pool.stopping || pool.job_id != last_job_id;
+      });
+      if (pool.stopping) {
+        return;
+      }
+      last_job_id = pool.job_id;
+      pool.num_active += 1;
+    }
+
+    // claim tasks until there are none left
+    uint32_t num_finished = 0;
+    while (true) {
+      uint32_t task = pool.next_task.fetch_add(1);
+      if (task >= pool.num_tasks) {
+        break;
+      }
+      pool.task_fn(task, thread_index);
+      num_finished += 1;
+    }
+
+    {
+      lock_guard<mutex> guard(pool.lock);
+      pool.num_done += num_finished;
+      pool.num_active -= 1;
+      if (pool.num_done == pool.num_tasks && pool.num_active == 0) {
+        pool.done_cv.notify_one();
+      }
+    }
+  }
+}
+
+void init_thread_pool(ThreadPool& pool, uint32_t num_threads) {
+  assert(num_threads > 0);
+  pool.stopping = false;
+  for (uint32_t i = 0; i < num_threads; ++i) {
+    pool.threads.push_back(thread(worker_loop, std::ref(pool), i));
+  }
+}
+
+void cleanup_thread_pool(ThreadPool& pool) {
+  {
+    lock_guard<mutex> guard(pool.lock);
+    pool.stopping = true;
+  }
+  pool.work_cv.notify_all();
+  for (thread& t : pool.threads) {
+    t.join();
+  }
+  pool.threads.clear();
+}
+
+uint32_t thread_pool_size(ThreadPool& pool) {
+  return (uint32_t) pool.threads.size();
+}
+
+void thread_pool_run(ThreadPool& pool, uint32_t num_tasks, const TaskFn& fn) {
+  if (num_tasks == 0) {
+    return;
+  }
+  unique_lock<mutex> guard(pool.lock);
+  // a worker that woke late for the previous job may still be claiming
+  // from it, and must leave before its fields are reused
+  pool.done_cv.wait(guard, [&] { return pool.num_active == 0; });
+  pool.task_fn = fn;
+  pool.next_task = 0;
+  pool.num_tasks = num_tasks;
+  pool.num_done = 0;
+  pool.job_id += 1;
+  pool.work_cv.notify_all();
+  pool.done_cv.wait(guard, [&] {
+    return pool.num_done == pool.num_tasks && pool.num_active == 0;
+  });
+}
@@ -0,0 +1,345 @@
+#include "upload.h"
+
+#include <cassert>
+#include <limits>
+
+void init_uploader(Uploader& uploader, VkDevice device,
+    uint32_t queue_family_index, VkQueue queue,
+    uint32_t dst_family_index, VkQueue dst_queue,
+    StagingRing* staging) {
+  uploader.device = device;
+  uploader.queue_family_index = queue_family_index;
+  uploader.queue = queue;
+  uploader.dst_family_index = dst_family_index;
+  uploader.dst_queue = dst_queue;
+  uploader.staging = staging;
+
+  VkCommandPoolCreateInfo cmd_pool_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = queue_family_index
+  };
+  VkResult res = vkCreateCommandPool(device, &cmd_pool_info, nullptr,
+      &uploader.cmd_pool);
+  assert(res == VK_SUCCESS);
+}
+
+void cleanup_uploader(Uploader& uploader) {
+  upload_wait(uploader, upload_ticket(uploader));
+  for (VkFence fence : uploader.free_fences) {
+    vkDestroyFence(uploader.device, fence, nullptr);
+  }
+  // semaphores that were never waited on are still signalled, which is
+  // fine to destroy once the device is idle
+  upload_recycle_semaphores(uploader, uploader.ready_handoff.wait_semas);
+  for (VkSemaphore sema : uploader.free_semas) {
+    vkDestroySemaphore(uploader.device, sema, nullptr);
+  }
+  // destroying the pool frees its command buffers
+  vkDestroyCommandPool(uploader.device, uploader.cmd_pool, nullptr);
+  uploader = Uploader();
+}
+
+VkCommandBuffer upload_cmd_buffer(Uploader& uploader) {
+  if (uploader.cur_cmd_buffer != VK_NULL_HANDLE) {
+    return uploader.cur_cmd_buffer;
+  }
+
+  VkCommandBuffer cmd_buffer;
+  if (!uploader.free_cmd_buffers.empty()) {
+    cmd_buffer = uploader.free_cmd_buffers.back();
+    uploader.free_cmd_buffers.pop_back();
+  } else {
+    VkCommandBufferAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = uploader.cmd_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1
+    };
+    VkResult res = vkAllocateCommandBuffers(uploader.device, &alloc_info,
+        &cmd_buffer);
+    assert(res == VK_SUCCESS);
+  }
+
+  // implicitly resets the buffer, see the pool flags
+  VkCommandBufferBeginInfo begin_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+  };
+  VkResult res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+  assert(res == VK_SUCCESS);
+
+  uploader.cur_cmd_buffer = cmd_buffer;
+  return cmd_buffer;
+}
+
+UploadTicket upload_ticket(Uploader& uploader) {
+  if (uploader.cur_cmd_buffer != VK_NULL_HANDLE) {
+    return uploader.next_ticket;
+  }
+  return uploader.next_ticket - 1;
+}
+
+// Retires the oldest batch. If wait is false it is only retired if its
+// fence has already signalled.
+static bool retire_oldest_batch(Uploader& uploader, bool wait) {
+  assert(!uploader.in_flight.empty());
+  UploadBatch& batch = uploader.in_flight.front();
+  VkResult res;
+  if (wait) {
+    res = vkWaitForFences(uploader.device, 1, &batch.fence, VK_TRUE,
+        std::numeric_limits<uint64_t>::max());
+    assert(res == VK_SUCCESS);
+  } else {
+    res = vkGetFenceStatus(uploader.device, batch.fence);
+    if (res == VK_NOT_READY) {
+      return false;
+    }
+    assert(res == VK_SUCCESS);
+  }
+
+  res = vkResetFences(uploader.device, 1, &batch.fence);
+  assert(res == VK_SUCCESS);
+  uploader.free_fences.push_back(batch.fence);
+  uploader.free_cmd_buffers.push_back(batch.cmd_buffer);
+  uploader.completed_ticket = batch.ticket;
+  if (uploader.staging) {
+    staging_retire(*uploader.staging, batch.ticket);
+  }
+  uploader.in_flight.pop_front();
+  return true;
+}
+
+StagingRegion upload_stage(Uploader& uploader, VkDeviceSize size,
+    VkDeviceSize alignment) {
+  assert(uploader.staging);
+  StagingRegion region;
+  while (!staging_alloc(*uploader.staging, size, alignment, region)) {
+    // regions of the current batch can only be given back once it is
+    // submitted and completes
+    if (uploader.in_flight.empty()) {
+      bool has_pending = uploader.cur_cmd_buffer != VK_NULL_HANDLE;
+      assert(has_pending);
+      upload_flush(uploader);
+    }
+    retire_oldest_batch(uploader, true);
+  }
+  // make sure the region is tagged with the batch that reads it
+  upload_cmd_buffer(uploader);
+  return region;
+}
+
+void upload_release_buffer(Uploader& uploader, VkBuffer buffer,
+    VkPipelineStageFlags dst_stage, VkAccessFlags dst_access) {
+  VkCommandBuffer cmd_buffer = upload_cmd_buffer(uploader);
+  VkBufferMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = dst_access,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .buffer = buffer,
+    .offset = 0,
+    .size = VK_WHOLE_SIZE
+  };
+  if (uploader.queue_family_index == uploader.dst_family_index) {
+    // dst_stage is supported by this queue, a plain barrier will do
+    vkCmdPipelineBarrier(cmd_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage,
+        0,
+        0, nullptr,
+        1, &barrier,
+        0, nullptr);
+    return;
+  }
+
+  barrier.srcQueueFamilyIndex = uploader.queue_family_index;
+  barrier.dstQueueFamilyIndex = uploader.dst_family_index;
+  // the release half only needs the src access, the acquire half only
+  // the dst access
+  VkBufferMemoryBarrier acquire_barrier = barrier;
+  barrier.dstAccessMask = 0;
+  acquire_barrier.srcAccessMask = 0;
+  vkCmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0,
+      0, nullptr,
+      1, &barrier,
+      0, nullptr);
+  uploader.recording_handoff.buffer_barriers.push_back(acquire_barrier);
+  uploader.recording_handoff.dst_stages |= dst_stage;
+}
+
+void upload_release_image(Uploader& uploader, VkImage image,
+    VkImageAspectFlags aspect, VkImageLayout new_layout,
+    VkPipelineStageFlags dst_stage, VkAccessFlags dst_access) {
+  VkCommandBuffer cmd_buffer = upload_cmd_buffer(uploader);
+  VkImageMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = dst_access,
+    .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    .newLayout = new_layout,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = image,
+    .subresourceRange = {
+      .aspectMask = aspect,
+      .baseMipLevel = 0,
+      .levelCount = VK_REMAINING_MIP_LEVELS,
+      .baseArrayLayer = 0,
+      .layerCount = VK_REMAINING_ARRAY_LAYERS
+    }
+  };
+  if (uploader.queue_family_index == uploader.dst_family_index) {
+    vkCmdPipelineBarrier(cmd_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+    return;
+  }
+
+  // both halves perform the same layout transition, it happens once
+  barrier.srcQueueFamilyIndex = uploader.queue_family_index;
+  barrier.dstQueueFamilyIndex = uploader.dst_family_index;
+  VkImageMemoryBarrier acquire_barrier = barrier;
+  barrier.dstAccessMask = 0;
+  acquire_barrier.srcAccessMask = 0;
+  vkCmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0,
+      0, nullptr,
+      0, nullptr,
+      1, &barrier);
+  uploader.recording_handoff.image_barriers.push_back(acquire_barrier);
+  uploader.recording_handoff.dst_stages |= dst_stage;
+}
+
+static void append_handoff(UploadHandoff& dst, UploadHandoff& src) {
+  dst.wait_semas.insert(dst.wait_semas.end(),
+      src.wait_semas.begin(), src.wait_semas.end());
+  dst.buffer_barriers.insert(dst.buffer_barriers.end(),
+      src.buffer_barriers.begin(), src.buffer_barriers.end());
+  dst.image_barriers.insert(dst.image_barriers.end(),
+      src.image_barriers.begin(), src.image_barriers.end());
+  dst.dst_stages |= src.dst_stages;
+  src = UploadHandoff();
+}
+
+UploadTicket upload_flush(Uploader& uploader) {
+  VkCommandBuffer cmd_buffer = uploader.cur_cmd_buffer;
+  if (cmd_buffer == VK_NULL_HANDLE) {
+    return uploader.next_ticket - 1;
+  }
+
+  // make the transfer writes of this batch visible to everything that is
+  // submitted after it
+  VkMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT
+  };
+  vkCmdPipelineBarrier(cmd_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      0,
+      1, &barrier,
+      0, nullptr,
+      0, nullptr);
+  VkResult res = vkEndCommandBuffer(cmd_buffer);
+  assert(res == VK_SUCCESS);
+
+  VkFence fence;
+  if (!uploader.free_fences.empty()) {
+    fence = uploader.free_fences.back();
+    uploader.free_fences.pop_back();
+  } else {
+    VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+    };
+    res = vkCreateFence(uploader.device, &fence_info, nullptr, &fence);
+    assert(res == VK_SUCCESS);
+  }
+
+  // a different queue has to wait for the batch explicitly
+  VkSemaphore signal_sema = VK_NULL_HANDLE;
+  if (uploader.queue != uploader.dst_queue) {
+    if (!uploader.free_semas.empty()) {
+      signal_sema = uploader.free_semas.back();
+      uploader.free_semas.pop_back();
+    } else {
+      VkSemaphoreCreateInfo sema_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+      };
+      res = vkCreateSemaphore(uploader.device, &sema_info, nullptr,
+          &signal_sema);
+      assert(res == VK_SUCCESS);
+    }
+    uploader.recording_handoff.wait_semas.push_back(signal_sema);
+  }
+
+  VkSubmitInfo submit_info = {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &cmd_buffer,
+    .signalSemaphoreCount = signal_sema != VK_NULL_HANDLE ? 1u : 0u,
+    .pSignalSemaphores = &signal_sema
+  };
+  res = vkQueueSubmit(uploader.queue, 1, &submit_info, fence);
+  assert(res == VK_SUCCESS);
+  append_handoff(uploader.ready_handoff, uploader.recording_handoff);
+
+  UploadTicket ticket = uploader.next_ticket;
+  if (uploader.staging) {
+    staging_submit(*uploader.staging, ticket);
+  }
+  uploader.in_flight.push_back({ticket, cmd_buffer, fence});
+  uploader.cur_cmd_buffer = VK_NULL_HANDLE;
+  uploader.next_ticket += 1;
+  return ticket;
+}
+
+bool upload_poll(Uploader& uploader, UploadTicket ticket) {
+  while (!uploader.in_flight.empty() &&
+      retire_oldest_batch(uploader, false)) {
+  }
+  return uploader.completed_ticket >= ticket;
+}
+
+void upload_wait(Uploader& uploader, UploadTicket ticket) {
+  if (ticket >= uploader.next_ticket) {
+    upload_flush(uploader);
+  }
+  while (uploader.completed_ticket < ticket) {
+    retire_oldest_batch(uploader, true);
+  }
+}
+
+void upload_take_handoff(Uploader& uploader, UploadHandoff& out_handoff) {
+  append_handoff(out_handoff, uploader.ready_handoff);
+}
+
+void record_upload_acquire(VkCommandBuffer cmd_buffer,
+    UploadHandoff& handoff) {
+  if (handoff.buffer_barriers.empty() && handoff.image_barriers.empty()) {
+    return;
+  }
+  // the semaphore wait happens at dst_stages, which chains into this
+  vkCmdPipelineBarrier(cmd_buffer,
+      handoff.dst_stages, handoff.dst_stages,
+      0,
+      0, nullptr,
+      (uint32_t) handoff.buffer_barriers.size(),
+      handoff.buffer_barriers.data(),
+      (uint32_t) handoff.image_barriers.size(),
+      handoff.image_barriers.data());
+}
+
+void upload_recycle_semaphores(Uploader& uploader,
+    vector<VkSemaphore>& semas) {
+  uploader.free_semas.insert(uploader.free_semas.end(),
+      semas.begin(), semas.end());
+  semas.clear();
+}
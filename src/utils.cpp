@@ -1,5 +1,7 @@
 #include "utils.h"
 
+#include <cassert>
+
 void handle_segfault(int sig_num) {
   array<void*, 15> frames{};
   int num_frames = backtrace(frames.data(), frames.size());
@@ -31,3 +33,15 @@ string ivec4_str(ivec4 v) {
   return string(s.data());
 }
 
+VkShaderModule create_shader_module(VkDevice& device, const uint8_t* code,
+    size_t code_size) {
+  VkShaderModuleCreateInfo create_info = {
+    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+    .codeSize = code_size,
+    .pCode = reinterpret_cast<const uint32_t*>(code)
+  };
+  VkShaderModule module;
+  VkResult res = vkCreateShaderModule(device, &create_info, nullptr, &module);
+  assert(res == VK_SUCCESS);
+  return module;
+}
@@ -0,0 +1,101 @@
+// Bakes source images into GPU-ready textures with pre-built mips, for
+// setup_texture_image to stream without decoding. Usage:
+//
+//   bake_texture [--format bc1|bc3|bc7|rgba8] [--no-mips] in out.mtex
+
+#include "texture_file.h"
+#include "mipmaps.h"
+#include "thread_pool.h"
+#include "stb_image.h"
+
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+// PSNR of the baked level 0 against the source, over RGBA
+static double level_psnr(const uint8_t* rgba, const uint8_t* blocks,
+    uint32_t w, uint32_t h, TexFormat format) {
+  vector<uint8_t> decoded((size_t) w * h * 4);
+  if (!decode_tex_blocks(blocks, w, h, format, decoded.data())) {
+    return 0.0;
+  }
+  double sq_err = 0.0;
+  for (size_t i = 0; i < decoded.size(); ++i) {
+    // BC1 drops alpha
+    if (format == TEX_FORMAT_BC1 && i % 4 == 3) {
+      continue;
+    }
+    double d = (double) decoded[i] - rgba[i];
+    sq_err += d * d;
+  }
+  double mse = sq_err / decoded.size();
+  return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+}
+
+int main(int argc, char** argv) {
+  TexFormat format = TEX_FORMAT_BC7;
+  bool mips = true;
+  vector<string> paths;
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "--format" && i + 1 < argc) {
+      string name(argv[++i]);
+      format = TEX_FORMAT_COUNT;
+      for (int f = 0; f < TEX_FORMAT_COUNT; ++f) {
+        if (name == tex_format_name((TexFormat) f)) {
+          format = (TexFormat) f;
+        }
+      }
+    } else if (arg == "--no-mips") {
+      mips = false;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (paths.size() != 2 || format == TEX_FORMAT_COUNT) {
+    printf("Incorrect usage. Please use:\n\n"
+        "bake_texture [--format bc1|bc3|bc7|rgba8] [--no-mips] in out%s\n",
+        TEX_FILE_EXTENSION);
+    return 1;
+  }
+
+  int w, h, channels;
+  stbi_uc* pixels = stbi_load(paths[0].c_str(), &w, &h, &channels,
+      STBI_rgb_alpha);
+  if (pixels == nullptr) {
+    printf("failed to load %s: %s\n", paths[0].c_str(),
+        stbi_failure_reason());
+    return 1;
+  }
+
+  ThreadPool threads;
+  init_thread_pool(threads, std::max(1u, thread::hardware_concurrency()));
+  auto start = chrono::steady_clock::now();
+  bool baked = bake_texture_file(paths[1], pixels, (uint32_t) w,
+      (uint32_t) h, format, mips, &threads);
+  chrono::duration<double, milli> elapsed =
+    chrono::steady_clock::now() - start;
+  cleanup_thread_pool(threads);
+
+  TextureFile tex;
+  if (baked && open_texture_file(tex, paths[1])) {
+    vector<MipLevel> levels;
+    VkDeviceSize raw_size = layout_mip_chain((uint32_t) w, (uint32_t) h,
+        tex.header.level_count, levels);
+    uint64_t baked_size = 0;
+    for (const TexFileLevel& level : tex.levels) {
+      baked_size += level.byte_length;
+    }
+    printf("%s: %dx%d %s, %u levels, %.1fKB (rgba8 %.1fKB), "
+        "psnr %.2fdB, %.2fms\n", paths[1].c_str(), w, h,
+        tex_format_name(format), tex.header.level_count,
+        baked_size / 1024.0, raw_size / 1024.0,
+        level_psnr(pixels, texture_level_data(tex, 0), (uint32_t) w,
+          (uint32_t) h, format), elapsed.count());
+    close_texture_file(tex);
+  } else {
+    baked = false;
+  }
+  stbi_image_free(pixels);
+  return baked ? 0 : 1;
+}